@@ -0,0 +1,51 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+/* Interlocked operations on 32-bit words. gcc's __sync builtins aren't
+ * available on the Interix compiler, so these are done by hand. They all
+ * return the value the word had before the operation.
+ */
+
+class Atomic
+{
+public:
+	static inline u32 CompareAndSwap(volatile u32* p, u32 oldvalue,
+			u32 newvalue)
+	{
+		u32 previous;
+		asm volatile (
+			"lock; cmpxchgl %2, %1"
+			: "=a" (previous), "+m" (*p)
+			: "r" (newvalue), "0" (oldvalue)
+			: "memory", "cc");
+		return previous;
+	}
+
+	static inline u32 Add(volatile u32* p, u32 delta)
+	{
+		asm volatile (
+			"lock; xaddl %0, %1"
+			: "+r" (delta), "+m" (*p)
+			:
+			: "memory", "cc");
+		return delta;
+	}
+
+	static inline u32 Exchange(volatile u32* p, u32 value)
+	{
+		/* xchg with memory is implicitly locked. */
+		asm volatile (
+			"xchgl %0, %1"
+			: "+r" (value), "+m" (*p)
+			:
+			: "memory");
+		return value;
+	}
+};
+
+#endif
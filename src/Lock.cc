@@ -0,0 +1,327 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "Lock.h"
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+
+using std::vector;
+using std::sort;
+using std::max;
+
+/* The list of all locks. This is statically initialised, so it's safe to
+ * use from other statics' constructors. */
+
+static pthread_mutex_t registry = PTHREAD_MUTEX_INITIALIZER;
+static BaseLock* locks = NULL;
+
+BaseLock::BaseLock(const char* name):
+	_name(name),
+	_acquisitions(0),
+	_contended(0),
+	_waited(0),
+	_held(0),
+	_maxheld(0),
+	_prev(NULL)
+{
+	memset(_sites, 0, sizeof(_sites));
+
+	pthread_mutex_lock(&registry);
+	_next = locks;
+	if (_next)
+		_next->_prev = this;
+	locks = this;
+	pthread_mutex_unlock(&registry);
+}
+
+BaseLock::~BaseLock()
+{
+	pthread_mutex_lock(&registry);
+	if (_prev)
+		_prev->_next = _next;
+	else
+		locks = _next;
+	if (_next)
+		_next->_prev = _prev;
+	pthread_mutex_unlock(&registry);
+}
+
+/* Only call this when there's just one thread, i.e. just after fork(). */
+void BaseLock::ReinitAll()
+{
+	pthread_mutex_init(&registry, NULL);
+
+	for (BaseLock* l = locks; l; l = l->_next)
+		l->init();
+}
+
+/* --- Statistics --------------------------------------------------------- */
+
+/* In microseconds. */
+u_int64_t BaseLock::now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (u_int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void BaseLock::acquired(void* caller, bool contended, u_int64_t waited)
+{
+	_acquisitions++;
+	if (!contended)
+		return;
+
+	_contended++;
+	_waited += waited;
+
+	/* Find (or make) the slot for this call site. If we run out, the last
+	 * slot collects everything else. */
+
+	int i;
+	for (i = 0; i < (MAX_SITES-1); i++)
+	{
+		if (_sites[i].caller == caller)
+			break;
+		if (!_sites[i].caller)
+		{
+			_sites[i].caller = caller;
+			break;
+		}
+	}
+
+	_sites[i].count++;
+	_sites[i].waited += waited;
+}
+
+void BaseLock::released(u_int64_t held)
+{
+	_held += held;
+	_maxheld = max(_maxheld, held);
+}
+
+void BaseLock::report()
+{
+	log("lockstats: %s (%p): %u acquisitions, %u contended, "
+			"%llu us waiting, %llu us held (max %llu us)",
+			_name ? _name : "unnamed", this,
+			_acquisitions, _contended,
+			_waited, _held, _maxheld);
+
+	/* Show the worst few call sites. There are so few that a selection
+	 * sort will do. */
+
+	bool shown[MAX_SITES];
+	memset(shown, 0, sizeof(shown));
+
+	for (int n = 0; n < 5; n++)
+	{
+		int worst = -1;
+		for (int i = 0; i < MAX_SITES; i++)
+		{
+			if (shown[i] || !_sites[i].count)
+				continue;
+			if ((worst == -1) || (_sites[i].waited > _sites[worst].waited))
+				worst = i;
+		}
+		if (worst == -1)
+			break;
+
+		shown[worst] = true;
+		const Site& s = _sites[worst];
+		if (worst == (MAX_SITES-1))
+			log("lockstats:     (other callers): %u waits, %llu us",
+					s.count, s.waited);
+		else
+			log("lockstats:     called from %p: %u waits, %llu us",
+					s.caller, s.count, s.waited);
+	}
+}
+
+/* Called at exit if --lockstats is set. The most contended locks come
+ * first. */
+void BaseLock::ReportAll()
+{
+	vector<BaseLock*> used;
+
+	pthread_mutex_lock(&registry);
+	for (BaseLock* l = locks; l; l = l->_next)
+		if (l->_acquisitions)
+			used.push_back(l);
+	pthread_mutex_unlock(&registry);
+
+	sort(used.begin(), used.end(), by_waited);
+	for (vector<BaseLock*>::const_iterator i = used.begin(); i != used.end(); i++)
+		(*i)->report();
+}
+
+bool BaseLock::by_waited(BaseLock* a, BaseLock* b)
+{
+	return a->_waited > b->_waited;
+}
+
+/* --- Mutexes ------------------------------------------------------------ */
+
+Mutex::Mutex(const char* name, bool recursive):
+	BaseLock(name),
+	_recursive(recursive)
+{
+	init();
+}
+
+Mutex::~Mutex()
+{
+	pthread_mutex_destroy(&_mutex);
+}
+
+void Mutex::init()
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	if (_recursive)
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+	int i = pthread_mutex_init(&_mutex, &attr);
+	if (i)
+		error("Failed to init mutex: %d!", i);
+
+	pthread_mutexattr_destroy(&attr);
+	_depth = 0;
+}
+
+void Mutex::Lock(void* caller)
+{
+	if (!Options.LockStats)
+	{
+		pthread_mutex_lock(&_mutex);
+		return;
+	}
+
+	bool contended = false;
+	u_int64_t waited = 0;
+	if (pthread_mutex_trylock(&_mutex) != 0)
+	{
+		contended = true;
+		u_int64_t start = now();
+		pthread_mutex_lock(&_mutex);
+		waited = now() - start;
+	}
+
+	/* We now own the lock, and therefore the statistics. */
+
+	if (!caller)
+		caller = __builtin_return_address(0);
+	acquired(caller, contended, waited);
+	if (_depth++ == 0)
+		_heldsince = now();
+}
+
+void Mutex::Unlock()
+{
+	if (Options.LockStats && (_depth > 0))
+	{
+		if (--_depth == 0)
+			released(now() - _heldsince);
+	}
+
+	pthread_mutex_unlock(&_mutex);
+}
+
+/* --- Reader/writer locks ------------------------------------------------ */
+
+RWLock::RWLock(const char* name):
+	BaseLock(name)
+{
+	init();
+}
+
+RWLock::~RWLock()
+{
+	pthread_rwlock_destroy(&_rwlock);
+	pthread_mutex_destroy(&_statslock);
+}
+
+void RWLock::init()
+{
+	int i = pthread_rwlock_init(&_rwlock, NULL);
+	if (i)
+		error("Failed to init rwlock: %d!", i);
+
+	pthread_mutex_init(&_statslock, NULL);
+	_writing = false;
+}
+
+void RWLock::ReadLock(void* caller)
+{
+	if (!Options.LockStats)
+	{
+		pthread_rwlock_rdlock(&_rwlock);
+		return;
+	}
+
+	bool contended = false;
+	u_int64_t waited = 0;
+	if (pthread_rwlock_tryrdlock(&_rwlock) != 0)
+	{
+		contended = true;
+		u_int64_t start = now();
+		pthread_rwlock_rdlock(&_rwlock);
+		waited = now() - start;
+	}
+
+	/* Other readers may be in here too. */
+
+	if (!caller)
+		caller = __builtin_return_address(0);
+	pthread_mutex_lock(&_statslock);
+	acquired(caller, contended, waited);
+	pthread_mutex_unlock(&_statslock);
+}
+
+void RWLock::WriteLock(void* caller)
+{
+	if (!Options.LockStats)
+	{
+		pthread_rwlock_wrlock(&_rwlock);
+		return;
+	}
+
+	bool contended = false;
+	u_int64_t waited = 0;
+	if (pthread_rwlock_trywrlock(&_rwlock) != 0)
+	{
+		contended = true;
+		u_int64_t start = now();
+		pthread_rwlock_wrlock(&_rwlock);
+		waited = now() - start;
+	}
+
+	if (!caller)
+		caller = __builtin_return_address(0);
+	pthread_mutex_lock(&_statslock);
+	acquired(caller, contended, waited);
+	_writing = true;
+	_heldsince = now();
+	pthread_mutex_unlock(&_statslock);
+}
+
+void RWLock::Unlock()
+{
+	if (Options.LockStats)
+	{
+		/* If there's a writer, it must be us. */
+
+		pthread_mutex_lock(&_statslock);
+		if (_writing)
+		{
+			_writing = false;
+			released(now() - _heldsince);
+		}
+		pthread_mutex_unlock(&_statslock);
+	}
+
+	pthread_rwlock_unlock(&_rwlock);
+}
@@ -0,0 +1,167 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+/* LBW's internal locks. Each subsystem has its own rather than everything
+ * sharing one big process lock.
+ *
+ * After a fork() only the calling thread survives, so any lock that was
+ * held by another thread would stay held forever. To avoid this, every lock
+ * puts itself on a list and InitProcess() reinitialises the lot in the
+ * child. Most locks are statics that live for the whole process; any that
+ * don't must never be destroyed while held.
+ *
+ * If --lockstats is on, each lock also keeps track of how it's used, and
+ * ReportAll() dumps the lot at exit. Hold times are only measured for
+ * exclusive holders.
+ */
+
+class BaseLock
+{
+public:
+	BaseLock(const char* name);
+	virtual ~BaseLock();
+
+	static void ReinitAll();
+	static void ReportAll();
+
+protected:
+	virtual void init() = 0;
+
+	/* Caller must have exclusive access to the statistics. */
+	void acquired(void* caller, bool contended, u_int64_t waited);
+	void released(u_int64_t held);
+
+	static u_int64_t now();
+
+private:
+	void report();
+	static bool by_waited(BaseLock* a, BaseLock* b);
+
+	enum { MAX_SITES = 16 };
+
+	struct Site
+	{
+		void* caller;
+		u_int32_t count;
+		u_int64_t waited;
+	};
+
+	const char* _name;
+	u_int32_t _acquisitions;
+	u_int32_t _contended;
+	u_int64_t _waited;
+	u_int64_t _held;
+	u_int64_t _maxheld;
+	Site _sites[MAX_SITES];
+
+	BaseLock* _prev;
+	BaseLock* _next;
+};
+
+class Mutex : public BaseLock
+{
+public:
+	Mutex(const char* name = NULL, bool recursive = false);
+	~Mutex();
+
+	/* caller is only used for the statistics; if it's NULL, whoever
+	 * called Lock() is used. */
+	void Lock(void* caller = NULL);
+	void Unlock();
+
+protected:
+	void init();
+
+private:
+	pthread_mutex_t _mutex;
+	bool _recursive;
+	int _depth;
+	u_int64_t _heldsince;
+};
+
+class RWLock : public BaseLock
+{
+public:
+	RWLock(const char* name = NULL);
+	~RWLock();
+
+	void ReadLock(void* caller = NULL);
+	void WriteLock(void* caller = NULL);
+	void Unlock();
+
+protected:
+	void init();
+
+private:
+	pthread_rwlock_t _rwlock;
+	pthread_mutex_t _statslock;
+	bool _writing;
+	u_int64_t _heldsince;
+};
+
+/* These are never inlined, so that the lock statistics see the real call
+ * site rather than the inside of the constructor. */
+
+class RAIILock
+{
+public:
+	__attribute__ ((noinline)) RAIILock(Mutex& mutex):
+		_mutex(mutex)
+	{
+		_mutex.Lock(__builtin_return_address(0));
+	}
+
+	~RAIILock()
+	{
+		_mutex.Unlock();
+	}
+
+private:
+	Mutex& _mutex;
+};
+
+class RAIIReadLock
+{
+public:
+	__attribute__ ((noinline)) RAIIReadLock(RWLock& rwlock):
+		_rwlock(rwlock)
+	{
+		_rwlock.ReadLock(__builtin_return_address(0));
+	}
+
+	~RAIIReadLock()
+	{
+		_rwlock.Unlock();
+	}
+
+private:
+	RWLock& _rwlock;
+};
+
+class RAIIWriteLock
+{
+public:
+	__attribute__ ((noinline)) RAIIWriteLock(RWLock& rwlock):
+		_rwlock(rwlock)
+	{
+		_rwlock.WriteLock(__builtin_return_address(0));
+	}
+
+	~RAIIWriteLock()
+	{
+		_rwlock.Unlock();
+	}
+
+private:
+	RWLock& _rwlock;
+};
+
+#endif
@@ -6,6 +6,13 @@
 #ifndef REF_H
 #define REF_H
 
+#include "Atomic.h"
+
+/* Reference counts are shared between threads, so they're updated with
+ * locked instructions. On x86 these are full barriers, so whoever drops the
+ * last reference sees every write made by the other holders.
+ */
+
 class HasRefCount
 {
 public:
@@ -20,18 +27,17 @@ public:
 
 	void Reference()
 	{
-		_refcount++;
+		Atomic::Add(&_refcount, 1);
 	}
 
 	void Dereference()
 	{
-		_refcount--;
-		if (_refcount == 0)
+		if (Atomic::Add(&_refcount, (u32) -1) == 1)
 			delete this;
 	}
 
 private:
-	unsigned int _refcount;
+	volatile u32 _refcount;
 };
 
 template <class T> class Ref
@@ -71,6 +77,14 @@ public:
 		return *this = other._object;
 	}
 
+	/* Exchanges two references without touching either count. */
+	void Swap(Ref<T>& other)
+	{
+		T* t = _object;
+		_object = other._object;
+		other._object = t;
+	}
+
 	bool operator == (const Ref<T>& other) const
 	{
 		return _object == other._object;
@@ -0,0 +1,170 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "TimerThread.h"
+#include "filesystem/FDSet.h"
+#include <sys/time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <vector>
+#include <algorithm>
+
+using std::vector;
+using std::find;
+
+//#define VERBOSE
+
+#if defined VERBOSE
+#define LOG log
+#else
+#define LOG(...)
+#endif
+
+/* The timer thread is woken up by writing a byte down a pipe whenever a
+ * client's deadline changes. */
+
+static int wakefds[2] = { -1, -1 };
+static bool timerrunning = false;
+static Mutex timerlock("timer thread");
+static vector<TimerThread::Client*> clients;
+
+int64_t TimerThread::Now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void TimerThread::Add(Client* client)
+{
+	RAIILock locked(timerlock);
+
+	clients.push_back(client);
+	if (!timerrunning)
+		start();
+	write(wakefds[1], "", 1);
+}
+
+void TimerThread::Remove(Client* client)
+{
+	RAIILock locked(timerlock);
+
+	vector<Client*>::iterator i = find(clients.begin(), clients.end(), client);
+	if (i != clients.end())
+		clients.erase(i);
+}
+
+void TimerThread::Changed()
+{
+	RAIILock locked(timerlock);
+
+	if (timerrunning)
+		write(wakefds[1], "", 1);
+}
+
+/* Call with timerlock held. */
+void TimerThread::start()
+{
+	if (pipe(wakefds) == -1)
+		error("unable to create timer thread wakeup pipe: %d", errno);
+	for (int i = 0; i < 2; i++)
+	{
+		fcntl(wakefds[i], F_SETFD, FD_CLOEXEC);
+		fcntl(wakefds[i], F_SETFL, O_NONBLOCK);
+	}
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	pthread_t timer;
+	int i = pthread_create(&timer, &attr, timer_cb, NULL);
+	pthread_attr_destroy(&attr);
+	if (i != 0)
+		error("unable to start timer thread: %d", i);
+
+	timerrunning = true;
+}
+
+void* TimerThread::timer_cb(void* user)
+{
+	/* Guest signals mustn't be delivered here. */
+
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	timer_main();
+	return NULL;
+}
+
+void TimerThread::timer_main()
+{
+	LOG("timer thread started");
+
+	for (;;)
+	{
+		int64_t deadline = -1;
+		int wakefd;
+		{
+			RAIILock locked(timerlock);
+			for (unsigned i = 0; i < clients.size(); i++)
+			{
+				int64_t d = clients[i]->GetDeadline();
+				if ((d != -1) && ((deadline == -1) || (d < deadline)))
+					deadline = d;
+			}
+			wakefd = wakefds[0];
+		}
+
+		struct timeval tv;
+		if (deadline != -1)
+		{
+			int64_t delay = deadline - Now();
+			if (delay < 0)
+				delay = 0;
+			tv.tv_sec = delay / 1000000;
+			tv.tv_usec = delay % 1000000;
+		}
+
+		FDSet reads;
+		reads.Set(wakefd);
+		int n = select(wakefd+1, reads.Get(), NULL, NULL,
+				(deadline == -1) ? NULL : &tv);
+		if ((n == -1) && (errno != EINTR))
+			error("timer thread select failed: %d", errno);
+
+		char buffer[64];
+		while (read(wakefd, buffer, sizeof(buffer)) > 0)
+			;
+
+		RAIILock locked(timerlock);
+		int64_t now = Now();
+		for (unsigned i = 0; i < clients.size(); i++)
+		{
+			Client* c = clients[i];
+			int64_t d = c->GetDeadline();
+			if ((d != -1) && (d <= now))
+				c->Expire(now);
+		}
+	}
+}
+
+/* Called in a new process. After fork() the timer thread doesn't exist any
+ * more; the clients do, so restart it if there are any. */
+void TimerThread::Init()
+{
+	if (!timerrunning)
+		return;
+
+	close(wakefds[0]);
+	close(wakefds[1]);
+	wakefds[0] = wakefds[1] = -1;
+	timerrunning = false;
+
+	if (!clients.empty())
+		start();
+}
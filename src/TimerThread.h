@@ -0,0 +1,46 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef TIMERTHREAD_H
+#define TIMERTHREAD_H
+
+/* A single thread per process which wakes up whatever needs waking up at a
+ * given time, so that timerfds and friends don't each need a thread of
+ * their own. It's started when the first client is added.
+ *
+ * Clients are called with the timer lock held, so they mustn't call back
+ * into TimerThread from GetDeadline() or Expire().
+ */
+
+class TimerThread
+{
+public:
+	class Client
+	{
+	public:
+		virtual ~Client() {}
+
+		/* Absolute time (see Now()) at which Expire() should next be
+		 * called, or -1 if there isn't one. */
+		virtual int64_t GetDeadline() = 0;
+		virtual void Expire(int64_t now) = 0;
+	};
+
+	static void Add(Client* client);
+	static void Remove(Client* client);
+	static void Changed();
+
+	/* Microseconds. CLOCK_MONOTONIC is the same as CLOCK_REALTIME here. */
+	static int64_t Now();
+
+	static void Init();
+
+private:
+	static void start();
+	static void* timer_cb(void* user);
+	static void timer_main();
+};
+
+#endif
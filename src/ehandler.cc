@@ -7,6 +7,9 @@
 #include "MemOp.h"
 #include "syscalls/mmap.h"
 #include <sys/mman.h>
+#include <set>
+
+using std::set;
 
 #define RET 0xc3
 
@@ -136,6 +139,8 @@ extern "C" void* __stdcall RtlAddVectoredExceptionHandler(u32 first,
 asm ("_RtlAddVectoredExceptionHandler: jmp _RtlAddVectoredExceptionHandler@8");
 
 static pthread_key_t linear_key = 0;
+static pthread_key_t gs_key = 0;
+static pthread_key_t trampoline_key = 0;
 
 void InitGSStore()
 {
@@ -145,13 +150,31 @@ void InitGSStore()
 	 */
 
 	if (linear_key == 0)
+	{
 		pthread_key_create(&linear_key, NULL);
+		pthread_key_create(&gs_key, NULL);
+		pthread_key_create(&trampoline_key, NULL);
+	}
 }
 
+/* The linear address is also stored in the TEB's ArbitraryUserPointer slot,
+ * %fs:0x14, where generated code can get at it cheaply (see
+ * relocate_gs_instruction()). */
 void SetGS(u_int16_t gs, void* linear)
 {
-	//pthread_setspecific(gs_key, (void*) gs);
+	pthread_setspecific(gs_key, (void*) (u32) gs);
 	pthread_setspecific(linear_key, linear);
+	asm volatile ("movl %0, %%fs:0x14" : : "r" (linear));
+}
+
+u32 GetGS()
+{
+	return (u32) pthread_getspecific(gs_key);
+}
+
+void* GetGSLinear()
+{
+	return pthread_getspecific(linear_key);
 }
 
 void printregs(CONTEXT& regs)
@@ -388,6 +411,16 @@ static u32 translate_gs_instruction(CONTEXT& regs, u8* buffer)
 	}
 }
 
+/* Protects the fragment allocator and the code we're patching. */
+static Mutex handlerlock("exception handler", true);
+
+static set<u32> fragmentblocks;
+
+static bool isFragment(u32 address)
+{
+	return fragmentblocks.find(address & ~0xffff) != fragmentblocks.end();
+}
+
 static u8* allocateFragment(u32 size)
 {
 	static u8* block = NULL;
@@ -407,6 +440,7 @@ static u8* allocateFragment(u32 size)
 
 		block = (u8*) result;
 		index = 0;
+		fragmentblocks.insert((u32) block);
 	}
 
 	u8* addr = block + index;
@@ -420,16 +454,133 @@ static void writeJumpInstruction(u32 target, u32 address)
 	MemOp::Store<u32>((u32)(target - address - 5), address+1);
 }
 
+/* Rewrites a %gs instruction so that it works for any thread: the
+ * thread's GS base is loaded from %fs:0x14 into a scratch register, and the
+ * instruction addresses memory relative to that instead. Returns the length
+ * of the code, or 0 if the instruction can't be done this way.
+ */
+static u32 relocate_gs_instruction(u32 ibegin, u32 ilen, u8* out)
+{
+	u8* in = (u8*) ibegin;
+	u8* end = in + ilen;
+	bool locked = false;
+
+	if (*in == 0xf0)
+	{
+		locked = true;
+		in++;
+	}
+	if (*in++ != 0x65)
+		return 0;
+
+	u8 opcode[2];
+	u32 opcodelen = 1;
+	u8 modrm;
+	if ((*in >= 0xa0) && (*in <= 0xa3))
+	{
+		/* The moffs forms of mov become the modrm forms, with an
+		 * absolute address and %eax/%al as the register. */
+
+		static const u8 modrmforms[4] = { 0x8a, 0x8b, 0x88, 0x89 };
+		opcode[0] = modrmforms[*in++ - 0xa0];
+		modrm = 0x05;
+	}
+	else
+	{
+		opcode[0] = *in++;
+		if (opcode[0] == 0x0f)
+		{
+			opcode[1] = *in++;
+			opcodelen = 2;
+		}
+		modrm = *in++;
+	}
+
+	int mod = modrm >> 6;
+	int reg = (modrm >> 3) & 7;
+	int rm = modrm & 7;
+
+	/* Only [disp32], [reg] and [reg+disp32] are translated at all. */
+
+	if ((mod == 1) || (mod == 3) || (rm == 4))
+		return 0;
+	bool absolute = (mod == 0) && (rm == 5);
+
+	u32 disp = 0;
+	if ((mod == 2) || absolute)
+		disp = MemOp::LoadAndAdvance<u32>(in);
+
+	/* For the groups, reg is part of the opcode. Otherwise it's a register
+	 * operand, which mustn't be the scratch register or %esp (which the
+	 * scratch register is saved on). Byte registers 4-7 are the high
+	 * halves of registers 0-3. */
+
+	bool group = (opcode[0] == 0x81) || (opcode[0] == 0x83) ||
+			(opcode[0] == 0xc6) || (opcode[0] == 0xc7);
+	bool byteop = (opcode[0] == 0x88) || (opcode[0] == 0x8a) ||
+			(opcode[0] == 0xc6);
+	if (!group && !byteop && (reg == 4))
+		return 0;
+
+	/* %eax is never used, as cmpxchg uses it implicitly. */
+
+	int scratch = 1;
+	while ((!group && ((scratch == reg) || (scratch == (reg & 3)))) ||
+			(!absolute && (scratch == rm)))
+		scratch++;
+
+	u8* p = out;
+	MemOp::Store<u8>(0x50 + scratch, p++);         // push scratch
+	MemOp::Store<u8>(0x64, p++);                   // fs:
+	MemOp::Store<u8>(0x8b, p++);                   // mov Gv, Ev
+	MemOp::Store<u8>((scratch << 3) | 5, p++);     // scratch, [disp32]
+	MemOp::Store<u32>(0x14, p); p += 4;
+
+	if (locked)
+		MemOp::Store<u8>(0xf0, p++);
+	memcpy(p, opcode, opcodelen);
+	p += opcodelen;
+
+	if (absolute)
+	{
+		MemOp::Store<u8>(0x80 | (reg << 3) | scratch, p++); // [scratch+disp32]
+		MemOp::Store<u32>(disp, p); p += 4;
+	}
+	else
+	{
+		MemOp::Store<u8>((mod << 6) | (reg << 3) | 4, p++); // SIB follows
+		MemOp::Store<u8>((rm << 3) | scratch, p++);        // [scratch+rm]
+		if (mod == 2)
+		{
+			MemOp::Store<u32>(disp, p); p += 4;
+		}
+	}
+
+	/* Anything left is an immediate. */
+
+	memcpy(p, in, end - in);
+	p += end - in;
+
+	MemOp::Store<u8>(0x58 + scratch, p++);         // pop scratch
+	return p - out;
+}
+
 static s32 copy_or_jump(EXCEPTION_POINTERS* ep, u32 ibegin, u32 ilen,
 		u8* trampoline, u32 olen)
 {
-	if (ilen >= 5)
+	u8 relocated[32];
+	u32 rlen = 0;
+	if ((ilen >= 5) && !isFragment(ibegin))
+		rlen = relocate_gs_instruction(ibegin, ilen, relocated);
+
+	if (rlen)
 	{
 		/* The original instruction is big enough that we can patch a
 		 * JMP instruction into it, permanently changing it to point
-		 * at our new piece of trampoline code. This means we avoid
-		 * the page fault and context switch next time we hit this
-		 * instruction.
+		 * at a rewritten copy of it. This means we avoid the page
+		 * fault and context switch next time any thread hits this
+		 * instruction. (The trampoline has this thread's GS base baked
+		 * into it, so can't be used.)
 		 */
 
 		try
@@ -438,10 +589,9 @@ static s32 copy_or_jump(EXCEPTION_POINTERS* ep, u32 ibegin, u32 ilen,
 
 			MakeWriteable((u8*) ibegin, 5);
 
-			/* Copy the generated code into its own fragment. */
-
-			u8* fragment = allocateFragment(olen);
-			memcpy(fragment, trampoline, olen);
+			u8* fragment = allocateFragment(rlen + 5);
+			memcpy(fragment, relocated, rlen);
+			writeJumpInstruction(ibegin + ilen, (u32) fragment + rlen);
 
 			writeJumpInstruction((u32) fragment, ibegin);
 			ep->ContextRecord->Eip = (u32) fragment;
@@ -457,16 +607,29 @@ static s32 copy_or_jump(EXCEPTION_POINTERS* ep, u32 ibegin, u32 ilen,
 			Warning("ehandler fragment copy failed with errno %d", e);
 		}
 	}
-	else
-		ep->ContextRecord->Eip = (u32) trampoline;
+
+	ep->ContextRecord->Eip = (u32) trampoline;
 	return EXCEPTION_CONTINUE_EXECUTION;
 
 }
 
+/* Each thread needs its own trampoline, as another thread may fault
+ * between us filling it in and running it. */
+static u8* getTrampoline()
+{
+	u8* trampoline = (u8*) pthread_getspecific(trampoline_key);
+	if (!trampoline)
+	{
+		trampoline = allocateFragment(32);
+		pthread_setspecific(trampoline_key, trampoline);
+	}
+	return trampoline;
+}
+
 static s32 __stdcall handler_cb(EXCEPTION_POINTERS* ep)
 {
-	RAIILock locked;
-	static u8* trampoline = allocateFragment(32);
+	RAIILock locked(handlerlock);
+	u8* trampoline = getTrampoline();
 
 	if (ep->ExceptionRecord->ExceptionCode == EXCEPTION_PRIV_INSTRUCTION)
 		printregs(*ep->ContextRecord);
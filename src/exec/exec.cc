@@ -45,7 +45,7 @@ static void linux_exec(const string& pathname, const char* argv[], const char* e
 	while (environ[envc])
 		envc++;
 
-	const char* newenviron[envc + 8];
+	const char* newenviron[envc + 10];
 	memset(newenviron, 0, sizeof(newenviron));
 
 	int index = 0;
@@ -59,6 +59,10 @@ static void linux_exec(const string& pathname, const char* argv[], const char* e
 		newenviron[index++] = "LBW_WARNINGS=1";
 	if (Options.ForceLoad)
 		newenviron[index++] = "LBW_FORCELOAD=1";
+	if (Options.MemStats)
+		newenviron[index++] = "LBW_MEMSTATS=1";
+	if (Options.LockStats)
+		newenviron[index++] = "LBW_LOCKSTATS=1";
 
 	if (!Options.Chroot.empty())
 	{
@@ -181,8 +185,10 @@ void Exec(const string& pathname, const char* argv[], const char* environ[])
 
 	try
 	{
-		/* Change the Interix directory. */
+		/* Change the Interix directory, and keep other threads from
+		 * changing it again before we're gone. */
 
+		RAIILock locked(InterixVFSNode::CWDLock);
 		Ref<VFSNode> node = VFS::GetCWDNode();
 		InterixVFSNode* inode = dynamic_cast<InterixVFSNode*>((VFSNode*) node);
 		if (inode)
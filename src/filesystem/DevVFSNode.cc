@@ -9,6 +9,7 @@
 #include "filesystem/DevVFSNode.h"
 #include "filesystem/PtsVFSNode.h"
 #include "filesystem/FakeFile.h"
+#include "syscalls/ipc.h"
 #include <sys/types.h>
 #include <dirent.h>
 
@@ -44,6 +45,11 @@ DevVFSNode::DevVFSNode(VFSNode* parent, const string& name):
 
 	AddFile(new TunnelledFakeDirectory("fs", "/dev/fs"));
 
+	/* POSIX shared memory objects are just files in here, which
+	 * shm_open() users then mmap() MAP_SHARED. */
+
+	AddFile(new TunnelledFakeDirectory("shm", GetIPCDirectory("shm")));
+
 	/* Add any /dev/pty* and /dev/tty* devices we can see. */
 
 	DIR* d = opendir("/dev");
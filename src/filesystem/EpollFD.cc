@@ -0,0 +1,454 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "filesystem/EpollFD.h"
+#include <sys/time.h>
+#include <algorithm>
+
+using std::max;
+
+//#define VERBOSE
+
+#if defined VERBOSE
+#define LOG log
+#else
+#define LOG(...)
+#endif
+
+/* Protects the interest sets of all epoll instances, and the parked map.
+ * It's never held while waiting. */
+static Mutex epolllock("epoll");
+
+/* Every parked edge-triggered interest, by FD. */
+EpollFD::ParkedMap EpollFD::_parked;
+
+EpollFD::EpollFD(int fd):
+	FD(fd),
+	_waiters(0)
+{
+	/* Changes made to the interest set while another thread is waiting are
+	 * signalled through this pipe. Without it, they'd only be noticed on
+	 * the next call. */
+
+	if (pipe(_wakepipe) == -1)
+	{
+		Warning("unable to create epoll wakeup pipe: %d", errno);
+		_wakepipe[0] = _wakepipe[1] = -1;
+		return;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		fcntl(_wakepipe[i], F_SETFD, 1);
+		fcntl(_wakepipe[i], F_SETFL, O_NONBLOCK);
+	}
+}
+
+EpollFD::~EpollFD()
+{
+	{
+		RAIILock locked(epolllock);
+		for (Interests::iterator ii = _interests.begin();
+				ii != _interests.end(); ii++)
+			unpark(ii->first, ii->second);
+	}
+
+	if (_wakepipe[0] != -1)
+	{
+		close(_wakepipe[0]);
+		close(_wakepipe[1]);
+	}
+}
+
+/* Call with epolllock held. */
+void EpollFD::arm(int fd, Interest& i, u32 events)
+{
+	i.armed = events;
+
+	if (events & LINUX_EPOLLIN)
+		_reads.Set(fd);
+	else
+		_reads.Clear(fd);
+
+	_writes.Clear(fd);
+	_polledwrites.Clear(fd);
+	if (events & LINUX_EPOLLOUT)
+	{
+		if (i.fdo->SelectsForWrite())
+			_writes.Set(fd);
+		else
+			_polledwrites.Set(fd);
+	}
+
+	if (events & LINUX_EPOLLPRI)
+		_excepts.Set(fd);
+	else
+		_excepts.Clear(fd);
+}
+
+/* Call with epolllock held. */
+void EpollFD::forget(Interests::iterator i)
+{
+	int fd = i->first;
+	LOG("epoll %d: forgetting fd %d", GetFD(), fd);
+
+	unpark(fd, i->second);
+	_reads.Clear(fd);
+	_writes.Clear(fd);
+	_polledwrites.Clear(fd);
+	_excepts.Clear(fd);
+	_interests.erase(i);
+}
+
+/* The FD is parked before its I/O count is looked at, and Touch() bumps the
+ * count before looking to see if it's parked; so any I/O after this is
+ * either noticed here or calls Touched(). Call with epolllock held. */
+void EpollFD::park(int fd, Interest& i)
+{
+	if (i.suppressed)
+		return;
+
+	i.suppressed = true;
+	i.fdo->Park();
+
+	Parked p;
+	p.epoll = this;
+	p.fd = fd;
+	_parked.insert(ParkedMap::value_type(i.fdo, p));
+
+	if (i.fdo->GetIOCount() != i.iocount)
+	{
+		unpark(fd, i);
+		arm(fd, i, i.events);
+	}
+}
+
+/* Call with epolllock held. */
+void EpollFD::unpark(int fd, Interest& i)
+{
+	if (!i.suppressed)
+		return;
+
+	i.suppressed = false;
+	i.fdo->Unpark();
+
+	std::pair<ParkedMap::iterator, ParkedMap::iterator> r =
+			_parked.equal_range(i.fdo);
+	for (ParkedMap::iterator pi = r.first; pi != r.second; pi++)
+	{
+		if ((pi->second.epoll == this) && (pi->second.fd == fd))
+		{
+			_parked.erase(pi);
+			break;
+		}
+	}
+}
+
+/* Puts back every edge-triggered interest parked on fdo. */
+void EpollFD::Touched(FD* fdo)
+{
+	RAIILock locked(epolllock);
+
+	std::pair<ParkedMap::iterator, ParkedMap::iterator> r =
+			_parked.equal_range(fdo);
+	ParkedMap::iterator pi = r.first;
+	while (pi != r.second)
+	{
+		EpollFD* epoll = pi->second.epoll;
+		int fd = pi->second.fd;
+		pi++;
+
+		Interests::iterator ii = epoll->_interests.find(fd);
+		if ((ii == epoll->_interests.end()) || (ii->second.fdo != fdo))
+			continue;
+
+		Interest& i = ii->second;
+		epoll->unpark(fd, i);
+		epoll->arm(fd, i, i.events);
+		epoll->wake();
+	}
+}
+
+/* Call with epolllock held. */
+void EpollFD::wake()
+{
+	if (_waiters && (_wakepipe[1] != -1))
+		write(_wakepipe[1], "", 1);
+}
+
+void EpollFD::Add(int fd, FD* fdo, u32 events, u64 data)
+{
+	RAIILock locked(epolllock);
+
+	if (_interests.find(fd) != _interests.end())
+		throw EEXIST;
+
+	Interest& i = _interests[fd];
+	i.fdo = fdo;
+	i.events = events;
+	i.data = data;
+	i.iocount = fdo->GetIOCount();
+	i.suppressed = false;
+	arm(fd, i, events);
+	wake();
+}
+
+void EpollFD::Modify(int fd, u32 events, u64 data)
+{
+	RAIILock locked(epolllock);
+
+	Interests::iterator ii = _interests.find(fd);
+	if (ii == _interests.end())
+		throw ENOENT;
+
+	Interest& i = ii->second;
+	i.events = events;
+	i.data = data;
+	unpark(fd, i);
+	arm(fd, i, events);
+	wake();
+}
+
+void EpollFD::Delete(int fd)
+{
+	RAIILock locked(epolllock);
+
+	Interests::iterator ii = _interests.find(fd);
+	if (ii == _interests.end())
+		throw ENOENT;
+
+	forget(ii);
+	wake();
+}
+
+static int next_fd(const FDSet& reads, const FDSet& writes,
+		const FDSet& excepts, int fd)
+{
+	int r = reads.Next(fd);
+	int w = writes.Next(fd);
+	int e = excepts.Next(fd);
+
+	int next = r;
+	if ((w != -1) && ((next == -1) || (w < next)))
+		next = w;
+	if ((e != -1) && ((next == -1) || (e < next)))
+		next = e;
+	return next;
+}
+
+static int64_t now_ms()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* If sigwakefd becomes readable, a signal has arrived and this returns 0;
+ * see SignalWait. */
+int EpollFD::Wait(struct linux_epoll_event* events, int maxevents,
+		int timeout, int sigwakefd)
+{
+	int64_t deadline = 0;
+	if (timeout > 0)
+		deadline = now_ms() + timeout;
+
+	for (;;)
+	{
+		/* Ask the descriptors select() can't judge if they're writable.
+		 * Their Poll() takes locks which are held while calling Touch(),
+		 * and so can't be called with epolllock held. */
+
+		vector<PolledWrite> polled;
+		{
+			RAIILock locked(epolllock);
+			for (int fd = _polledwrites.Next(0); fd != -1;
+					fd = _polledwrites.Next(fd+1))
+			{
+				PolledWrite p;
+				p.fd = fd;
+				p.fdo = _interests[fd].fdo;
+				p.iocount = p.fdo->GetIOCount();
+				polled.push_back(p);
+			}
+		}
+
+		FDSet polledready;
+		bool writable = false;
+		for (unsigned j = 0; j < polled.size(); j++)
+		{
+			/* The poll and epoll flags are the same. */
+			int r = polled[j].fdo->Poll(LINUX_EPOLLOUT);
+			if ((r != -1) && (r & LINUX_EPOLLOUT))
+			{
+				polledready.Set(polled[j].fd);
+				writable = true;
+			}
+		}
+
+		FDSet reads;
+		FDSet writes;
+		FDSet excepts;
+		{
+			RAIILock locked(epolllock);
+			reads = _reads;
+			writes = _writes;
+			excepts = _excepts;
+			_waiters++;
+
+			/* Anything not writable is parked, so that the I/O which makes
+			 * it writable wakes us. If there's been I/O since it was
+			 * asked, it's asked again. */
+
+			for (unsigned j = 0; j < polled.size(); j++)
+			{
+				int fd = polled[j].fd;
+				if (polledready.IsSet(fd))
+					continue;
+
+				Interests::iterator ii = _interests.find(fd);
+				if ((ii == _interests.end()) || (ii->second.fdo != polled[j].fdo))
+					continue;
+
+				Interest& i = ii->second;
+				if (i.suppressed)
+					continue;
+				i.iocount = polled[j].iocount;
+				park(fd, i);
+				if (!i.suppressed)
+					writable = true;
+			}
+		}
+
+		if (_wakepipe[0] != -1)
+			reads.Set(_wakepipe[0]);
+		if (sigwakefd != -1)
+			reads.Set(sigwakefd);
+
+		int maxfd = reads.GetMax();
+		if (writes.GetMax() > maxfd)
+			maxfd = writes.GetMax();
+		if (excepts.GetMax() > maxfd)
+			maxfd = excepts.GetMax();
+
+		int64_t delay = -1;
+		if ((timeout == 0) || writable)
+			delay = 0;
+		else if (timeout > 0)
+			delay = max(deadline - now_ms(), (int64_t) 0);
+
+		struct timeval tv;
+		tv.tv_sec = delay / 1000;
+		tv.tv_usec = (delay % 1000) * 1000;
+
+		int result = select(maxfd+1, reads.Get(), writes.Get(), excepts.Get(),
+				(delay == -1) ? NULL : &tv);
+		int e = errno;
+
+		RAIILock locked(epolllock);
+		_waiters--;
+
+		if (result == -1)
+		{
+			if (e != EBADF)
+				throw e;
+
+			/* Something in the interest set has been closed behind our
+			 * back. Linux would have removed it automatically, so do
+			 * that and try again. */
+
+			bool removed = false;
+			Interests::iterator ii = _interests.begin();
+			while (ii != _interests.end())
+			{
+				Interests::iterator here = ii++;
+				int fd = here->first;
+				if ((here->second.fdo->GetFD() != fd) ||
+						(fcntl(fd, F_GETFD, 0) == -1))
+				{
+					forget(here);
+					removed = true;
+				}
+			}
+
+			if (!removed)
+				throw e;
+			continue;
+		}
+
+		if ((_wakepipe[0] != -1) && reads.IsSet(_wakepipe[0]))
+		{
+			char buffer[64];
+			while (read(_wakepipe[0], buffer, sizeof(buffer)) > 0)
+				;
+			reads.Clear(_wakepipe[0]);
+		}
+
+		if ((sigwakefd != -1) && reads.IsSet(sigwakefd))
+			return 0;
+
+		for (int fd = polledready.Next(0); fd != -1;
+				fd = polledready.Next(fd+1))
+			writes.Set(fd);
+
+		/* Only look at the descriptors select() says are ready. */
+
+		int n = 0;
+		int fd = next_fd(reads, writes, excepts, 0);
+		while ((fd != -1) && (n < maxevents))
+		{
+			Interests::iterator ii = _interests.find(fd);
+			if (ii != _interests.end())
+			{
+				Interest& i = ii->second;
+				if (i.fdo->GetFD() != fd)
+					forget(ii);
+				else
+				{
+					/* The poll and epoll hang-up flags are the same. As on
+					 * Linux, EPOLLHUP and EPOLLERR don't have to be asked
+					 * for. */
+
+					u32 ready = 0;
+					if (reads.IsSet(fd))
+						ready |= LINUX_EPOLLIN | i.fdo->PollHangup(i.armed);
+					if (writes.IsSet(fd))
+						ready |= LINUX_EPOLLOUT;
+					if (excepts.IsSet(fd))
+						ready |= LINUX_EPOLLPRI;
+					ready &= i.armed | LINUX_EPOLLHUP | LINUX_EPOLLERR;
+
+					if (ready)
+					{
+						events[n].events = ready;
+						events[n].data = i.data;
+						n++;
+
+						if (i.events & LINUX_EPOLLONESHOT)
+							arm(fd, i, 0);
+						else if (i.events & LINUX_EPOLLET)
+						{
+							i.iocount = i.fdo->GetIOCount();
+							arm(fd, i, i.armed & ~ready);
+							park(fd, i);
+						}
+					}
+				}
+			}
+
+			fd = next_fd(reads, writes, excepts, fd+1);
+		}
+
+		if (n > 0)
+			return n;
+		if (timeout == 0)
+			return 0;
+		if ((timeout > 0) && (now_ms() >= deadline))
+			return 0;
+
+		/* We were woken up, or everything that was ready has already been
+		 * reported; go round again. */
+	}
+}
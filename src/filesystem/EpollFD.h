@@ -0,0 +1,122 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef EPOLLFD_H
+#define EPOLLFD_H
+
+#include "FD.h"
+#include "FDSet.h"
+#include <map>
+
+using std::map;
+using std::multimap;
+
+#define LINUX_EPOLLIN          0x001
+#define LINUX_EPOLLPRI         0x002
+#define LINUX_EPOLLOUT         0x004
+#define LINUX_EPOLLERR         0x008
+#define LINUX_EPOLLHUP         0x010
+#define LINUX_EPOLLRDNORM      0x040
+#define LINUX_EPOLLRDBAND      0x080
+#define LINUX_EPOLLWRNORM      0x100
+#define LINUX_EPOLLWRBAND      0x200
+#define LINUX_EPOLLMSG         0x400
+#define LINUX_EPOLLRDHUP       0x2000
+#define LINUX_EPOLLONESHOT     (1U << 30)
+#define LINUX_EPOLLET          (1U << 31)
+
+#define LINUX_EPOLL_CTL_ADD    1
+#define LINUX_EPOLL_CTL_DEL    2
+#define LINUX_EPOLL_CTL_MOD    3
+
+#define LINUX_EPOLL_CLOEXEC    02000000
+
+struct linux_epoll_event
+{
+	u32 events;
+	u64 data;
+} PACKED;
+
+/* An epoll instance. The interest set and the select() masks built from it
+ * persist between calls, so epoll_wait() only has to copy the masks and
+ * look at the descriptors select() says are ready.
+ *
+ * Edge-triggered interests are taken out of the masks once reported and the
+ * FD is parked; the guest's next I/O on it (which is the only way it can
+ * stop being ready) calls Touched(), which puts them back and wakes any
+ * waiter. One-shot interests are taken out until they're modified.
+ *
+ * Hang-ups are only seen on descriptors being watched for EPOLLIN, as
+ * select() can only say that something is readable; EPOLLRDHUP on its own
+ * doesn't watch anything.
+ *
+ * Descriptors whose host fd select() can't judge for writing (see
+ * FD::SelectsForWrite) have their EPOLLOUT answered by Poll() instead; if
+ * they aren't writable, they're parked so that the I/O that changes that
+ * wakes the waiter.
+ */
+
+class EpollFD : public FD
+{
+public:
+	EpollFD(int fd);
+	~EpollFD();
+
+public:
+	void Add(int fd, FD* fdo, u32 events, u64 data);
+	void Modify(int fd, u32 events, u64 data);
+	void Delete(int fd);
+	int Wait(struct linux_epoll_event* events, int maxevents, int timeout,
+			int sigwakefd = -1);
+
+	/* Called when the guest does I/O on a parked FD. */
+	static void Touched(FD* fdo);
+
+private:
+	struct Interest
+	{
+		Ref<FD> fdo;
+		u32 events;
+		u64 data;
+		u32 armed;              // events currently in the select() masks
+		u32 iocount;            // fdo's I/O count when last reported
+		bool suppressed;        // parked, waiting for I/O to be rearmed
+	};
+
+	typedef map<int, Interest> Interests;
+
+	struct Parked
+	{
+		EpollFD* epoll;
+		int fd;
+	};
+
+	typedef multimap<FD*, Parked> ParkedMap;
+
+	struct PolledWrite
+	{
+		int fd;
+		Ref<FD> fdo;
+		u32 iocount;
+	};
+
+	void arm(int fd, Interest& i, u32 events);
+	void forget(Interests::iterator i);
+	void park(int fd, Interest& i);
+	void unpark(int fd, Interest& i);
+	void wake();
+
+	static ParkedMap _parked;
+
+	Interests _interests;
+	FDSet _reads;
+	FDSet _writes;
+	FDSet _polledwrites;    // EPOLLOUT interests select() can't see
+	FDSet _excepts;
+	int _wakepipe[2];
+	int _waiters;
+};
+
+#endif
@@ -0,0 +1,112 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "filesystem/EventFD.h"
+
+/* The largest value the counter can hold. */
+#define EVENTFD_MAX 0xfffffffffffffffeULL
+
+/* A write that would overflow the counter waits this long between tries.
+ * It takes some effort to get there, so it's not worth a second pipe. */
+#define OVERFLOW_POLL_US 10000
+
+static Mutex eventfdlock("eventfd");
+
+int EventFD::Create(u32 initval, int flags)
+{
+	if (flags & ~(LINUX_EFD_SEMAPHORE | LINUX_EFD_CLOEXEC | LINUX_EFD_NONBLOCK))
+		throw EINVAL;
+
+	int fds[2];
+	MakePipe(fds, flags & ~LINUX_EFD_SEMAPHORE);
+	new EventFD(fds, initval, flags & LINUX_EFD_SEMAPHORE);
+	return fds[0];
+}
+
+EventFD::EventFD(int fds[2], u32 initval, bool semaphore):
+	NotifyFD(fds),
+	_counter(initval),
+	_semaphore(semaphore)
+{
+	if (_counter)
+		Notify();
+}
+
+int EventFD::Read(void* buffer, size_t size)
+{
+	if (size < sizeof(u64))
+		throw EINVAL;
+
+	for (;;)
+	{
+		u64 value = 0;
+		{
+			RAIILock locked(eventfdlock);
+			if (_counter)
+			{
+				value = _semaphore ? 1 : _counter;
+				_counter -= value;
+				if (!_counter)
+					Clear();
+				Touch();
+			}
+		}
+
+		if (value)
+		{
+			*(u64*) buffer = value;
+			return sizeof(u64);
+		}
+
+		if (IsNonBlocking())
+			throw EAGAIN;
+		WaitForNotify();
+	}
+}
+
+int EventFD::Write(const void* buffer, size_t size)
+{
+	if (size < sizeof(u64))
+		throw EINVAL;
+
+	u64 value = *(const u64*) buffer;
+	if (value > EVENTFD_MAX)
+		throw EINVAL;
+
+	for (;;)
+	{
+		{
+			RAIILock locked(eventfdlock);
+			if (value <= (EVENTFD_MAX - _counter))
+			{
+				_counter += value;
+				if (_counter)
+					Notify();
+				Touch();
+				return sizeof(u64);
+			}
+		}
+
+		if (IsNonBlocking())
+			throw EAGAIN;
+		usleep(OVERFLOW_POLL_US);
+	}
+}
+
+int EventFD::Poll(int events)
+{
+	int ready = 0;
+	{
+		RAIILock locked(eventfdlock);
+		if (_counter)
+			ready |= LINUX_POLLIN | LINUX_POLLRDNORM;
+		if (_counter < EVENTFD_MAX)
+			ready |= LINUX_POLLOUT | LINUX_POLLWRNORM;
+	}
+
+	ready &= events;
+	return ready ? ready : -1;
+}
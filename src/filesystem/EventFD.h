@@ -0,0 +1,34 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef EVENTFD_H
+#define EVENTFD_H
+
+#include "NotifyFD.h"
+
+#define LINUX_EFD_SEMAPHORE    1
+#define LINUX_EFD_CLOEXEC      LINUX_O_CLOEXEC
+#define LINUX_EFD_NONBLOCK     LINUX_O_NONBLOCK
+
+/* An eventfd. The counter lives here; the host only sees the pipe. */
+
+class EventFD : public NotifyFD
+{
+public:
+	static int Create(u32 initval, int flags);
+
+	EventFD(int fds[2], u32 initval, bool semaphore);
+
+public:
+	int Read(void* buffer, size_t size);
+	int Write(const void* buffer, size_t size);
+	int Poll(int events);
+
+private:
+	u64 _counter;
+	bool _semaphore;
+};
+
+#endif
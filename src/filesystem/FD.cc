@@ -8,19 +8,63 @@
 #include "filesystem/RealFD.h"
 #include "filesystem/VFS.h"
 #include "filesystem/VFSNode.h"
+#include "filesystem/EpollFD.h"
 #include "filesystem/file.h"
+#include "Atomic.h"
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <map>
-#include <list>
+#include <vector>
+#include <algorithm>
+
+using std::vector;
+using std::min;
 
 //#define VERBOSE
 
-using std::map;
-using std::list;
+/* The fd table is a flat array indexed by fd. Every read(), write() etc
+ * looks in here, so lookups take no locks at all: readers just announce
+ * themselves in the current epoch, load the slot, and take a reference.
+ *
+ * Writers are serialised by fdslock. Anything they remove from the table
+ * (an FD object, or the whole array when it grows) isn't released until
+ * every reader that might have seen it has left. The writer flips the
+ * epoch and queues the object; it's released by a later writer once the
+ * old epoch's reader count has dropped to zero. Writers never wait for
+ * readers, so a signal handler which closes an fd can't deadlock against
+ * a lookup it interrupted, and readers can hold on for the length of a
+ * short call (see BorrowedFD).
+ */
+
+struct FDTable
+{
+	int size;
+	FD* volatile slots[1];
+};
+
+static FDTable* volatile fdtable = NULL;
+static Mutex fdslock("fd table");
+
+static volatile u32 epoch = 0;
+static volatile u32 epochreaders[2] = { 0, 0 };
+
+/* Things removed from the table, waiting for readers to go. Protected by
+ * fdslock. */
+struct Retired
+{
+	u32 slot;               // epochreaders[] entry they might be seen by
+	FD* fdo;
+	FDTable* table;
+};
+
+static deque<Retired> retired;
+
+#define INITIAL_FDTABLE_SIZE 64
+
+#define SENDFILE_CHUNK (64*1024)
 
-typedef map<int, Ref<FD> > FDS;
-static FDS fds;
+/* Protects each FD's pointer to its DirStream. The streams themselves have
+ * their own locks, so reading one directory doesn't hold up another. */
+static Mutex dirlock("directory streams");
 
 #if defined VERBOSE
 #define LOG log
@@ -28,18 +72,192 @@ static FDS fds;
 #define LOG(...)
 #endif
 
+/* --- FD table --------------------------------------------------------- */
+
+static u32 enter_epoch()
+{
+	for (;;)
+	{
+		u32 e = epoch;
+		Atomic::Add(&epochreaders[e & 1], 1);
+
+		/* If a writer flipped the epoch under us, it may not have seen our
+		 * count, so try again in the new one. */
+
+		if (epoch == e)
+			return e;
+		Atomic::Add(&epochreaders[e & 1], (u32) -1);
+	}
+}
+
+static void leave_epoch(u32 e)
+{
+	Atomic::Add(&epochreaders[e & 1], (u32) -1);
+}
+
+/* Queues something which has just been removed from the table, and moves
+ * readers on to a new epoch, in which it can't be seen. Call with fdslock
+ * held. */
+static void retire(FD* fdo, FDTable* table)
+{
+	Retired r;
+	r.slot = Atomic::Add(&epoch, 1) & 1;
+	r.fdo = fdo;
+	r.table = table;
+	retired.push_back(r);
+}
+
+/* Frees any tables that no reader can be looking at any more, and hands
+ * back any such FDs. Their destructors may need fdslock, so they're
+ * released by the caller once it's been dropped. The reader count may
+ * include readers of a later epoch with the same parity, which only delays
+ * things. Call with fdslock held. */
+static void reclaim(vector<FD*>& dead)
+{
+	deque<Retired>::iterator i = retired.begin();
+	while (i != retired.end())
+	{
+		if (epochreaders[i->slot] != 0)
+		{
+			i++;
+			continue;
+		}
+
+		if (i->table)
+			free(i->table);
+		if (i->fdo)
+			dead.push_back(i->fdo);
+		i = retired.erase(i);
+	}
+}
+
+static void release_fdos(const vector<FD*>& dead)
+{
+	for (unsigned i = 0; i < dead.size(); i++)
+		dead[i]->Dereference();
+}
+
+static FDTable* new_fdtable(int size)
+{
+	FDTable* t = (FDTable*) calloc(1, sizeof(FDTable) +
+			(size - 1) * sizeof(FD*));
+	if (!t)
+		throw ENOMEM;
+	t->size = size;
+	return t;
+}
+
+/* Makes sure the table has a slot for fd. Call with fdslock held. */
+static FDTable* grow_fdtable(int fd)
+{
+	FDTable* old = fdtable;
+	if (old && (fd < old->size))
+		return old;
+
+	int size = old ? old->size : INITIAL_FDTABLE_SIZE;
+	while (size <= fd)
+		size *= 2;
+
+	FDTable* t = new_fdtable(size);
+	if (old)
+		memcpy((void*) t->slots, (void*) old->slots, old->size * sizeof(FD*));
+	fdtable = t;
+
+	if (old)
+		retire(NULL, old);
+	return t;
+}
+
+/* Swaps the object in a slot. The table's reference to the old object is
+ * retired along with it. Call with fdslock held. */
+static void exchange_slot(int fd, FD* fdo)
+{
+	if (fdo)
+		fdo->Reference();
+
+	FDTable* t = grow_fdtable(fd);
+	FD* old = (FD*) Atomic::Exchange((volatile u32*) &t->slots[fd], (u32) fdo);
+	if (old)
+		retire(old, NULL);
+}
+
+/* --- Placeholder fds -------------------------------------------------- */
+
+/* Fake directories and files need an fd number but no real host object, so
+ * they get a dup of a /dev/null that's kept open for the purpose. This is
+ * much cheaper than making a socket. The guest can't see the original. */
+
+static int placeholderfd = -1;
+static Mutex placeholderlock("placeholder fd");
+
+static void open_placeholder()
+{
+	int fd = open("/dev/null", O_RDWR);
+	CheckError(fd);
+	fcntl(fd, F_SETFD, 1);
+	placeholderfd = fd;
+}
+
+/* Moves the placeholder out of the way if the guest wants its number. */
+static void evict_placeholder(int fd)
+{
+	RAIILock locked(placeholderlock);
+	if (fd != placeholderfd)
+		return;
+
+	int newfd = fcntl(fd, F_DUPFD, 0);
+	CheckError(newfd);
+	fcntl(newfd, F_SETFD, 1);
+	placeholderfd = newfd;
+	close(fd);
+}
+
+/* After a fork() we're the only thread, and any reader counts left over
+ * from other threads are bogus. */
+void FD::InitTable()
+{
+	epoch = 0;
+	epochreaders[0] = epochreaders[1] = 0;
+
+	if (placeholderfd == -1)
+		open_placeholder();
+}
+
 /* --- FD management ----------------------------------------------------- */
 
 int FD::CreateDummyFD()
 {
 	/* It doesn't matter what fd we create; we only want it for the number. */
 
-	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	int fd = fcntl(placeholderfd, F_DUPFD, 0);
+	if (fd == -1)
+	{
+		/* Something's happened to the placeholder; get a new one. */
+
+		RAIILock locked(placeholderlock);
+		open_placeholder();
+		fd = fcntl(placeholderfd, F_DUPFD, 0);
+	}
 	CheckError(fd);
 	fcntl(fd, F_SETFD, 1);
 	return fd;
 }
 
+static Ref<FD> lookup_fdo(int fd)
+{
+	Ref<FD> fdo;
+	if (fd < 0)
+		return fdo;
+
+	u32 e = enter_epoch();
+	FDTable* t = fdtable;
+	if (t && (fd < t->size))
+		fdo = t->slots[fd];
+	leave_epoch(e);
+
+	return fdo;
+}
+
 static Ref<FD> create_new_fdo(int fd)
 {
 	/* First check to see if this is a valid FD. */
@@ -55,31 +273,84 @@ static Ref<FD> create_new_fdo(int fd)
 
 Ref<FD> FD::Get(int fd)
 {
-	RAIILock locked;
-
 	//LOG("FD::Get(%d)", fd);
 
-	FDS::iterator i = fds.find(fd);
-	if (i == fds.end())
-		return create_new_fdo(fd);
-	return i->second;
+	if (fd == placeholderfd)
+		throw EBADF;
+
+	Ref<FD> fdo = lookup_fdo(fd);
+	if (fdo)
+		return fdo;
+
+	/* Not seen this one before. Another thread may be doing the same thing,
+	 * so make sure we all end up with the object that's in the table. */
+
+	fdo = create_new_fdo(fd);
+
+	Ref<FD> current = lookup_fdo(fd);
+	if (current)
+		return current;
+	return fdo;
 }
 
 void FD::Set(int fd, FD* fdo)
 {
-	RAIILock locked;
+	vector<FD*> dead;
+	{
+		RAIILock locked(fdslock);
 
-	LOG("FD::Set(%d)", fd);
-	fds[fd] = fdo;
+		LOG("FD::Set(%d)", fd);
+		exchange_slot(fd, fdo);
+		reclaim(dead);
+	}
+	release_fdos(dead);
 }
 
 void FD::Unset(int fd)
 {
-	RAIILock locked;
+	if (fd < 0)
+		return;
+
+	vector<FD*> dead;
+	{
+		RAIILock locked(fdslock);
+
+		FDTable* t = fdtable;
+		if (!t || (fd >= t->size))
+			return;
+		exchange_slot(fd, NULL);
+		reclaim(dead);
+	}
+	release_fdos(dead);
+}
+
+BorrowedFD::BorrowedFD(int fd):
+	_fdo(NULL)
+{
+	if (fd == placeholderfd)
+		throw EBADF;
+
+	if (fd >= 0)
+	{
+		_epoch = enter_epoch();
+		FDTable* t = fdtable;
+		if (t && (fd < t->size))
+			_fdo = t->slots[fd];
+		if (_fdo)
+			return;
+		leave_epoch(_epoch);
+	}
+
+	/* Not in the table yet, so do it the slow way. */
 
-	FDS::iterator i = fds.find(fd);
-	if (i != fds.end())
-		fds.erase(i);
+	_ref = FD::Get(fd);
+	_fdo = _ref;
+}
+
+BorrowedFD::~BorrowedFD()
+{
+	if (!_ref)
+		leave_epoch(_epoch);
 }
 
 Ref<VFSNode> FD::GetVFSNodeFor(int fd)
@@ -98,7 +369,9 @@ Ref<VFSNode> FD::GetVFSNodeFor(int fd)
 
 FD::FD(int fd):
 	_fd(fd),
-	_dirdata(NULL)
+	_dirstream(NULL),
+	_iocount(0),
+	_parked(0)
 {
 	FD::Set(fd, this);
 }
@@ -106,14 +379,21 @@ FD::FD(int fd):
 FD::FD(int fd, VFSNode* node):
 	_fd(fd),
 	_node(node),
-	_dirdata(NULL)
+	_dirstream(NULL),
+	_iocount(0),
+	_parked(0)
 {
 	FD::Set(fd, this);
 }
 
 FD::~FD()
 {
-	delete _dirdata;
+	delete _dirstream;
+}
+
+void FD::touched()
+{
+	EpollFD::Touched(this);
 }
 
 /* --- Default methods --------------------------------------------------- */
@@ -135,7 +415,10 @@ int FD::Dup(int destfd)
 	if (destfd == -1)
 		result = destfd = dup(fd);
 	else
+	{
+		evict_placeholder(destfd);
 		result = dup2(fd, destfd);
+	}
 
 	CheckError(result);
 	return result;
@@ -171,89 +454,179 @@ int FD::Fcntl(int cmd, u_int32_t argument)
 	error("unsupported fcntl %08x", cmd);
 }
 
+/* The slow way: through a buffer. If the source is seekable, the source
+ * position ends up just past the bytes actually written, so nothing is lost
+ * if the destination fills up. */
+int FD::SendFile(FD* out, int64_t* offset, size_t count)
+{
+	int64_t pos = -1;
+	if (offset)
+		pos = *offset;
+	else
+	{
+		try
+		{
+			pos = Seek(0, SEEK_CUR);
+		}
+		catch (int e)
+		{
+			/* Not seekable; fall through. */
+		}
+	}
+
+	vector<char> buffer(min(count, (size_t) SENDFILE_CHUNK));
+	size_t sent = 0;
+	while (sent < count)
+	{
+		size_t len = min(count - sent, buffer.size());
+
+		int r;
+		try
+		{
+			if (pos == -1)
+				r = Read(&buffer[0], len);
+			else
+				r = PRead(&buffer[0], len, pos + sent);
+		}
+		catch (int e)
+		{
+			if (sent)
+				break;
+			throw e;
+		}
+		if (r == 0)
+			break;
+
+		int w = 0;
+		try
+		{
+			while (w < r)
+				w += out->Write(&buffer[w], r - w);
+		}
+		catch (int e)
+		{
+			if (!sent && !w)
+				throw e;
+		}
+
+		sent += w;
+		if (w < r)
+			break;
+	}
+
+	if (offset)
+		*offset = pos + sent;
+	else if (pos != -1)
+		Seek(pos + sent, SEEK_SET);
+	return sent;
+}
+
 int FD::Ioctl(int cmd, u_int32_t argument)
 {
 	error("unsupported ioctl %08x", cmd);
 }
 
-FD::DirData& FD::get_dirdata()
+/* The host directory isn't opened until it's first read. */
+DirStream& FD::get_dirstream()
 {
-	if (_dirdata)
-		return *_dirdata;
+	{
+		RAIILock locked(dirlock);
+		if (_dirstream)
+			return *_dirstream;
+	}
 
-	_dirdata = new DirData();
-	if (!_dirdata)
-		throw ENOMEM;
+	/* Opening it may take a while, so don't do it with the lock held. If
+	 * another thread gets there first, its stream wins. */
+
+	DirStream* ds = GetVFSNode()->OpenDirStream();
 
-	_dirdata->pos = 0;
-	_dirdata->contents = GetVFSNode()->Enumerate();
-	return *_dirdata;
-}
-
-static int get_file_type(const struct stat& st)
-{
-	if (S_ISDIR(st.st_mode))
-		return LINUX_DT_DIR;
-	if (S_ISCHR(st.st_mode))
-		return LINUX_DT_CHR;
-	if (S_ISBLK(st.st_mode))
-		return LINUX_DT_BLK;
-	if (S_ISREG(st.st_mode))
-		return LINUX_DT_REG;
-	if (S_ISFIFO(st.st_mode))
-		return LINUX_DT_FIFO;
-	if (S_ISSOCK(st.st_mode))
-		return LINUX_DT_SOCK;
-	if (S_ISLNK(st.st_mode))
-		return LINUX_DT_LNK;
+	RAIILock locked(dirlock);
+	if (_dirstream)
+		delete ds;
+	else
+		_dirstream = ds;
+	return *_dirstream;
+}
+
+/* Only directories can seek by default, and only to the cookies getdents
+ * gave out. Callers pass the offset first and the whence second. */
+int64_t FD::Seek(int offset, int64_t whence)
+{
+	if (!GetVFSNode())
+		throw EINVAL;
+
+	DirStream& ds = get_dirstream();
+	RAIILock locked(ds.GetLock());
+	switch (whence)
+	{
+		case SEEK_SET:
+			ds.Seek(offset);
+			return offset;
+
+		case SEEK_CUR:
+			if (offset != 0)
+				throw EINVAL;
+			return ds.Tell();
+	}
+	throw EINVAL;
+}
+
+static int get_file_type(int type)
+{
+	switch (type)
+	{
+		case VFSNode::DIRECTORY: return LINUX_DT_DIR;
+		case VFSNode::CHAR:      return LINUX_DT_CHR;
+		case VFSNode::BLOCK:     return LINUX_DT_BLK;
+		case VFSNode::FILE:      return LINUX_DT_REG;
+		case VFSNode::FIFO:      return LINUX_DT_FIFO;
+		case VFSNode::SOCKET:    return LINUX_DT_SOCK;
+		case VFSNode::LINK:      return LINUX_DT_LNK;
+	}
 	return LINUX_DT_UNKNOWN;
 }
 
 int FD::GetDents(void* buffer, size_t count)
 {
-	RAIILock locked;
 	Ref<VFSNode>& vfsnode = GetVFSNode();
 	if (!vfsnode)
 		throw ENOTDIR;
 
 	u8* ptr = (u8*) buffer;
-	DirData& dd = get_dirdata();
+	DirStream& ds = get_dirstream();
+	RAIILock locked(ds.GetLock());
 	unsigned int byteswritten = 0;
 	for (;;)
 	{
-		if (dd.pos == dd.contents.size())
+		int64_t here = ds.Tell();
+		DirEntry entry;
+		if (!ds.Read(entry))
 			break;
+		const string& filename = entry.name;
 
-		try
+		size_t reclen = sizeof(struct compat_linux_dirent) +
+				filename.size() + 1;
+		reclen = (reclen + 3) & ~3; // align to 32 bit boundary
+		if ((count - byteswritten) < reclen)
 		{
-			const string& filename = dd.contents[dd.pos];
-
-			struct stat st;
-			vfsnode->StatFile(filename, st);
+			/* Leave it for next time. */
+			ds.Seek(here);
+			if (!byteswritten)
+				throw EINVAL;
+			break;
+		}
 
-			size_t reclen = sizeof(struct compat_linux_dirent) +
-					filename.size() + 1;
-			reclen = (reclen + 3) & ~3; // align to 32 bit boundary
-			if ((count - byteswritten) < reclen)
-				break;
+		/* The type goes in the last byte of the record. */
 
-			struct compat_linux_dirent* dirent = (struct compat_linux_dirent*) ptr;
-			dirent->d_ino = st.st_ino;
-			dirent->d_off = dd.pos + 1;
-			dirent->d_reclen = reclen;
-			strcpy(dirent->d_name, filename.c_str());
+		struct compat_linux_dirent* dirent = (struct compat_linux_dirent*) ptr;
+		dirent->d_ino = entry.ino;
+		dirent->d_off = ds.Tell();
+		dirent->d_reclen = reclen;
+		strcpy(dirent->d_name, filename.c_str());
+		ptr[reclen-1] = get_file_type(entry.type);
 
-			ptr += reclen;
-			byteswritten += reclen;
-		}
-		catch (int e)
-		{
-			/* Something weird happened while enumerating the directory; just
-			 * ignore this file.
-			 */
-		}
-
-		dd.pos++;
+		ptr += reclen;
+		byteswritten += reclen;
 	}
 
 	return byteswritten;
@@ -261,50 +634,42 @@ int FD::GetDents(void* buffer, size_t count)
 
 int FD::GetDents64(void* buffer, size_t count)
 {
-	RAIILock locked;
 	Ref<VFSNode>& vfsnode = GetVFSNode();
 	if (!vfsnode)
 		throw ENOTDIR;
 
 	u8* ptr = (u8*) buffer;
-	DirData& dd = get_dirdata();
+	DirStream& ds = get_dirstream();
+	RAIILock locked(ds.GetLock());
 	unsigned int byteswritten = 0;
 	for (;;)
 	{
-		if (dd.pos == dd.contents.size())
+		int64_t here = ds.Tell();
+		DirEntry entry;
+		if (!ds.Read(entry))
 			break;
+		const string& filename = entry.name;
 
-		try
+		size_t reclen = sizeof(struct linux_dirent64) +
+				filename.size() + 1;
+		reclen = (reclen + 7) & ~7; // align to 64 bit boundary
+		if ((count - byteswritten) < reclen)
 		{
-			const string& filename = dd.contents[dd.pos];
-
-			struct stat st;
-			vfsnode->StatFile(filename, st);
-
-			size_t reclen = sizeof(struct linux_dirent64) +
-					filename.size() + 1;
-			reclen = (reclen + 7) & ~7; // align to 64 bit boundary
-			if ((count - byteswritten) < reclen)
-				break;
-
-			struct linux_dirent64* dirent = (struct linux_dirent64*) ptr;
-			dirent->d_ino = st.st_ino;
-			dirent->d_off = dd.pos + 1;
-			dirent->d_reclen = reclen;
-			dirent->d_type = get_file_type(st);
-			strcpy(dirent->d_name, filename.c_str());
-
-			ptr += reclen;
-			byteswritten += reclen;
-		}
-		catch (int e)
-		{
-			/* Something weird happened while enumerating the directory; just
-			 * ignore this file.
-			 */
+			ds.Seek(here);
+			if (!byteswritten)
+				throw EINVAL;
+			break;
 		}
 
-		dd.pos++;
+		struct linux_dirent64* dirent = (struct linux_dirent64*) ptr;
+		dirent->d_ino = entry.ino;
+		dirent->d_off = ds.Tell();
+		dirent->d_reclen = reclen;
+		dirent->d_type = get_file_type(entry.type);
+		strcpy(dirent->d_name, filename.c_str());
+
+		ptr += reclen;
+		byteswritten += reclen;
 	}
 
 	return byteswritten;
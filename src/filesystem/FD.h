@@ -9,12 +9,14 @@
 #include <map>
 #include <deque>
 #include "file.h"
+#include "Atomic.h"
 
 using std::map;
 using std::deque;
 
 class SocketFD;
 class VFSNode;
+class DirStream;
 
 class FD : public HasRefCount
 {
@@ -24,6 +26,7 @@ public:
 	static void Set(int fd, FD* fdo);
 	static void Unset(int fd);
 	static Ref<VFSNode> GetVFSNodeFor(int fd);
+	static void InitTable();
 
 public:
 	FD(int fd);
@@ -36,13 +39,49 @@ public:
 	int GetFD() const { return _fd; }
 	Ref<VFSNode>& GetVFSNode() { return _node; }
 
+	/* Guest path this FD was opened with, if known (used by
+	 * /proc/self/maps and friends). */
+	const string& GetPath() const { return _path; }
+	void SetPath(const string& path) { _path = path; }
+
+	/* Bumped whenever the guest does I/O on this FD, so that edge-triggered
+	 * epoll can tell when it's worth looking again. */
+	u32 GetIOCount() const { return _iocount; }
+
+	/* While parked, the next Touch() tells EpollFD; see there. */
+	void Park() { Atomic::Add(&_parked, 1); }
+	void Unpark() { Atomic::Add(&_parked, (u32) -1); }
+
 	/* Basic operations */
 
 	virtual int ReadV(const struct iovec* iov, int iovcnt) { throw EINVAL; }
 	virtual int WriteV(const struct iovec* iov, int iovcnt) { throw EINVAL; }
 	virtual int Read(void* buffer, size_t size) { throw EINVAL; }
 	virtual int Write(const void* buffer, size_t size) { throw EINVAL; }
-	virtual int64_t Seek(int whence, int64_t offset) { throw EINVAL; }
+	virtual int PRead(void* buffer, size_t size, int64_t offset) { throw ESPIPE; }
+	virtual int PWrite(const void* buffer, size_t size, int64_t offset) { throw ESPIPE; }
+	virtual int PReadV(const struct iovec* iov, int iovcnt, int64_t offset) { throw ESPIPE; }
+	virtual int PWriteV(const struct iovec* iov, int iovcnt, int64_t offset) { throw ESPIPE; }
+
+	/* Copies up to count bytes from this FD to another, starting at *offset
+	 * (which is updated), or at the current position if offset is NULL. */
+	virtual int SendFile(FD* out, int64_t* offset, size_t count);
+
+	/* Returns the Linux poll flags for this FD if they can be worked out
+	 * without asking the host, or -1 if select() needs to be used. */
+	virtual int Poll(int events) { return -1; }
+
+	/* False if select() can't tell when this is writable, so Poll() has to
+	 * be asked instead. */
+	virtual bool SelectsForWrite() { return true; }
+
+	/* False if reads and writes never block, so BorrowedFD can be used. */
+	virtual bool CanBlock() { return true; }
+
+	/* Called once select() has said this FD is readable. Returns whichever
+	 * of POLLHUP, POLLRDHUP and POLLERR apply, as select() can't say. */
+	virtual int PollHangup(int events) { return 0; }
+	virtual int64_t Seek(int whence, int64_t offset);
 	virtual void Truncate(int64_t length) { throw EINVAL; }
 	virtual void Fsync() { }
 	virtual void Flock(int operation) { throw EINVAL; }
@@ -63,6 +102,10 @@ public:
 
 	virtual void Connect(const struct sockaddr* addr, int addrlen) { throw EINVAL; }
 	virtual void Bind(const struct sockaddr* addr, int addrlen) { throw EINVAL; }
+	virtual void Listen(int backlog) { throw EINVAL; }
+
+	/* Returns the new connection's fd. */
+	virtual int Accept(struct sockaddr* addr, int* addrlen) { throw EINVAL; }
 	virtual void Shutdown(int how) { throw EINVAL; }
 
 	virtual void SetSockopt(int level, int optname, const void* option,
@@ -75,23 +118,57 @@ public:
 	virtual int SendTo(const void *buf, size_t len, int flags,
 			const struct sockaddr* to, int tolen) { throw EINVAL; }
 	virtual int RecvFrom(void *buf, size_t len, int flags,
-			struct sockaddr* from, int* fromlen) { throw EINVAL; }
+			struct sockaddr* from, int* fromlen, bool dontwait = false)
+			{ throw EINVAL; }
 
+	/* These take host msghdrs; see sockets.cc for the conversion. */
+	virtual int SendMsg(const struct msghdr* msg, int flags) { throw EINVAL; }
+	virtual int RecvMsg(struct msghdr* msg, int flags, bool dontwait = false)
+			{ throw EINVAL; }
 
-private:
-	class DirData;
-	DirData& get_dirdata();
 
-private:
-	struct DirData
+protected:
+	void Touch()
 	{
-		unsigned int pos;
-		deque<string> contents;
-	};
+		Atomic::Add(&_iocount, 1);
+		if (_parked)
+			touched();
+	}
+
+private:
+	void touched();
+	DirStream& get_dirstream();
 
+private:
 	int _fd;
 	Ref<VFSNode> _node;
-	DirData* _dirdata;
+	string _path;
+	DirStream* _dirstream;
+	volatile u32 _iocount;
+	volatile u32 _parked;
+};
+
+/* Looks up an fd without taking a reference, for the length of a short
+ * call that can't block (fstat(), lseek() and the like). The FD can't be
+ * released while this is in scope; holding it for longer only delays
+ * that. */
+
+class BorrowedFD
+{
+public:
+	BorrowedFD(int fd);
+	~BorrowedFD();
+
+	FD* operator -> () const { return _fdo; }
+	operator FD* () const { return _fdo; }
+
+private:
+	BorrowedFD(const BorrowedFD& other);
+	BorrowedFD& operator = (const BorrowedFD& other);
+
+	u32 _epoch;
+	FD* _fdo;
+	Ref<FD> _ref;           // only if it wasn't in the table
 };
 
 #endif
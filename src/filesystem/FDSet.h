@@ -0,0 +1,128 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef FDSET_H
+#define FDSET_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <vector>
+
+using std::vector;
+
+/* A growable fd_set. The host's select() looks at as many bits as it's told
+ * to, so this can be handed to it directly, and isn't limited to
+ * FD_SETSIZE descriptors.
+ */
+
+class FDSet
+{
+public:
+	FDSet():
+		_words((sizeof(fd_set) + 3) / 4),
+		_max(-1)
+	{
+	}
+
+	void Set(int fd)
+	{
+		unsigned word = fd / 32;
+		if (word >= _words.size())
+			_words.resize(word + 1);
+		_words[word] |= 1U << (fd % 32);
+		if (fd > _max)
+			_max = fd;
+	}
+
+	void Clear(int fd)
+	{
+		unsigned word = fd / 32;
+		if (word < _words.size())
+			_words[word] &= ~(1U << (fd % 32));
+	}
+
+	bool IsSet(int fd) const
+	{
+		unsigned word = fd / 32;
+		if (word >= _words.size())
+			return false;
+		return _words[word] & (1U << (fd % 32));
+	}
+
+	void Zero()
+	{
+		for (unsigned i = 0; i < _words.size(); i++)
+			_words[i] = 0;
+		_max = -1;
+	}
+
+	/* Highest fd ever set since the last Zero(); it's not lowered by
+	 * Clear(), so this is an upper bound. */
+	int GetMax() const
+	{
+		return _max;
+	}
+
+	/* Returns the first set fd at or after fd, or -1. Empty words are
+	 * skipped 32 fds at a time. */
+	int Next(int fd) const
+	{
+		unsigned word = fd / 32;
+		if (word >= _words.size())
+			return -1;
+
+		u32 bits = _words[word] & (~0U << (fd % 32));
+		for (;;)
+		{
+			if (bits)
+				return (word * 32) + __builtin_ctz(bits);
+
+			word++;
+			if (word >= _words.size())
+				return -1;
+			bits = _words[word];
+		}
+	}
+
+	/* Copies in the first n bits of a guest fd_set. */
+	void Load(const fd_set* set, int n)
+	{
+		const u32* words = (const u32*) set;
+		Zero();
+		for (int fd = 0; fd < n; fd++)
+			if (words[fd / 32] & (1U << (fd % 32)))
+				Set(fd);
+	}
+
+	/* Copies the first n bits out to a guest fd_set, and returns how many
+	 * were set. */
+	int Store(fd_set* set, int n) const
+	{
+		u32* words = (u32*) set;
+		int count = 0;
+		for (int fd = 0; fd < n; fd++)
+		{
+			if (IsSet(fd))
+			{
+				words[fd / 32] |= 1U << (fd % 32);
+				count++;
+			}
+			else
+				words[fd / 32] &= ~(1U << (fd % 32));
+		}
+		return count;
+	}
+
+	fd_set* Get()
+	{
+		return (fd_set*) &_words[0];
+	}
+
+private:
+	vector<u32> _words;
+	int _max;
+};
+
+#endif
@@ -16,3 +16,8 @@ FakeDirFD::FakeDirFD(int fd, VFSNode* node):
 FakeDirFD::~FakeDirFD()
 {
 }
+
+int FakeDirFD::Poll(int events)
+{
+	return events & LINUX_POLL_ALWAYS;
+}
@@ -13,6 +13,9 @@ class FakeDirFD : public FD
 public:
 	FakeDirFD(int fd, VFSNode* node);
 	~FakeDirFD();
+
+public:
+	int Poll(int events);
 };
 
 #endif
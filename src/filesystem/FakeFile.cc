@@ -5,6 +5,7 @@
 
 #include "globals.h"
 #include "filesystem/RealFD.h"
+#include "filesystem/StringFD.h"
 #include "filesystem/InterixVFSNode.h"
 #include "filesystem/FakeVFSNode.h"
 #include "filesystem/FakeFile.h"
@@ -39,6 +40,11 @@ int FakeFile::Access(int mode)
 	throw EINVAL;
 }
 
+string FakeFile::ReadLink()
+{
+	throw EINVAL;
+}
+
 FakeDirectory::FakeDirectory(VFSNode* node):
 		_node(node)
 {
@@ -122,3 +128,68 @@ Ref<VFSNode> TunnelledFakeDirectory::OpenDirectory(VFSNode* parent)
 {
 	return new InterixVFSNode(parent, _localname, _destname);
 }
+
+GeneratedFakeFile::GeneratedFakeFile(const string& localname,
+			Generator* generator):
+		_localname(localname),
+		_generator(generator)
+{
+}
+
+string GeneratedFakeFile::GetName()
+{
+	return _localname;
+}
+
+Ref<FD> GeneratedFakeFile::OpenFile(int flags, int mode)
+{
+	if ((flags & O_ACCMODE) != O_RDONLY)
+		throw EACCES;
+
+	int newfd = FD::CreateDummyFD();
+	return new StringFD(newfd, _generator());
+}
+
+void GeneratedFakeFile::Stat(struct stat& st)
+{
+	memset(&st, 0, sizeof(st));
+	st.st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+	st.st_nlink = 1;
+}
+
+int GeneratedFakeFile::Access(int mode)
+{
+	if (mode & W_OK)
+		throw EACCES;
+	return 0;
+}
+
+GeneratedFakeLink::GeneratedFakeLink(const string& localname,
+			Generator* generator):
+		_localname(localname),
+		_generator(generator)
+{
+}
+
+string GeneratedFakeLink::GetName()
+{
+	return _localname;
+}
+
+void GeneratedFakeLink::Stat(struct stat& st)
+{
+	memset(&st, 0, sizeof(st));
+	st.st_mode = S_IFLNK | S_IRWXU | S_IRWXG | S_IRWXO;
+	st.st_nlink = 1;
+	st.st_size = _generator().size();
+}
+
+int GeneratedFakeLink::Access(int mode)
+{
+	return 0;
+}
+
+string GeneratedFakeLink::ReadLink()
+{
+	return _generator();
+}
@@ -22,6 +22,7 @@ public:
 	virtual Ref<FD> OpenFile(int flags, int mode);
 	virtual void Stat(struct stat& st);
 	virtual int Access(int mode);
+	virtual string ReadLink();
 };
 
 class FakeDirectory : public FakeFile
@@ -73,4 +74,46 @@ public:
 	Ref<VFSNode> OpenDirectory(VFSNode* parent);
 };
 
+/* A read-only file whose contents are produced by calling a function every
+ * time it's opened. */
+
+class GeneratedFakeFile : public FakeFile
+{
+public:
+	typedef string Generator();
+
+	GeneratedFakeFile(const string& localname, Generator* generator);
+
+public:
+	string GetName();
+	Ref<FD> OpenFile(int flags, int mode);
+	void Stat(struct stat& st);
+	int Access(int mode);
+
+private:
+	string _localname;
+	Generator* _generator;
+};
+
+/* A symlink whose target is produced by calling a function every time it's
+ * read. */
+
+class GeneratedFakeLink : public FakeFile
+{
+public:
+	typedef string Generator();
+
+	GeneratedFakeLink(const string& localname, Generator* generator);
+
+public:
+	string GetName();
+	void Stat(struct stat& st);
+	int Access(int mode);
+	string ReadLink();
+
+private:
+	string _localname;
+	Generator* _generator;
+};
+
 #endif
@@ -84,19 +84,40 @@ Ref<FD> FakeVFSNode::OpenFile(const string& name, int flags, int mode)
 	return i->second->OpenFile(flags, mode);
 }
 
-deque<string> FakeVFSNode::Enumerate()
+/* Fake files are all in memory, so they can just be asked. */
+deque<DirEntry> FakeVFSNode::Enumerate()
 {
-	deque<string> files;
-	files.push_back(".");
-	files.push_back("..");
+	deque<string> names;
+	names.push_back(".");
+	names.push_back("..");
 
 	FilesMap::const_iterator i = _files.begin();
 	while (i != _files.end())
 	{
-		files.push_back(i->second->GetName());
+		names.push_back(i->second->GetName());
 		i++;
 	}
 
+	deque<DirEntry> files;
+	for (deque<string>::const_iterator n = names.begin(); n != names.end(); n++)
+	{
+		try
+		{
+			struct stat st;
+			StatFile(*n, st);
+
+			DirEntry e;
+			e.name = *n;
+			e.ino = st.st_ino;
+			e.type = GetFileType(st);
+			files.push_back(e);
+		}
+		catch (int e)
+		{
+			/* Something weird happened; just leave this one out. */
+		}
+	}
+
 	return files;
 }
 
@@ -111,9 +132,14 @@ int FakeVFSNode::Access(const string& name, int mode)
 	if (i == _files.end())
 		throw ENOENT;
 
-	struct stat st;
-	i->second->Stat(st);
-
+	return i->second->Access(mode);
+}
+
+string FakeVFSNode::ReadLink(const string& name)
+{
+	FilesMap::const_iterator i = _files.find(name);
+	if (i == _files.end())
+		throw ENOENT;
 
-	throw ENOENT;
+	return i->second->ReadLink();
 }
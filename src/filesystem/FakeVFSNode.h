@@ -27,8 +27,9 @@ public:
 	Ref<FD> OpenDirectory();
 	Ref<FD> OpenFile(const string& name, int flags = O_RDONLY,
 			int mode = 0);
-	deque<string> Enumerate();
+	deque<DirEntry> Enumerate();
 	int Access(const string& name, int mode);
+	string ReadLink(const string& name);
 
 public:
 	void AddFile(FakeFile* file);
@@ -13,6 +13,13 @@
 #include <utime.h>
 #include <typeinfo>
 
+/* Interix has no *at() calls, so everything here works on absolute host
+ * paths built from the node's own path, and the real cwd is left alone. The
+ * few places that do need to change it (exec, and Unix sockets with very
+ * long names) hold this lock while they do. It's recursive for historical
+ * reasons. */
+Mutex InterixVFSNode::CWDLock("Interix cwd", true);
+
 InterixVFSNode::InterixVFSNode(VFSNode* parent, const string& name, const string& path):
 	VFSNode(parent, name)
 {
@@ -33,13 +40,16 @@ void InterixVFSNode::init(VFSNode* parent, const string& name, const string& pat
 	{
 		InterixVFSNode* iparent = dynamic_cast<InterixVFSNode*>(parent);
 		assert(iparent);
-		_path = iparent->GetRealPath() + "/" + path;
+		_path = iparent->GetRealPath(path);
 	}
 
-	/* Ensure that the path is openable. */
+	/* Ensure that the path is a directory. */
 
-	int i = chdir(_path.c_str());
+	struct stat st;
+	int i = stat(_path.c_str(), &st);
 	CheckError(i);
+	if (!S_ISDIR(st.st_mode))
+		throw ENOTDIR;
 }
 
 InterixVFSNode::~InterixVFSNode()
@@ -51,8 +61,8 @@ void InterixVFSNode::StatFile(const string& name, struct stat& st)
 	if (name == "..")
 		return GetParent()->StatFile(".", st);
 
-	setup();
-	int i = lstat(name.c_str(), &st);
+	string path = GetRealPath(name);
+	int i = lstat(path.c_str(), &st);
 	CheckError(i);
 }
 
@@ -72,19 +82,22 @@ Ref<VFSNode> InterixVFSNode::Traverse(const string& name)
 	return new InterixVFSNode(this, name);
 }
 
-void InterixVFSNode::setup()
+/* Returns the host path of something in this directory. */
+string InterixVFSNode::GetRealPath(const string& name)
 {
-	int i = chdir(_path.c_str());
-	CheckError(i);
+	if (name.empty())
+		throw ENOENT;
+	if (!_path.empty() && (_path[_path.size()-1] == '/'))
+		return _path + name;
+	return _path + "/" + name;
 }
 
-void InterixVFSNode::setup(const string& name, int e)
+/* As GetRealPath(), for operations that can't be done to . or .. */
+string InterixVFSNode::checkedpath(const string& name, int e)
 {
-	if (name.empty())
-		throw ENOENT;
 	if ((name == ".") || (name == ".."))
 		throw e;
-	setup();
+	return GetRealPath(name);
 }
 
 Ref<FD> InterixVFSNode::OpenDirectory()
@@ -96,8 +109,7 @@ Ref<FD> InterixVFSNode::OpenDirectory()
 
 Ref<FD> InterixVFSNode::OpenFile(const string& name, int flags,	int mode)
 {
-	RAIILock locked;
-	setup(name, EISDIR);
+	string path = checkedpath(name, EISDIR);
 
 	/* Never allow opening directories --- you need to create a DirFD
 	 * for this VFSNode instead.
@@ -106,39 +118,120 @@ Ref<FD> InterixVFSNode::OpenFile(const string& name, int flags,	int mode)
 		throw EISDIR;
 
 	//log("opening interix file <%s>", name.c_str());
-	int newfd = open(name.c_str(), flags, mode);
+	int newfd = open(path.c_str(), flags, mode);
 	if (newfd == -1)
 		throw errno;
 
 	return new RealFD(newfd);
 }
 
-deque<string> InterixVFSNode::Enumerate()
+/* Reads a host directory as the guest asks for it, so that huge directories
+ * don't have to be held in memory. The host's dirent has no d_type, so each
+ * entry is lstat()ed by its full path as it's read; that doesn't need the
+ * cwd. Cookies are the host's telldir() values plus one, so that 0 can
+ * mean the beginning. */
+class InterixDirStream : public DirStream
 {
-	RAIILock locked;
-	setup();
+public:
+	InterixDirStream(InterixVFSNode* node):
+		_node(node),
+		_atstart(true)
+	{
+		_dir = opendir(node->GetRealPath().c_str());
+		if (!_dir)
+			throw errno;
+	}
+
+	~InterixDirStream()
+	{
+		closedir(_dir);
+	}
 
-	deque<string> d;
-	DIR* dir = opendir(".");
-	for (;;)
+	bool Read(DirEntry& entry)
 	{
-		struct dirent* de = readdir(dir);
+		struct dirent* de = readdir(_dir);
 		if (!de)
-			break;
-		d.push_back(de->d_name);
+			return false;
+		_atstart = false;
+
+		entry.name = de->d_name;
+		entry.ino = de->d_ino;
+		entry.type = VFSNode::UNKNOWN;
+
+		if ((entry.name == ".") || (entry.name == ".."))
+		{
+			entry.type = VFSNode::DIRECTORY;
+
+			/* .. might be in another filesystem entirely. */
+
+			if (entry.name == "..")
+			{
+				try
+				{
+					struct stat st;
+					_node->StatFile("..", st);
+					entry.ino = st.st_ino;
+				}
+				catch (int e)
+				{
+				}
+			}
+		}
+		else
+		{
+			string path = _node->GetRealPath(entry.name);
+			struct stat st;
+			if (lstat(path.c_str(), &st) == 0)
+			{
+				entry.ino = st.st_ino;
+				entry.type = VFSNode::GetFileType(st);
+			}
+		}
+
+		return true;
+	}
+
+	int64_t Tell()
+	{
+		if (_atstart)
+			return 0;
+		return (int64_t) telldir(_dir) + 1;
 	}
-	closedir(dir);
 
-	return d;
+	void Seek(int64_t cookie)
+	{
+		if (cookie < 0)
+			throw EINVAL;
+
+		if (cookie == 0)
+		{
+			rewinddir(_dir);
+			_atstart = true;
+		}
+		else
+		{
+			seekdir(_dir, (long) (cookie - 1));
+			_atstart = false;
+		}
+	}
+
+private:
+	Ref<InterixVFSNode> _node;
+	DIR* _dir;
+	bool _atstart;
+};
+
+DirStream* InterixVFSNode::OpenDirStream()
+{
+	return new InterixDirStream(this);
 }
 
 string InterixVFSNode::ReadLink(const string& name)
 {
-	RAIILock locked;
-	setup(name);
+	string path = checkedpath(name);
 
 	char buffer[PATH_MAX];
-	int i = readlink(name.c_str(), buffer, sizeof(buffer));
+	int i = readlink(path.c_str(), buffer, sizeof(buffer));
 	if (i == -1)
 		throw errno;
 
@@ -147,46 +240,39 @@ string InterixVFSNode::ReadLink(const string& name)
 
 void InterixVFSNode::MkDir(const string& name, int mode)
 {
-	RAIILock locked;
-
 	//log("mkdir(%s %s)", GetPath().c_str(), name.c_str());
 
 	/* Succeed silently if trying to make the current directory. */
 	if (name == ".")
 		return;
 
-	setup(name);
-
-	int i = mkdir(name.c_str(), mode);
+	string path = checkedpath(name);
+	int i = mkdir(path.c_str(), mode);
 	if (i == -1)
 		throw errno;
 }
 
 void InterixVFSNode::RmDir(const string& name)
 {
-	RAIILock locked;
-	setup(name);
+	string path = checkedpath(name);
 
-	int i = rmdir(name.c_str());
+	int i = rmdir(path.c_str());
 	if (i == -1)
 		throw errno;
 }
 
 void InterixVFSNode::Mknod(const string& name, mode_t mode, dev_t dev)
 {
-	RAIILock locked;
-	setup(name);
+	string path = checkedpath(name);
 
-	int i = mknod(name.c_str(), mode, dev);
+	int i = mknod(path.c_str(), mode, dev);
 	CheckError(i);
 }
 
 int InterixVFSNode::Access(const string& name, int mode)
 {
-	RAIILock locked;
-	setup();
-
-	int i = access(name.empty() ? "." : name.c_str(), mode);
+	string path = name.empty() ? _path : GetRealPath(name);
+	int i = access(path.c_str(), mode);
 	if (i == -1)
 		throw errno;
 	return i;
@@ -201,35 +287,30 @@ void InterixVFSNode::Rename(const string& from, VFSNode* other, const string& to
 		(to == ".") || (to == "..") || to.empty())
 		throw EINVAL;
 
-	RAIILock locked;
+	string fromabs = GetRealPath(from);
+	string toabs = othernode->GetRealPath(to);
 
-	string toabs = othernode->GetRealPath() + "/" + to;
-
-	setup();
-	int i = rename(from.c_str(), toabs.c_str());
+	int i = rename(fromabs.c_str(), toabs.c_str());
 	if (i == -1)
 		throw errno;
 }
 
 void InterixVFSNode::Chmod(const string& name, int mode)
 {
-	RAIILock locked;
-	setup();
-
-	int i = chmod(name.c_str(), mode);
+	string path = GetRealPath(name);
+	int i = chmod(path.c_str(), mode);
 	if (i == -1)
 		throw errno;
 }
 
 void InterixVFSNode::Chown(const string& name, uid_t owner, gid_t group)
 {
-	RAIILock locked;
-	setup();
+	string path = GetRealPath(name);
 
 	if (Options.FakeRoot)
 		return;
 
-	int i = chown(name.c_str(), owner, group);
+	int i = chown(path.c_str(), owner, group);
 	if (i == -1)
 		throw errno;
 }
@@ -243,21 +324,18 @@ void InterixVFSNode::Link(const string& name, VFSNode* targetnode, const string&
 		(name == ".") || (name == "..") || name.empty())
 		throw EINVAL;
 
-	RAIILock locked;
-
-	string toabs = itargetnode->GetRealPath() + "/" + target;
+	string fromabs = GetRealPath(name);
+	string toabs = itargetnode->GetRealPath(target);
 
-	setup();
-	int i = link(toabs.c_str(), name.c_str());
+	int i = link(toabs.c_str(), fromabs.c_str());
 	CheckError(i);
 }
 
 void InterixVFSNode::Unlink(const string& name)
 {
-	RAIILock locked;
-	setup(name);
+	string path = checkedpath(name);
 
-	int i = unlink(name.c_str());
+	int i = unlink(path.c_str());
 	if (i == -1)
 	{
 		/* Interix won't let us delete executables that are in use; for now
@@ -270,18 +348,16 @@ void InterixVFSNode::Unlink(const string& name)
 
 void InterixVFSNode::Symlink(const string& name, const string& target)
 {
-	RAIILock locked;
-	setup(name);
+	string path = checkedpath(name);
 
-	int i = symlink(target.c_str(), name.c_str());
+	int i = symlink(target.c_str(), path.c_str());
 	CheckError(i);
 }
 
 
 void InterixVFSNode::Utimes(const string& name, const struct timeval times[2])
 {
-	RAIILock locked;
-	setup();
+	string path = GetRealPath(name);
 
 	/* Interix doesn't support times(), even though the docs say it does! */
 
@@ -297,7 +373,7 @@ void InterixVFSNode::Utimes(const string& name, const struct timeval times[2])
 		ub.modtime = times[1].tv_sec;
 	}
 
-	int i = utime(name.c_str(), &ub);
+	int i = utime(path.c_str(), &ub);
 	if (i == -1)
 		throw errno;
 }
@@ -21,6 +21,12 @@ private:
 public:
 	const string& GetRealPath() { return _path; }
 
+	/* The host path of something in this directory. */
+	string GetRealPath(const string& name);
+
+	/* Held by anything which changes the real cwd. */
+	static Mutex CWDLock;
+
 	void StatFile(const string& name, struct stat& st);
 	void StatFS(struct statvfs& st);
 	Ref<VFSNode> Traverse(const string& name);
@@ -28,7 +34,7 @@ public:
 	Ref<FD> OpenFile(const string& name, int flags = O_RDONLY,
 			int mode = 0);
 	string ReadLink(const string& name);
-	deque<string> Enumerate();
+	DirStream* OpenDirStream();
 	void MkDir(const string& name, int mode = 0);
 	void RmDir(const string& name);
 	void Mknod(const string& name, mode_t mode, dev_t dev);
@@ -42,8 +48,7 @@ public:
 	void Utimes(const string& name, const struct timeval times[2]);
 
 private:
-	void setup();
-	void setup(const string& name, int e = EINVAL);
+	string checkedpath(const string& name, int e = EINVAL);
 
 private:
 	string _path;
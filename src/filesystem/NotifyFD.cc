@@ -0,0 +1,154 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "filesystem/NotifyFD.h"
+#include "filesystem/FDSet.h"
+#include <sys/time.h>
+#include <set>
+
+using std::set;
+
+/* Every NotifyFD in the process, so that fork() children can find them. */
+static set<NotifyFD*> notifyfds;
+static Mutex notifyfdslock("notify fds");
+
+void NotifyFD::MakePipe(int fds[2], int flags)
+{
+	if (flags & ~(LINUX_O_NONBLOCK | LINUX_O_CLOEXEC))
+		throw EINVAL;
+
+	if (pipe(fds) == -1)
+		throw errno;
+
+	/* The write end is ours alone. */
+
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	if (flags & LINUX_O_CLOEXEC)
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	if (flags & LINUX_O_NONBLOCK)
+		fcntl(fds[0], F_SETFL, O_NONBLOCK);
+}
+
+NotifyFD::NotifyFD(int fds[2]):
+	FD(fds[0]),
+	_writefd(fds[1]),
+	_notified(false)
+{
+	RAIILock locked(notifyfdslock);
+	notifyfds.insert(this);
+}
+
+/* The write end stays open until nothing refers to this any more, so that
+ * a late Notify() can't write to some other file that's reused the
+ * number. */
+NotifyFD::~NotifyFD()
+{
+	{
+		RAIILock locked(notifyfdslock);
+		notifyfds.erase(this);
+	}
+
+	close(_writefd);
+}
+
+/* Only one thread exists at this point, so no locks are needed. */
+void NotifyFD::InitPipes()
+{
+	for (set<NotifyFD*>::const_iterator i = notifyfds.begin();
+			i != notifyfds.end(); i++)
+		(*i)->renew_pipe();
+}
+
+/* Replaces the pipe underneath the guest's fd with a new one in the same
+ * state, keeping the guest's flags. */
+void NotifyFD::renew_pipe()
+{
+	int fd = GetFD();
+	if (fd == -1)
+		return;
+
+	int fdflags = fcntl(fd, F_GETFD, 0);
+	int flflags = fcntl(fd, F_GETFL, 0);
+
+	int fds[2];
+	if (pipe(fds) == -1)
+	{
+		Warning("unable to renew notification pipe: %d", errno);
+		return;
+	}
+
+	dup2(fds[0], fd);
+	close(fds[0]);
+	if (fdflags != -1)
+		fcntl(fd, F_SETFD, fdflags);
+	if (flflags != -1)
+		fcntl(fd, F_SETFL, flflags);
+
+	close(_writefd);
+	_writefd = fds[1];
+	fcntl(_writefd, F_SETFD, FD_CLOEXEC);
+	fcntl(_writefd, F_SETFL, O_NONBLOCK);
+
+	if (_notified)
+		write(_writefd, "", 1);
+}
+
+int NotifyFD::Poll(int events)
+{
+	int ready = 0;
+	if (_notified)
+		ready |= LINUX_POLLIN | LINUX_POLLRDNORM;
+
+	/* If it's not ready, let select() wait on the pipe. */
+
+	ready &= events;
+	return ready ? ready : -1;
+}
+
+void NotifyFD::Notify()
+{
+	/* Once the read end has gone, the write would just raise SIGPIPE. */
+
+	if (_notified || (GetFD() == -1))
+		return;
+
+	write(_writefd, "", 1);
+	_notified = true;
+}
+
+void NotifyFD::Clear()
+{
+	if (!_notified || (GetFD() == -1))
+		return;
+
+	/* There's always exactly one byte in the pipe, so this won't block
+	 * even if the guest has made the fd blocking. */
+
+	char c;
+	read(GetFD(), &c, 1);
+	_notified = false;
+}
+
+/* The guest may change this with fcntl(), so ask the host every time. */
+bool NotifyFD::IsNonBlocking()
+{
+	int flags = fcntl(GetFD(), F_GETFL, 0);
+	return (flags != -1) && (flags & O_NONBLOCK);
+}
+
+/* Blocks until the descriptor might be readable. Callers should check
+ * their state again afterwards, as another thread may have got there
+ * first. */
+void NotifyFD::WaitForNotify()
+{
+	int fd = GetFD();
+	FDSet reads;
+	reads.Set(fd);
+	if (select(fd+1, reads.Get(), NULL, NULL, NULL) == -1)
+		throw errno;
+}
@@ -0,0 +1,56 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef NOTIFYFD_H
+#define NOTIFYFD_H
+
+#include "FD.h"
+
+/* Base class for descriptors whose state is kept by LBW rather than the
+ * host: eventfd, timerfd and signalfd. The fd is the read end of a host
+ * pipe which has a byte in it whenever the descriptor is readable, so
+ * select(), poll() and epoll can wait on it like anything else.
+ *
+ * Subclasses call Notify() and Clear() as their state changes, with their
+ * own lock held.
+ *
+ * Unlike Linux, the state isn't shared across fork(): the child gets a copy
+ * of it, and InitPipes() gives every descriptor a new pipe so that the two
+ * processes don't consume each other's notifications.
+ */
+
+class NotifyFD : public FD
+{
+public:
+	NotifyFD(int fds[2]);
+	~NotifyFD();
+
+	/* Makes the pipe for a new descriptor. flags are the Linux O_NONBLOCK
+	 * and O_CLOEXEC. */
+	static void MakePipe(int fds[2], int flags);
+
+	/* Called in a new process. */
+	static void InitPipes();
+
+public:
+	int Poll(int events);
+	bool SelectsForWrite() { return false; }
+
+protected:
+	void Notify();
+	void Clear();
+	bool IsNotified() const { return _notified; }
+
+	bool IsNonBlocking();
+	void WaitForNotify();
+
+private:
+	void renew_pipe();
+
+	int _writefd;
+	volatile bool _notified;
+};
+
+#endif
@@ -0,0 +1,251 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "filesystem/ProcVFSNode.h"
+#include "filesystem/FakeFile.h"
+#include "syscalls/mmap.h"
+#include "syscalls/thread.h"
+#include "filesystem/VFS.h"
+#include "hostinfo.h"
+
+/* A very small subset of Linux's /proc. Everything in here is generated
+ * freshly every time it's opened.
+ */
+
+static string self_maps()
+{
+	return GetProcMaps();
+}
+
+static string self_status()
+{
+	MemoryStats ms;
+	GetMemoryStats(ms);
+
+	string name = Options.Executable;
+	size_t slash = name.rfind('/');
+	if (slash != string::npos)
+		name = name.substr(slash + 1);
+
+	return cprintf(
+			"Name:\t%s\n"
+			"State:\tR (running)\n"
+			"Tgid:\t%d\n"
+			"Pid:\t%d\n"
+			"PPid:\t%d\n"
+			"Uid:\t%d\t%d\t%d\t%d\n"
+			"Gid:\t%d\t%d\t%d\t%d\n"
+			"VmPeak:\t%8u kB\n"
+			"VmSize:\t%8u kB\n"
+			"VmHWM:\t%8u kB\n"
+			"VmRSS:\t%8u kB\n"
+			"Threads:\t%d\n",
+			name.c_str(),
+			getpid(), getpid(), getppid(),
+			getuid(), geteuid(), geteuid(), geteuid(),
+			getgid(), getegid(), getegid(), getegid(),
+			ms.VmPeak / 1024, ms.VmSize / 1024,
+			ms.VmHWM / 1024, ms.VmRSS / 1024,
+			CountGuestThreads());
+}
+
+static string self_exe()
+{
+	return Options.Executable;
+}
+
+static string self_cwd()
+{
+	return VFS::GetCWD();
+}
+
+/* Linux's names for the CPUID leaf 1 feature bits; EDX first, then ECX. */
+static const char* const cpuflags[64] =
+{
+	"fpu", "vme", "de", "pse", "tsc", "msr", "pae", "mce",
+	"cx8", "apic", NULL, "sep", "mtrr", "pge", "mca", "cmov",
+	"pat", "pse36", "pn", "clflush", NULL, "dts", "acpi", "mmx",
+	"fxsr", "sse", "sse2", "ss", "ht", "tm", "ia64", "pbe",
+
+	"pni", "pclmulqdq", "dtes64", "monitor", "ds_cpl", "vmx", "smx", "est",
+	"tm2", "ssse3", "cid", NULL, "fma", "cx16", "xtpr", "pdcm",
+	NULL, "pcid", "dca", "sse4_1", "sse4_2", "x2apic", "movbe", "popcnt",
+	"tsc_deadline_timer", "aes", "xsave", NULL, "avx", "f16c", "rdrand", NULL
+};
+
+/* Programs count the 'processor' lines to find out how many CPUs there are,
+ * so there has to be one stanza per processor. */
+static string cpuinfo()
+{
+	const HostInfo& hi = GetHostInfo();
+	u32 eax, ebx, ecx, edx;
+
+	char vendor[13];
+	HostCPUID(0, eax, ebx, ecx, edx);
+	memcpy(vendor+0, &ebx, 4);
+	memcpy(vendor+4, &edx, 4);
+	memcpy(vendor+8, &ecx, 4);
+	vendor[12] = '\0';
+
+	HostCPUID(1, eax, ebx, ecx, edx);
+	int stepping = eax & 0xf;
+	int model = (eax >> 4) & 0xf;
+	int family = (eax >> 8) & 0xf;
+	if (family == 0xf)
+		family += (eax >> 20) & 0xff;
+	if ((family == 0x6) || (family >= 0xf))
+		model |= ((eax >> 16) & 0xf) << 4;
+
+	string flags;
+	for (int i = 0; i < 64; i++)
+	{
+		u32 reg = (i < 32) ? edx : ecx;
+		if (cpuflags[i] && (reg & (1U << (i & 31))))
+		{
+			if (!flags.empty())
+				flags += ' ';
+			flags += cpuflags[i];
+		}
+	}
+
+	char modelname[49];
+	memset(modelname, 0, sizeof(modelname));
+	HostCPUID(0x80000000, eax, ebx, ecx, edx);
+	if (eax >= 0x80000004)
+	{
+		u32* p = (u32*) modelname;
+		for (u32 leaf = 0x80000002; leaf <= 0x80000004; leaf++)
+		{
+			HostCPUID(leaf, p[0], p[1], p[2], p[3]);
+			p += 4;
+		}
+	}
+	const char* name = modelname;
+	while (*name == ' ')
+		name++;
+	if (!*name)
+		name = "unknown";
+
+	string s;
+	for (int cpu = 0; cpu < hi.Processors; cpu++)
+	{
+		s += cprintf(
+			"processor\t: %d\n"
+			"vendor_id\t: %s\n"
+			"cpu family\t: %d\n"
+			"model\t\t: %d\n"
+			"model name\t: %s\n"
+			"stepping\t: %d\n"
+			"physical id\t: 0\n"
+			"siblings\t: %d\n"
+			"core id\t\t: %d\n"
+			"cpu cores\t: %d\n"
+			"flags\t\t: %s\n"
+			"\n",
+			cpu, vendor, family, model, name, stepping,
+			hi.Processors, cpu, hi.Processors,
+			flags.c_str());
+	}
+	return s;
+}
+
+static string meminfo()
+{
+	const HostInfo& hi = GetHostInfo();
+	u32 pagekb = hi.PageSize / 1024;
+
+	u32 total = hi.PhysicalPages * pagekb;
+	u32 avail = GetHostFreePages() * pagekb;
+	return cprintf(
+			"MemTotal:\t%8u kB\n"
+			"MemFree:\t%8u kB\n"
+			"MemAvailable:\t%8u kB\n"
+			"Buffers:\t%8u kB\n"
+			"Cached:\t\t%8u kB\n"
+			"SwapTotal:\t%8u kB\n"
+			"SwapFree:\t%8u kB\n",
+			total, avail, avail, 0, 0, 0, 0);
+}
+
+/* Times here are in USER_HZ, which is always 100; NT counts in 100ns. */
+#define NT_TO_USER_HZ(t) ((t) / 100000ULL)
+
+static string proc_stat()
+{
+	vector<HostCPUTimes> times;
+	GetHostCPUTimes(times);
+
+	HostCPUTimes total;
+	total.User = total.System = total.Idle = 0;
+	for (unsigned i = 0; i < times.size(); i++)
+	{
+		total.User += times[i].User;
+		total.System += times[i].System;
+		total.Idle += times[i].Idle;
+	}
+
+	string s = cprintf("cpu  %llu 0 %llu %llu 0 0 0 0 0 0\n",
+			NT_TO_USER_HZ(total.User), NT_TO_USER_HZ(total.System),
+			NT_TO_USER_HZ(total.Idle));
+	for (unsigned i = 0; i < times.size(); i++)
+		s += cprintf("cpu%u %llu 0 %llu %llu 0 0 0 0 0 0\n", i,
+				NT_TO_USER_HZ(times[i].User),
+				NT_TO_USER_HZ(times[i].System),
+				NT_TO_USER_HZ(times[i].Idle));
+
+	s += cprintf(
+			"intr 0\n"
+			"ctxt 0\n"
+			"btime %lu\n"
+			"processes 0\n"
+			"procs_running 1\n"
+			"procs_blocked 0\n",
+			(unsigned long) GetHostBootTime());
+	return s;
+}
+
+static string uptime()
+{
+	vector<HostCPUTimes> times;
+	GetHostCPUTimes(times);
+
+	u64 idle = 0;
+	for (unsigned i = 0; i < times.size(); i++)
+		idle += NT_TO_USER_HZ(times[i].Idle);
+
+	time_t boot = GetHostBootTime();
+	u32 up = boot ? (time(NULL) - boot) : 0;
+	return cprintf("%u.00 %llu.%02llu\n", up, idle / 100, idle % 100);
+}
+
+/* glibc's shm_open() looks in here to find out where tmpfs is mounted. */
+static string mounts()
+{
+	return
+		"rootfs / rootfs rw 0 0\n"
+		"tmpfs /dev/shm tmpfs rw 0 0\n";
+}
+
+ProcVFSNode::ProcVFSNode(VFSNode* parent, const string& name):
+	FakeVFSNode(parent, name),
+	_selfnode(new FakeVFSNode(this, "self"))
+{
+	_selfnode->AddFile(new GeneratedFakeFile("maps", self_maps));
+	_selfnode->AddFile(new GeneratedFakeFile("status", self_status));
+	_selfnode->AddFile(new GeneratedFakeLink("exe", self_exe));
+	_selfnode->AddFile(new GeneratedFakeLink("cwd", self_cwd));
+	AddDirectory(_selfnode);
+
+	AddFile(new GeneratedFakeFile("mounts", mounts));
+	AddFile(new GeneratedFakeFile("cpuinfo", cpuinfo));
+	AddFile(new GeneratedFakeFile("meminfo", meminfo));
+	AddFile(new GeneratedFakeFile("stat", proc_stat));
+	AddFile(new GeneratedFakeFile("uptime", uptime));
+}
+
+ProcVFSNode::~ProcVFSNode()
+{
+}
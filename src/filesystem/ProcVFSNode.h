@@ -0,0 +1,21 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef PROCVFSNODE_H
+#define PROCVFSNODE_H
+
+#include "FakeVFSNode.h"
+
+class ProcVFSNode : public FakeVFSNode
+{
+public:
+	ProcVFSNode(VFSNode* parent, const string& name);
+	~ProcVFSNode();
+
+private:
+	Ref<FakeVFSNode> _selfnode;
+};
+
+#endif
@@ -9,20 +9,35 @@
 #include "filesystem/VFS.h"
 #include "filesystem/VFSNode.h"
 #include "filesystem/InterixVFSNode.h"
+#include "filesystem/FDSet.h"
 #include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <algorithm>
+
+using std::min;
+
+/* sendfile() maps the source this much at a time. Mapping offsets have to be
+ * aligned to the NT allocation granularity. */
+#define SENDFILE_WINDOW (1024*1024)
+#define MAPPING_GRANULARITY 0x10000
 
 RealFD::RealFD(int fd):
-	FD(fd)
+	FD(fd),
+	_pollkind(POLL_UNKNOWN),
+	_dontwaitlock("MSG_DONTWAIT")
 {
 }
 
 RealFD::RealFD(int fd, VFSNode* node):
-	FD(fd, node)
+	FD(fd, node),
+	_pollkind(POLL_ALWAYS),
+	_dontwaitlock("MSG_DONTWAIT")
 {
 }
 
@@ -30,10 +45,76 @@ RealFD::~RealFD()
 {
 }
 
+/* Makes the descriptor non-blocking while it's in scope, if it isn't
+ * already. Other threads using it meanwhile may get a spurious EAGAIN; see
+ * retry_eagain(). */
+class DontWait
+{
+public:
+	DontWait(RealFD& fdo, bool enabled):
+		_fdo(fdo),
+		_enabled(enabled),
+		_flags(-1)
+	{
+		if (!_enabled)
+			return;
+
+		_fdo._dontwaitlock.Lock();
+		int flags = fcntl(_fdo.GetFD(), F_GETFL, 0);
+		if ((flags != -1) && !(flags & O_NONBLOCK) &&
+				(fcntl(_fdo.GetFD(), F_SETFL, flags | O_NONBLOCK) != -1))
+			_flags = flags;
+	}
+
+	~DontWait()
+	{
+		if (!_enabled)
+			return;
+
+		int e = errno;
+		if (_flags != -1)
+			fcntl(_fdo.GetFD(), F_SETFL, _flags);
+		_fdo._dontwaitlock.Unlock();
+		errno = e;
+	}
+
+private:
+	RealFD& _fdo;
+	bool _enabled;
+	int _flags;
+};
+
+/* Called after an EAGAIN. If the guest's descriptor is really blocking,
+ * the EAGAIN came from another thread's MSG_DONTWAIT; wait for the
+ * descriptor to be ready and return true to try again. */
+bool RealFD::retry_eagain(bool writing)
+{
+	int fd = GetFD();
+	int e = errno;
+	int flags;
+	{
+		RAIILock locked(_dontwaitlock);
+		flags = fcntl(fd, F_GETFL, 0);
+	}
+	errno = e;
+	if ((flags == -1) || (flags & O_NONBLOCK))
+		return false;
+
+	FDSet fds;
+	fds.Set(fd);
+	select(fd+1, writing ? NULL : fds.Get(), writing ? fds.Get() : NULL,
+			NULL, NULL);
+	return true;
+}
+
 int RealFD::ReadV(const struct iovec* iov, int iovcnt)
 {
 	int fd = GetFD();
-	int result = readv(fd, iov, iovcnt);
+	Touch();
+	int result;
+	do
+		result = readv(fd, iov, iovcnt);
+	while ((result == -1) && (errno == EAGAIN) && retry_eagain(false));
 	if (result == -1)
 		throw errno;
 	return result;
@@ -42,7 +123,11 @@ int RealFD::ReadV(const struct iovec* iov, int iovcnt)
 int RealFD::Read(void* buffer, size_t size)
 {
 	int fd = GetFD();
-	int result = read(fd, buffer, size);
+	Touch();
+	int result;
+	do
+		result = read(fd, buffer, size);
+	while ((result == -1) && (errno == EAGAIN) && retry_eagain(false));
 	if (result == -1)
 		throw errno;
 	return result;
@@ -51,7 +136,11 @@ int RealFD::Read(void* buffer, size_t size)
 int RealFD::Write(const void* buffer, size_t size)
 {
 	int fd = GetFD();
-	int result = write(fd, buffer, size);
+	Touch();
+	int result;
+	do
+		result = write(fd, buffer, size);
+	while ((result == -1) && (errno == EAGAIN) && retry_eagain(true));
 	if (result == -1)
 		throw errno;
 	return result;
@@ -60,14 +149,259 @@ int RealFD::Write(const void* buffer, size_t size)
 int RealFD::WriteV(const struct iovec* iov, int iovcnt)
 {
 	int fd = GetFD();
-	int result = writev(fd, iov, iovcnt);
+	Touch();
+	int result;
+	do
+		result = writev(fd, iov, iovcnt);
+	while ((result == -1) && (errno == EAGAIN) && retry_eagain(true));
+	if (result == -1)
+		throw errno;
+	return result;
+}
+
+/* Interix offsets are only 32 bits wide. */
+static off_t host_offset(int64_t offset)
+{
+	if (offset < 0)
+		throw EINVAL;
+	if (offset > 0xffffffffLL)
+		throw EFBIG;
+	return offset;
+}
+
+int RealFD::PRead(void* buffer, size_t size, int64_t offset)
+{
+	int fd = GetFD();
+	int result = pread(fd, buffer, size, host_offset(offset));
 	if (result == -1)
 		throw errno;
 	return result;
 }
 
+int RealFD::PWrite(const void* buffer, size_t size, int64_t offset)
+{
+	int fd = GetFD();
+	int result = pwrite(fd, buffer, size, host_offset(offset));
+	if (result == -1)
+		throw errno;
+	return result;
+}
+
+/* Interix has no preadv() or pwritev(), so do one pread() per buffer,
+ * stopping at the first short transfer. */
+
+int RealFD::PReadV(const struct iovec* iov, int iovcnt, int64_t offset)
+{
+	int total = 0;
+	for (int i = 0; i < iovcnt; i++)
+	{
+		int count;
+		try
+		{
+			count = PRead(iov[i].iov_base, iov[i].iov_len, offset + total);
+		}
+		catch (int e)
+		{
+			if (total)
+				break;
+			throw e;
+		}
+
+		total += count;
+		if ((size_t) count < iov[i].iov_len)
+			break;
+	}
+	return total;
+}
+
+int RealFD::PWriteV(const struct iovec* iov, int iovcnt, int64_t offset)
+{
+	int total = 0;
+	for (int i = 0; i < iovcnt; i++)
+	{
+		int count;
+		try
+		{
+			count = PWrite(iov[i].iov_base, iov[i].iov_len, offset + total);
+		}
+		catch (int e)
+		{
+			if (total)
+				break;
+			throw e;
+		}
+
+		total += count;
+		if ((size_t) count < iov[i].iov_len)
+			break;
+	}
+	return total;
+}
+
+/* Regular files are mapped a window at a time and written straight out of
+ * the mapping, which saves copying everything through a buffer. Anything
+ * else goes the slow way. */
+int RealFD::SendFile(FD* out, int64_t* offset, size_t count)
+{
+	int fd = GetFD();
+	struct stat st;
+	if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode))
+		return FD::SendFile(out, offset, count);
+
+	int64_t pos;
+	if (offset)
+		pos = *offset;
+	else
+	{
+		pos = lseek(fd, 0, SEEK_CUR);
+		if (pos == -1)
+			throw errno;
+	}
+
+	if (pos >= st.st_size)
+		return 0;
+	count = min(count, (size_t) (st.st_size - pos));
+
+	size_t sent = 0;
+	while (sent < count)
+	{
+		int64_t here = pos + sent;
+		off_t base = host_offset(here & ~(int64_t)(MAPPING_GRANULARITY-1));
+		size_t delta = here - base;
+		size_t len = min(count - sent, (size_t) SENDFILE_WINDOW);
+
+		u8* p = (u8*) mmap(NULL, delta + len, PROT_READ, MAP_SHARED, fd, base);
+		if (p == (u8*) MAP_FAILED)
+		{
+			/* Give up and copy the rest. */
+
+			int64_t o = here;
+			try
+			{
+				sent += FD::SendFile(out, &o, count - sent);
+			}
+			catch (int e)
+			{
+				if (!sent)
+					throw e;
+			}
+			break;
+		}
+
+		size_t w = 0;
+		try
+		{
+			while (w < len)
+				w += out->Write(p + delta + w, len - w);
+		}
+		catch (int e)
+		{
+			if (!sent && !w)
+			{
+				munmap(p, delta + len);
+				throw e;
+			}
+		}
+		munmap(p, delta + len);
+
+		sent += w;
+		if (w < len)
+			break;
+	}
+
+	if (offset)
+		*offset = pos + sent;
+	else
+		lseek(fd, host_offset(pos + sent), SEEK_SET);
+	return sent;
+}
+
+/* Works out what kind of thing this is, the first time it's needed. */
+void RealFD::classify()
+{
+	if (_pollkind != POLL_UNKNOWN)
+		return;
+
+	int fd = GetFD();
+	struct stat st;
+	if (fstat(fd, &st) == -1)
+		return;
+
+	if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))
+		_pollkind = POLL_ALWAYS;
+	else if (S_ISFIFO(st.st_mode))
+		_pollkind = POLL_PIPE;
+	else if (S_ISSOCK(st.st_mode))
+	{
+		int type = 0;
+		int len = sizeof(type);
+		getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len);
+		_pollkind = (type == SOCK_STREAM) ? POLL_STREAM : POLL_SELECT;
+	}
+	else
+		_pollkind = POLL_SELECT;
+}
+
+bool RealFD::CanBlock()
+{
+	classify();
+	return _pollkind != POLL_ALWAYS;
+}
+
+/* Regular files and directories are always ready; it's only worth asking
+ * the host about everything else. */
+int RealFD::Poll(int events)
+{
+	classify();
+	if (_pollkind == POLL_ALWAYS)
+		return events & LINUX_POLL_ALWAYS;
+	return -1;
+}
+
+static bool still_readable(int fd)
+{
+	FDSet reads;
+	reads.Set(fd);
+	struct timeval tv = { 0, 0 };
+	return select(fd+1, reads.Get(), NULL, NULL, &tv) > 0;
+}
+
+/* A stream socket or pipe that's readable but has nothing to read has been
+ * closed at the other end (or another thread has just emptied it, which is
+ * why readability is checked again). Only then is the socket peeked at, as
+ * the end-of-file or error is permanent and the peek can't block. */
+int RealFD::PollHangup(int events)
+{
+	classify();
+	if ((_pollkind != POLL_STREAM) && (_pollkind != POLL_PIPE))
+		return 0;
+
+	int fd = GetFD();
+	int avail = 0;
+	if ((ioctl(fd, FIONREAD, &avail) == -1) || (avail > 0))
+		return 0;
+	if (!still_readable(fd))
+		return 0;
+
+	if (_pollkind == POLL_PIPE)
+		return LINUX_POLLHUP;
+
+	char c;
+	int n = recv(fd, &c, 1, MSG_PEEK);
+	if (n == 0)
+		return LINUX_POLLHUP | (events & LINUX_POLLRDHUP);
+	if ((n == -1) && ((errno == ECONNRESET) || (errno == ECONNREFUSED) ||
+			(errno == ETIMEDOUT) || (errno == EPIPE)))
+		return LINUX_POLLERR | LINUX_POLLHUP;
+	return 0;
+}
+
 int64_t RealFD::Seek(int whence, int64_t offset)
 {
+	/* Directories seek by getdents cookie. */
+	if (GetVFSNode())
+		return FD::Seek(whence, offset);
+
 	int fd = GetFD();
 	off_t i = lseek(fd, whence, offset);
 	if (i == -1)
@@ -152,7 +486,6 @@ void RealFD::Connect(const struct sockaddr* sa, int addrlen)
 
 			const struct sockaddr_un* sun = (const struct sockaddr_un*) sa;
 
-			RAIILock locked;
 			Ref<VFSNode> node;
 			string leaf;
 			VFS::Resolve(NULL, sun->sun_path, node, leaf, false);
@@ -161,14 +494,32 @@ void RealFD::Connect(const struct sockaddr* sa, int addrlen)
 			if (!inode)
 				throw EINVAL;
 
-			int i = chdir(inode->GetRealPath().c_str());
-			if (i == -1)
-				throw errno;
-
 			struct sockaddr_un childsun;
 			childsun.sun_family = AF_UNIX;
+
+			/* Use the absolute path if it'll fit; otherwise we have to
+			 * chdir() into the directory and use the leaf name. */
+
+			string path = inode->GetRealPath(leaf);
+			if (path.size() < sizeof(childsun.sun_path))
+			{
+				strcpy(childsun.sun_path, path.c_str());
+				int i = connect(fd, (const struct sockaddr*) &childsun,
+						sizeof(childsun));
+				if (i == -1)
+					throw errno;
+				break;
+			}
+
+			if (leaf.size() >= sizeof(childsun.sun_path))
+				throw ENAMETOOLONG;
 			strcpy(childsun.sun_path, leaf.c_str());
 
+			RAIILock locked(InterixVFSNode::CWDLock);
+			int i = chdir(inode->GetRealPath().c_str());
+			if (i == -1)
+				throw errno;
+
 			i = connect(fd, (const struct sockaddr*) &childsun,
 					sizeof(childsun));
 			if (i == -1)
@@ -201,6 +552,26 @@ void RealFD::Bind(const struct sockaddr* sa, int addrlen)
 	}
 }
 
+void RealFD::Listen(int backlog)
+{
+	int fd = GetFD();
+	int result = listen(fd, backlog);
+	if (result == -1)
+		throw errno;
+}
+
+int RealFD::Accept(struct sockaddr* addr, int* addrlen)
+{
+	int fd = GetFD();
+	Touch();
+	int newfd = accept(fd, addr, addrlen);
+	if (newfd == -1)
+		throw errno;
+
+	new RealFD(newfd);
+	return newfd;
+}
+
 void RealFD::Shutdown(int how)
 {
 	int fd = GetFD();
@@ -261,10 +632,17 @@ void RealFD::GetPeername(struct sockaddr* sa, int* namelen)
 }
 
 int RealFD::RecvFrom(void *buf, size_t len, int flags,
-		struct sockaddr *from, int *fromlen)
+		struct sockaddr *from, int *fromlen, bool dontwait)
 {
 	int fd = GetFD();
-	int i = recvfrom(fd, buf, len, flags, from, fromlen);
+	Touch();
+	int i;
+	do
+	{
+		DontWait nonblocking(*this, dontwait);
+		i = recvfrom(fd, buf, len, flags, from, fromlen);
+	}
+	while ((i == -1) && (errno == EAGAIN) && !dontwait && retry_eagain(false));
 	if (i == -1)
 		throw errno;
 	return i;
@@ -274,7 +652,40 @@ int RealFD::SendTo(const void *buf, size_t len, int flags,
 		const struct sockaddr* to, int tolen)
 {
 	int fd = GetFD();
-	int i = sendto(fd, buf, len, flags, to, tolen);
+	Touch();
+	int i;
+	do
+		i = sendto(fd, buf, len, flags, to, tolen);
+	while ((i == -1) && (errno == EAGAIN) && retry_eagain(true));
+	if (i == -1)
+		throw errno;
+	return i;
+}
+
+int RealFD::SendMsg(const struct msghdr* msg, int flags)
+{
+	int fd = GetFD();
+	Touch();
+	int i;
+	do
+		i = sendmsg(fd, msg, flags);
+	while ((i == -1) && (errno == EAGAIN) && retry_eagain(true));
+	if (i == -1)
+		throw errno;
+	return i;
+}
+
+int RealFD::RecvMsg(struct msghdr* msg, int flags, bool dontwait)
+{
+	int fd = GetFD();
+	Touch();
+	int i;
+	do
+	{
+		DontWait nonblocking(*this, dontwait);
+		i = recvmsg(fd, msg, flags);
+	}
+	while ((i == -1) && (errno == EAGAIN) && !dontwait && retry_eagain(false));
 	if (i == -1)
 		throw errno;
 	return i;
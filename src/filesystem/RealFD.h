@@ -25,6 +25,14 @@ public:
 	int WriteV(const struct iovec* iov, int iovcnt);
 	int Read(void* buffer, size_t size);
 	int Write(const void* buffer, size_t size);
+	int PRead(void* buffer, size_t size, int64_t offset);
+	int PWrite(const void* buffer, size_t size, int64_t offset);
+	int PReadV(const struct iovec* iov, int iovcnt, int64_t offset);
+	int PWriteV(const struct iovec* iov, int iovcnt, int64_t offset);
+	int SendFile(FD* out, int64_t* offset, size_t count);
+	int Poll(int events);
+	int PollHangup(int events);
+	bool CanBlock();
 	int64_t Seek(int whence, int64_t offset);
 	void Truncate(int64_t length);
 	void Fsync();
@@ -41,6 +49,8 @@ public:
 
 	void Connect(const struct sockaddr* addr, int addrlen);
 	void Bind(const struct sockaddr* addr, int addrlen);
+	void Listen(int backlog);
+	int Accept(struct sockaddr* addr, int* addrlen);
 	void Shutdown(int how);
 
 	void SetSockopt(int level, int optname, const void* option,	int optlen);
@@ -51,7 +61,31 @@ public:
 	int SendTo(const void *buf, size_t len, int flags,
 			const struct sockaddr* to, int tolen);
 	int RecvFrom(void *buf, size_t len, int flags,
-			struct sockaddr* from, int* fromlen);
+			struct sockaddr* from, int* fromlen, bool dontwait = false);
+	int SendMsg(const struct msghdr* msg, int flags);
+	int RecvMsg(struct msghdr* msg, int flags, bool dontwait = false);
+
+private:
+	friend class DontWait;
+
+	void classify();
+	bool retry_eagain(bool writing);
+
+	enum
+	{
+		POLL_UNKNOWN,
+		POLL_ALWAYS,            // files and directories never block
+		POLL_SELECT,
+		POLL_STREAM,            // stream socket; select(), and can hang up
+		POLL_PIPE               // ditto for pipes
+	};
+
+	int _pollkind;
+
+	/* The host has no MSG_DONTWAIT, so the descriptor is made non-blocking
+	 * for the duration of the call instead; this covers that, and the
+	 * guest's own F_GETFL and F_SETFL. */
+	Mutex _dontwaitlock;
 };
 
 #endif
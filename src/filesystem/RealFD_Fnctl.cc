@@ -75,6 +75,7 @@ int RealFD::Fcntl(int cmd, u_int32_t argument)
 	{
 		case LINUX_F_GETFL:
 		{
+			RAIILock locked(_dontwaitlock);
 			int result = fcntl(fd, F_GETFL, NULL);
 			if (result == -1)
 				throw errno;
@@ -85,6 +86,7 @@ int RealFD::Fcntl(int cmd, u_int32_t argument)
 		{
 			int iflags = FileFlagsL2I(argument);
 			//log("setting flags for realfd %d to %x", fd, iflags);
+			RAIILock locked(_dontwaitlock);
 			int result = fcntl(fd, F_SETFL, iflags);
 			CheckError(result);
 			return result;
@@ -8,7 +8,9 @@
 
 RootVFSNode::RootVFSNode(const string& path):
 	InterixVFSNode(NULL, "", path),
-	_devfs(new DevVFSNode(this, "dev"))
+	_devfs(new DevVFSNode(this, "dev")),
+	_procfs(new ProcVFSNode(this, "proc")),
+	_sysfs(new SysVFSNode(this, "sys"))
 {
 }
 
@@ -25,6 +27,10 @@ Ref<VFSNode> RootVFSNode::Traverse(const string& name)
 {
 	if (name == "dev")
 		return _devfs;
+	if (name == "proc")
+		return _procfs;
+	if (name == "sys")
+		return _sysfs;
 
 	return InterixVFSNode::Traverse(name);
 }
@@ -8,6 +8,8 @@
 
 #include "InterixVFSNode.h"
 #include "DevVFSNode.h"
+#include "ProcVFSNode.h"
+#include "SysVFSNode.h"
 
 class RootVFSNode : public InterixVFSNode
 {
@@ -20,6 +22,8 @@ public:
 
 private:
 	Ref<VFSNode> _devfs;
+	Ref<VFSNode> _procfs;
+	Ref<VFSNode> _sysfs;
 };
 
 #endif
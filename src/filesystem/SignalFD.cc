@@ -0,0 +1,174 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "filesystem/SignalFD.h"
+#include "syscalls/signals.h"
+
+/* How often the timer thread looks for pending signals. */
+#define SIGNALFD_POLL_US 20000
+
+/* Always taken after the timer thread's lock, never before it. */
+static Mutex signalfdlock("signalfd");
+
+/* Fills in found with those signals in mask that are pending on this thread
+ * or the process. */
+static bool find_pending(const sigset_t& mask, sigset_t& found)
+{
+	sigset_t pending;
+	sigpending(&pending);
+
+	bool any = false;
+	sigemptyset(&found);
+	for (int isig = 1; isig < NSIG; isig++)
+	{
+		if (sigismember(&pending, isig) && sigismember(&mask, isig))
+		{
+			sigaddset(&found, isig);
+			any = true;
+		}
+	}
+	return any;
+}
+
+int SignalFD::Create(const sigset_t& mask, int flags)
+{
+	int fds[2];
+	MakePipe(fds, flags);
+	new SignalFD(fds, mask);
+	return fds[0];
+}
+
+SignalFD::SignalFD(int fds[2], const sigset_t& mask):
+	NotifyFD(fds),
+	_mask(mask),
+	_nextcheck(0)
+{
+	sigemptyset(&_seen);
+	TimerThread::Add(this);
+}
+
+SignalFD::~SignalFD()
+{
+	TimerThread::Remove(this);
+}
+
+void SignalFD::Close()
+{
+	TimerThread::Remove(this);
+	NotifyFD::Close();
+}
+
+void SignalFD::SetMask(const sigset_t& mask)
+{
+	{
+		RAIILock locked(signalfdlock);
+		_mask = mask;
+		_nextcheck = 0;
+	}
+	TimerThread::Changed();
+}
+
+int SignalFD::Read(void* buffer, size_t size)
+{
+	linux_signalfd_siginfo* infos = (linux_signalfd_siginfo*) buffer;
+	size_t max = size / sizeof(linux_signalfd_siginfo);
+	if (max == 0)
+		throw EINVAL;
+
+	size_t count = 0;
+	while (count < max)
+	{
+		sigset_t mask;
+		{
+			RAIILock locked(signalfdlock);
+			mask = _mask;
+		}
+
+		/* Only block if nothing's been read yet. */
+
+		sigset_t ready;
+		if (!find_pending(mask, ready))
+		{
+			if (count)
+				break;
+			if (IsNonBlocking())
+				throw EAGAIN;
+			ready = mask;
+		}
+
+		int isig;
+		int e = sigwait(&ready, &isig);
+		if (e == -1)
+			e = errno;
+		if (e)
+		{
+			if (count)
+				break;
+			throw e;
+		}
+
+		linux_signalfd_siginfo& info = infos[count++];
+		memset(&info, 0, sizeof(info));
+		info.ssi_signo = SignalI2L(isig);
+	}
+
+	RAIILock locked(signalfdlock);
+	if (!find_pending(_mask, _seen))
+		Clear();
+	Touch();
+
+	return count * sizeof(linux_signalfd_siginfo);
+}
+
+int SignalFD::Poll(int events)
+{
+	sigset_t mask;
+	{
+		RAIILock locked(signalfdlock);
+		mask = _mask;
+	}
+
+	sigset_t ready;
+	if ((events & (LINUX_POLLIN | LINUX_POLLRDNORM)) && find_pending(mask, ready))
+		return events & (LINUX_POLLIN | LINUX_POLLRDNORM);
+	return -1;
+}
+
+/* Called by the timer thread. */
+int64_t SignalFD::GetDeadline()
+{
+	RAIILock locked(signalfdlock);
+	return _nextcheck;
+}
+
+/* Called by the timer thread, which blocks all signals, so sigpending()
+ * sees exactly those pending on the process. */
+void SignalFD::Expire(int64_t now)
+{
+	RAIILock locked(signalfdlock);
+
+	/* A signal that wasn't pending last time is a new edge, even if the
+	 * pipe's already readable. */
+
+	sigset_t ready;
+	if (find_pending(_mask, ready))
+	{
+		Notify();
+		for (int isig = 1; isig < NSIG; isig++)
+		{
+			if (sigismember(&ready, isig) && !sigismember(&_seen, isig))
+			{
+				Touch();
+				break;
+			}
+		}
+	}
+	else
+		Clear();
+	_seen = ready;
+
+	_nextcheck = now + SIGNALFD_POLL_US;
+}
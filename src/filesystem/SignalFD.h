@@ -0,0 +1,69 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef SIGNALFD_H
+#define SIGNALFD_H
+
+#include "NotifyFD.h"
+#include "TimerThread.h"
+#include <signal.h>
+
+#define LINUX_SFD_CLOEXEC      LINUX_O_CLOEXEC
+#define LINUX_SFD_NONBLOCK     LINUX_O_NONBLOCK
+
+struct linux_signalfd_siginfo
+{
+	u32 ssi_signo;
+	s32 ssi_errno;
+	s32 ssi_code;
+	u32 ssi_pid;
+	u32 ssi_uid;
+	s32 ssi_fd;
+	u32 ssi_tid;
+	u32 ssi_band;
+	u32 ssi_overrun;
+	u32 ssi_trapno;
+	s32 ssi_status;
+	s32 ssi_int;
+	u64 ssi_ptr;
+	u64 ssi_utime;
+	u64 ssi_stime;
+	u64 ssi_addr;
+	u16 ssi_addr_lsb;
+	u8 pad[46];
+} PACKED;
+
+/* A signalfd. Signals are read with sigwait(), so (as on Linux) the guest
+ * has to have blocked them. Interix can't tell us when one becomes
+ * pending, so while the descriptor is open the timer thread looks every so
+ * often and sets the pipe for the benefit of select() and epoll; poll()
+ * and read() always look for themselves.
+ */
+
+class SignalFD : public NotifyFD, private TimerThread::Client
+{
+public:
+	static int Create(const sigset_t& mask, int flags);
+
+	SignalFD(int fds[2], const sigset_t& mask);
+	~SignalFD();
+
+public:
+	void Close();
+	int Read(void* buffer, size_t size);
+	int Poll(int events);
+
+	void SetMask(const sigset_t& mask);
+
+private:
+	int64_t GetDeadline();
+	void Expire(int64_t now);
+
+	sigset_t _mask;
+	sigset_t _seen;          // pending when last looked at
+	int64_t _nextcheck;
+};
+
+#endif
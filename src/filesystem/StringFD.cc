@@ -0,0 +1,112 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "filesystem/StringFD.h"
+#include "filesystem/file.h"
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+using std::min;
+
+StringFD::StringFD(int fd, const string& data):
+	FD(fd),
+	_data(data),
+	_pos(0)
+{
+}
+
+StringFD::~StringFD()
+{
+}
+
+int StringFD::Read(void* buffer, size_t size)
+{
+	if (_pos >= _data.size())
+		return 0;
+
+	size_t count = min(size, _data.size() - _pos);
+	memcpy(buffer, _data.data() + _pos, count);
+	_pos += count;
+	return count;
+}
+
+int StringFD::ReadV(const struct iovec* iov, int iovcnt)
+{
+	int total = 0;
+	for (int i = 0; i < iovcnt; i++)
+	{
+		int count = Read(iov[i].iov_base, iov[i].iov_len);
+		total += count;
+		if ((size_t) count < iov[i].iov_len)
+			break;
+	}
+	return total;
+}
+
+int StringFD::PRead(void* buffer, size_t size, int64_t offset)
+{
+	if (offset < 0)
+		throw EINVAL;
+	if ((u64) offset >= _data.size())
+		return 0;
+
+	size_t count = min(size, _data.size() - (size_t) offset);
+	memcpy(buffer, _data.data() + offset, count);
+	return count;
+}
+
+int StringFD::PReadV(const struct iovec* iov, int iovcnt, int64_t offset)
+{
+	int total = 0;
+	for (int i = 0; i < iovcnt; i++)
+	{
+		int count = PRead(iov[i].iov_base, iov[i].iov_len, offset + total);
+		total += count;
+		if ((size_t) count < iov[i].iov_len)
+			break;
+	}
+	return total;
+}
+
+int StringFD::Write(const void* buffer, size_t size)
+{
+	throw EBADF;
+}
+
+/* Callers pass the offset first and the whence second. */
+int64_t StringFD::Seek(int offset, int64_t whence)
+{
+	int64_t pos;
+	switch (whence)
+	{
+		case SEEK_SET: pos = offset; break;
+		case SEEK_CUR: pos = _pos + offset; break;
+		case SEEK_END: pos = _data.size() + offset; break;
+		default:
+			throw EINVAL;
+	}
+
+	if (pos < 0)
+		throw EINVAL;
+	_pos = pos;
+	return pos;
+}
+
+void StringFD::Fstat(struct stat& st)
+{
+	/* Like Linux, /proc files claim to be empty. */
+
+	memset(&st, 0, sizeof(st));
+	st.st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+	st.st_nlink = 1;
+	st.st_ino = 1;
+}
+
+int StringFD::Poll(int events)
+{
+	return events & LINUX_POLL_ALWAYS;
+}
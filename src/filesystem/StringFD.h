@@ -0,0 +1,36 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef STRINGFD_H
+#define STRINGFD_H
+
+#include "FD.h"
+
+/* A read-only FD whose contents are a string held in memory. Used for the
+ * synthesised files in /proc. The fd number is a dummy.
+ */
+
+class StringFD : public FD
+{
+public:
+	StringFD(int fd, const string& data);
+	~StringFD();
+
+public:
+	int ReadV(const struct iovec* iov, int iovcnt);
+	int Read(void* buffer, size_t size);
+	int PRead(void* buffer, size_t size, int64_t offset);
+	int PReadV(const struct iovec* iov, int iovcnt, int64_t offset);
+	int Write(const void* buffer, size_t size);
+	int64_t Seek(int whence, int64_t offset);
+	void Fstat(struct stat& st);
+	int Poll(int events);
+
+private:
+	string _data;
+	size_t _pos;
+};
+
+#endif
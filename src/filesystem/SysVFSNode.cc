@@ -0,0 +1,79 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "filesystem/SysVFSNode.h"
+#include "filesystem/FakeFile.h"
+#include "hostinfo.h"
+
+/* Just enough of sysfs for glibc's sysconf(_SC_NPROCESSORS_*) and friends,
+ * which look at /sys/devices/system/cpu before falling back to /proc.
+ */
+
+/* Formats a CPU mask the way the kernel does, e.g. "0-3,6". */
+static string cpulist(u32 mask)
+{
+	string s;
+	int cpu = 0;
+	while (cpu < 32)
+	{
+		if (!(mask & (1U << cpu)))
+		{
+			cpu++;
+			continue;
+		}
+
+		int first = cpu;
+		while ((cpu < 32) && (mask & (1U << cpu)))
+			cpu++;
+
+		if (!s.empty())
+			s += ',';
+		if ((cpu - 1) == first)
+			s += cprintf("%d", first);
+		else
+			s += cprintf("%d-%d", first, cpu - 1);
+	}
+
+	return s + "\n";
+}
+
+static string cpu_possible()
+{
+	int n = GetHostInfo().Processors;
+	return cpulist((n >= 32) ? 0xffffffff : ((1U << n) - 1));
+}
+
+static string cpu_online()
+{
+	return cpulist(GetHostInfo().ProcessorMask);
+}
+
+SysVFSNode::SysVFSNode(VFSNode* parent, const string& name):
+	FakeVFSNode(parent, name)
+{
+	Ref<FakeVFSNode> devices = new FakeVFSNode(this, "devices");
+	AddDirectory(devices);
+
+	Ref<FakeVFSNode> system = new FakeVFSNode(devices, "system");
+	devices->AddDirectory(system);
+
+	Ref<FakeVFSNode> cpu = new FakeVFSNode(system, "cpu");
+	system->AddDirectory(cpu);
+
+	cpu->AddFile(new GeneratedFakeFile("possible", cpu_possible));
+	cpu->AddFile(new GeneratedFakeFile("present", cpu_possible));
+	cpu->AddFile(new GeneratedFakeFile("online", cpu_online));
+
+	/* _SC_NPROCESSORS_CONF counts these. */
+
+	int n = GetHostInfo().Processors;
+	for (int i = 0; i < n; i++)
+		cpu->AddDirectory(new FakeVFSNode(cpu, cprintf("cpu%d", i)));
+}
+
+SysVFSNode::~SysVFSNode()
+{
+}
@@ -0,0 +1,18 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef SYSVFSNODE_H
+#define SYSVFSNODE_H
+
+#include "FakeVFSNode.h"
+
+class SysVFSNode : public FakeVFSNode
+{
+public:
+	SysVFSNode(VFSNode* parent, const string& name);
+	~SysVFSNode();
+};
+
+#endif
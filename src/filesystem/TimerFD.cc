@@ -0,0 +1,177 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "filesystem/TimerFD.h"
+
+#define LINUX_CLOCK_REALTIME  0
+#define LINUX_CLOCK_MONOTONIC 1
+
+/* Always taken after the timer thread's lock, never before it. */
+static Mutex timerfdlock("timerfd");
+
+static int64_t timespec_to_us(const struct timespec& ts)
+{
+	if ((ts.tv_sec < 0) || (ts.tv_nsec < 0) || (ts.tv_nsec >= 1000000000))
+		throw EINVAL;
+
+	/* Round up, so that the timer never fires early. */
+	return (int64_t) ts.tv_sec * 1000000 + (ts.tv_nsec + 999) / 1000;
+}
+
+static void us_to_timespec(int64_t us, struct timespec& ts)
+{
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+}
+
+int TimerFD::Create(int clockid, int flags)
+{
+	if ((clockid != LINUX_CLOCK_REALTIME) && (clockid != LINUX_CLOCK_MONOTONIC))
+		throw EINVAL;
+
+	int fds[2];
+	MakePipe(fds, flags);
+	new TimerFD(fds);
+	return fds[0];
+}
+
+TimerFD::TimerFD(int fds[2]):
+	NotifyFD(fds),
+	_deadline(-1),
+	_interval(0),
+	_expirations(0)
+{
+	TimerThread::Add(this);
+}
+
+TimerFD::~TimerFD()
+{
+	TimerThread::Remove(this);
+}
+
+/* Something else (like an epoll set) may keep this object around after
+ * it's closed; it mustn't keep firing. */
+void TimerFD::Close()
+{
+	TimerThread::Remove(this);
+	NotifyFD::Close();
+}
+
+int TimerFD::Read(void* buffer, size_t size)
+{
+	if (size < sizeof(u64))
+		throw EINVAL;
+
+	for (;;)
+	{
+		u64 value;
+		{
+			RAIILock locked(timerfdlock);
+			value = _expirations;
+			_expirations = 0;
+			Clear();
+			if (value)
+				Touch();
+		}
+
+		if (value)
+		{
+			*(u64*) buffer = value;
+			return sizeof(u64);
+		}
+
+		if (IsNonBlocking())
+			throw EAGAIN;
+		WaitForNotify();
+	}
+}
+
+/* Call with timerfdlock held. */
+void TimerFD::get_time(linux_itimerspec& value, int64_t now)
+{
+	us_to_timespec(_interval, value.it_interval);
+
+	int64_t left = 0;
+	if (_deadline != -1)
+	{
+		left = _deadline - now;
+		if (left < 1)
+			left = 1;
+	}
+	us_to_timespec(left, value.it_value);
+}
+
+void TimerFD::SetTime(int flags, const linux_itimerspec& value,
+		linux_itimerspec* ovalue)
+{
+	if (flags & ~LINUX_TFD_TIMER_ABSTIME)
+		throw EINVAL;
+
+	int64_t interval = timespec_to_us(value.it_interval);
+	int64_t initial = timespec_to_us(value.it_value);
+
+	{
+		RAIILock locked(timerfdlock);
+		int64_t now = TimerThread::Now();
+
+		if (ovalue)
+			get_time(*ovalue, now);
+
+		/* Rearming discards any expiries that haven't been read yet. */
+
+		_expirations = 0;
+		Clear();
+
+		_interval = interval;
+		if (initial == 0)
+			_deadline = -1;
+		else if (flags & LINUX_TFD_TIMER_ABSTIME)
+			_deadline = initial;
+		else
+			_deadline = now + initial;
+	}
+
+	TimerThread::Changed();
+}
+
+void TimerFD::GetTime(linux_itimerspec& value)
+{
+	RAIILock locked(timerfdlock);
+	get_time(value, TimerThread::Now());
+}
+
+/* Called by the timer thread. */
+int64_t TimerFD::GetDeadline()
+{
+	RAIILock locked(timerfdlock);
+	return _deadline;
+}
+
+/* Called by the timer thread. If it's been held up, a periodic timer may
+ * have expired several times; they're all counted at once. */
+void TimerFD::Expire(int64_t now)
+{
+	RAIILock locked(timerfdlock);
+	if ((_deadline == -1) || (_deadline > now))
+		return;
+
+	if (_interval)
+	{
+		int64_t missed = (now - _deadline) / _interval;
+		_expirations += missed + 1;
+		_deadline += (missed + 1) * _interval;
+	}
+	else
+	{
+		_expirations++;
+		_deadline = -1;
+	}
+
+	/* Every expiry is a new edge, even if the pipe's already readable. */
+
+	Notify();
+	Touch();
+}
@@ -0,0 +1,52 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef TIMERFD_H
+#define TIMERFD_H
+
+#include "NotifyFD.h"
+#include "TimerThread.h"
+
+#define LINUX_TFD_TIMER_ABSTIME 1
+#define LINUX_TFD_CLOEXEC      LINUX_O_CLOEXEC
+#define LINUX_TFD_NONBLOCK     LINUX_O_NONBLOCK
+
+/* compat_timespec is compatible with Interix */
+struct linux_itimerspec
+{
+	struct timespec it_interval;
+	struct timespec it_value;
+};
+
+/* A timerfd. Expiries are counted by the shared TimerThread. */
+
+class TimerFD : public NotifyFD, private TimerThread::Client
+{
+public:
+	static int Create(int clockid, int flags);
+
+	TimerFD(int fds[2]);
+	~TimerFD();
+
+public:
+	void Close();
+	int Read(void* buffer, size_t size);
+
+	void SetTime(int flags, const linux_itimerspec& value,
+			linux_itimerspec* ovalue);
+	void GetTime(linux_itimerspec& value);
+
+private:
+	int64_t GetDeadline();
+	void Expire(int64_t now);
+
+	void get_time(linux_itimerspec& value, int64_t now);
+
+	int64_t _deadline;          // -1 if disarmed
+	int64_t _interval;          // 0 for one-shot
+	u64 _expirations;
+};
+
+#endif
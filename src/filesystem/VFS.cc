@@ -13,23 +13,28 @@
 static Ref<RootVFSNode> root;
 static Ref<VFSNode> cwd;
 
+/* Protects root and cwd themselves; resolution happens without it. */
+static Mutex nodelock("VFS root and cwd");
+
 void VFS::SetRoot(const string& path)
 {
 #if defined VERBOSE
 	log("SetRoot(%s)", path.c_str());
 #endif
-	root = new RootVFSNode(path);
+	Ref<RootVFSNode> newroot = new RootVFSNode(path);
+
+	RAIILock locked(nodelock);
+	root = newroot;
 }
 
 Ref<VFSNode> VFS::GetRootNode()
 {
+	RAIILock locked(nodelock);
 	return (VFSNode*) root;
 }
 
 void VFS::SetCWD(VFSNode* cwd, const string& path)
 {
-	RAIILock locked;
-
 #if defined VERBOSE
 	log("SetCWD(%p, %s)", cwd, path.c_str());
 #endif
@@ -37,15 +42,15 @@ void VFS::SetCWD(VFSNode* cwd, const string& path)
 	Ref<VFSNode> node;
 	string leaf;
 	Resolve(cwd, path, node, leaf);
+	node = node->Traverse(leaf);
 
-	::cwd = node->Traverse(leaf);
+	RAIILock locked(nodelock);
+	::cwd = node;
 }
 
 string VFS::GetCWD()
 {
-	RAIILock locked;
-
-	string s = cwd->GetPath();
+	string s = GetCWDNode()->GetPath();
 	if (s.empty())
 		return "/";
 	return s;
@@ -53,14 +58,13 @@ string VFS::GetCWD()
 
 Ref<VFSNode> VFS::GetCWDNode()
 {
+	RAIILock locked(nodelock);
 	return (VFSNode*) cwd;
 }
 
 void VFS::Resolve(VFSNode* cwd, const string& path, Ref<VFSNode>& node,
 		string& leaf, bool followlink)
 {
-	RAIILock locked;
-
 #if defined VERBOSE
 	//log("Resolve(%s)", path.c_str());
 #endif
@@ -68,20 +72,20 @@ void VFS::Resolve(VFSNode* cwd, const string& path, Ref<VFSNode>& node,
 	string p = path;
 	if (p == "/")
 	{
-		node = root;
 		if (!cwd)
-			node = root;
+			node = GetRootNode();
 		else
 			node = cwd;
 		leaf = ".";
 	}
 	else if (!p.empty() && (p[0] == '/'))
-		root->Resolve(p.substr(1), node, leaf, followlink);
+		GetRootNode()->Resolve(p.substr(1), node, leaf, followlink);
 	else
 	{
+		Ref<VFSNode> cwdref = cwd;
 		if (!cwd)
-			cwd = ::cwd;
-		cwd->Resolve(p, node, leaf, followlink);
+			cwdref = GetCWDNode();
+		cwdref->Resolve(p, node, leaf, followlink);
 	}
 }
 
@@ -110,7 +114,9 @@ Ref<FD> VFS::OpenFile(VFSNode* cwd, const string& path, int flags, int mode,
 	string leaf;
 	Resolve(cwd, path, node, leaf, !nofollow);
 
-	return node->OpenFile(leaf, flags, mode);
+	Ref<FD> fd = node->OpenFile(leaf, flags, mode);
+	fd->SetPath(node->GetPath() + "/" + leaf);
+	return fd;
 }
 
 void VFS::Stat(VFSNode* cwd, const string& path, struct stat& st)
@@ -48,21 +48,10 @@ int VFSNode::GetFileType(const string& name)
 		struct stat st;
 		StatFile(name, st);
 
-		if (S_ISREG(st.st_mode))
-			return FILE;
-		if (S_ISDIR(st.st_mode))
-			return DIRECTORY;
-		if (S_ISLNK(st.st_mode))
-			return LINK;
-		if (S_ISCHR(st.st_mode))
-			return CHAR;
-		if (S_ISBLK(st.st_mode))
-			return BLOCK;
-		if (S_ISSOCK(st.st_mode))
-			return SOCKET;
-		if (S_ISFIFO(st.st_mode))
-			return FIFO;
-		error("strange file type!");
+		int type = GetFileType(st);
+		if (type == UNKNOWN)
+			error("strange file type!");
+		return type;
 	}
 	catch (int e)
 	{
@@ -72,6 +61,25 @@ int VFSNode::GetFileType(const string& name)
 	}
 }
 
+int VFSNode::GetFileType(const struct stat& st)
+{
+	if (S_ISREG(st.st_mode))
+		return FILE;
+	if (S_ISDIR(st.st_mode))
+		return DIRECTORY;
+	if (S_ISLNK(st.st_mode))
+		return LINK;
+	if (S_ISCHR(st.st_mode))
+		return CHAR;
+	if (S_ISBLK(st.st_mode))
+		return BLOCK;
+	if (S_ISSOCK(st.st_mode))
+		return SOCKET;
+	if (S_ISFIFO(st.st_mode))
+		return FIFO;
+	return UNKNOWN;
+}
+
 void VFSNode::Resolve(const string& path, Ref<VFSNode>& node, string& leaf,
 		bool followlink)
 {
@@ -121,7 +129,7 @@ void VFSNode::Resolve(const string& path, Ref<VFSNode>& node, string& leaf,
 				VFS::Resolve(NULL, target, linktarget, element, true);
 			else
 				node->Resolve(target, linktarget, element, true);
-			node = linktarget;
+			node.Swap(linktarget);
 		}
 
 		if (right == string::npos)
@@ -185,3 +193,44 @@ Ref<FD> VFSNode::OpenFile(const string& name, int flags, int mode)
 {
 	throw ENOENT;
 }
+
+/* A DirStream over a list that's already been fetched; cookies are just
+ * indices. */
+class ListDirStream : public DirStream
+{
+public:
+	ListDirStream(const deque<DirEntry>& contents):
+		_contents(contents),
+		_pos(0)
+	{
+	}
+
+	bool Read(DirEntry& entry)
+	{
+		if (_pos >= _contents.size())
+			return false;
+		entry = _contents[_pos++];
+		return true;
+	}
+
+	int64_t Tell()
+	{
+		return _pos;
+	}
+
+	void Seek(int64_t cookie)
+	{
+		if ((cookie < 0) || (cookie > (int64_t) _contents.size()))
+			throw EINVAL;
+		_pos = cookie;
+	}
+
+private:
+	deque<DirEntry> _contents;
+	size_t _pos;
+};
+
+DirStream* VFSNode::OpenDirStream()
+{
+	return new ListDirStream(Enumerate());
+}
@@ -11,6 +11,36 @@ using std::deque;
 
 #include "FD.h"
 
+/* One entry returned by Enumerate() or a DirStream. */
+struct DirEntry
+{
+	string name;
+	u64 ino;
+	int type;                   // VFSNode::FILE etc.
+};
+
+/* An open directory, read one entry at a time. Tell() returns an opaque
+ * cookie for the position of the next entry, which can be handed back to
+ * Seek(); 0 is always the beginning. These are what the guest sees as d_off.
+ */
+class DirStream
+{
+public:
+	DirStream(): _lock("directory stream") {}
+	virtual ~DirStream() {}
+
+	/* Held by anything reading or moving the stream. */
+	Mutex& GetLock() { return _lock; }
+
+	/* Returns false at the end of the directory. */
+	virtual bool Read(DirEntry& entry) = 0;
+	virtual int64_t Tell() = 0;
+	virtual void Seek(int64_t cookie) = 0;
+
+private:
+	Mutex _lock;
+};
+
 class VFSNode : public HasRefCount
 {
 public:
@@ -27,7 +57,8 @@ public:
 		BLOCK,
 		CHAR,
 		FIFO,
-		SOCKET
+		SOCKET,
+		UNKNOWN
 	};
 
 public:
@@ -36,6 +67,7 @@ public:
 	string GetPath();
 
 	int GetFileType(const string& name);
+	static int GetFileType(const struct stat& st);
 	virtual void StatFile(const string& name, struct stat& st);
 	virtual void StatFS(struct statvfs& st);
 
@@ -44,7 +76,11 @@ public:
 	virtual Ref<FD> OpenFile(const string& name, int flags = O_RDONLY,
 			int mode = 0);
 	virtual string ReadLink(const string& name) { throw EINVAL; }
-	virtual deque<string> Enumerate() { throw EINVAL; }
+	virtual deque<DirEntry> Enumerate() { throw EINVAL; }
+
+	/* The default reads everything with Enumerate(); override this if the
+	 * directory might be big. */
+	virtual DirStream* OpenDirStream();
 	virtual void MkDir(const string& name, int mode = 0) { throw EINVAL; }
 	virtual void RmDir(const string& name) { throw EINVAL; }
 	virtual void Mknod(const string& name, mode_t mode, dev_t dev) { throw EINVAL; }
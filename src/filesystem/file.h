@@ -47,6 +47,24 @@ extern u_int32_t FileFlagsL2I(u_int32_t flags);
 
 #define LINUX_FD_CLOEXEC      1       /* actually anything with low bit set goes */
 
+#define LINUX_POLLIN          0x001           /* There is data to read.  */
+#define LINUX_POLLPRI         0x002           /* There is urgent data to read.  */
+#define LINUX_POLLOUT         0x004           /* Writing now will not block.  */
+#define LINUX_POLLRDNORM      0x040           /* Normal data may be read.  */
+#define LINUX_POLLRDBAND      0x080           /* Priority data may be read.  */
+#define LINUX_POLLWRNORM      0x100           /* Writing now will not block.  */
+#define LINUX_POLLWRBAND      0x200           /* Priority data may be written.  */
+#define LINUX_POLLMSG         0x400
+#define LINUX_POLLREMOVE      0x1000
+#define LINUX_POLLRDHUP       0x2000
+#define LINUX_POLLERR         0x008           /* Error condition.  */
+#define LINUX_POLLHUP         0x010           /* Hung up.  */
+#define LINUX_POLLNVAL        0x020           /* Invalid polling request.  */
+
+/* Things that are always ready for I/O. */
+#define LINUX_POLL_ALWAYS     (LINUX_POLLIN | LINUX_POLLOUT | \
+                               LINUX_POLLRDNORM | LINUX_POLLWRNORM)
+
 #pragma pack(push, 1)
 struct linux_compat_stat
 {
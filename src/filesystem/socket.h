@@ -63,8 +63,11 @@
 #define LINUX_MSG_ERRQUEUE        0x2000 /* Fetch message from error queue.  */
 #define LINUX_MSG_NOSIGNAL        0x4000 /* Do not generate SIGPIPE.  */
 #define LINUX_MSG_MORE            0x8000  /* Sender will send more.  */
+#define LINUX_MSG_WAITFORONE      0x10000 /* recvmmsg(): block until 1+ packets avail */
 #define LINUX_MSG_CMSG_CLOEXEC    0x40000000
 
+#define LINUX_SCM_RIGHTS          0x01
+
 #pragma pack(push, 1)
 struct linux_msghdr
 {
@@ -76,6 +79,20 @@ struct linux_msghdr
 	u32 msg_controllen;	    /* Length of cmsg list */
 	u32 msg_flags;
 };
+
+struct linux_mmsghdr
+{
+	struct linux_msghdr msg_hdr;
+	u32 msg_len;
+};
+
+/* Each entry is padded to a multiple of 4 bytes. */
+struct linux_cmsghdr
+{
+	u32 cmsg_len;           /* Including this header */
+	s32 cmsg_level;
+	s32 cmsg_type;
+};
 #pragma pack(pop)
 
 #endif
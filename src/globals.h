@@ -17,15 +17,6 @@
 #include <limits.h>
 #include <string>
 
-#include "linux_errno.h"
-#include "Ref.h"
-
-using std::string;
-
-class FD;
-
-#define PACKED  __attribute__((packed)) __attribute__((aligned(1)))
-
 typedef u_int16_t __u16;
 typedef int16_t __s16;
 typedef u_int32_t __u32;
@@ -42,13 +33,26 @@ typedef int32_t s32;
 typedef u_int64_t u64;
 typedef int64_t s64;
 
+#include "linux_errno.h"
+#include "Ref.h"
+#include "Lock.h"
+
+using std::string;
+
+class FD;
+
+#define PACKED  __attribute__((packed)) __attribute__((aligned(1)))
+
 struct Options_s
 {
 	string LBW;              // path of LBW executable
+	string Executable;       // absolute guest path of the Linux executable
 	string Chroot;           // current chroot, or empty
 	bool FakeRoot : 1;       // is fakeroot enabled?
 	bool Warnings : 1;       // are we showing warnings?
 	bool ForceLoad : 1;      // force all data to be read into RAM, not mapped
+	bool MemStats : 1;       // report guest memory usage at exit
+	bool LockStats : 1;      // report internal lock contention at exit
 };
 
 extern Options_s Options;
@@ -90,22 +94,14 @@ extern int CheckError(int i);
 
 extern void InitProcess();
 extern void InstallExceptionHandler();
-extern void Lock();
-extern void Unlock();
 extern void RunElf(const string& pathname, const char* argv[], const char* environ[]);
 
-class RAIILock
-{
-public:
-	RAIILock() { Lock(); }
-	~RAIILock() { Unlock(); }
-};
-
 /* GS handling */
 
 extern void InitGSStore();
 extern void SetGS(u_int16_t gs, void* linear);
 extern u32 GetGS();
+extern void* GetGSLinear();
 
 /* Machine code entry points */
 
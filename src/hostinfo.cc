@@ -0,0 +1,206 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "hostinfo.h"
+
+/* Native API entry points. As with the exception handler, these are
+ * stdcall and live in ntdll. */
+
+#define SystemBasicInformation 0
+#define SystemPerformanceInformation 2
+#define SystemTimeOfDayInformation 3
+#define SystemProcessorPerformanceInformation 8
+#define ThreadBasePriority 3
+#define ThreadAffinityMask 4
+
+#define NtCurrentThread ((void*) -2)
+
+struct SYSTEM_BASIC_INFORMATION
+{
+	u32 Reserved;
+	u32 TimerResolution;
+	u32 PageSize;
+	u32 NumberOfPhysicalPages;
+	u32 LowestPhysicalPageNumber;
+	u32 HighestPhysicalPageNumber;
+	u32 AllocationGranularity;
+	u32 MinimumUserModeAddress;
+	u32 MaximumUserModeAddress;
+	u32 ActiveProcessorsAffinityMask;
+	s8 NumberOfProcessors;
+};
+
+/* This is much bigger, and grows with every Windows release, but we only
+ * want the one field. */
+struct SYSTEM_PERFORMANCE_INFORMATION
+{
+	u64 IdleTime;
+	u64 ReadTransferCount;
+	u64 WriteTransferCount;
+	u64 OtherTransferCount;
+	u32 ReadOperationCount;
+	u32 WriteOperationCount;
+	u32 OtherOperationCount;
+	u32 AvailablePages;
+	u8 Rest[1024];
+};
+
+struct SYSTEM_TIMEOFDAY_INFORMATION
+{
+	u64 BootTime;
+	u64 CurrentTime;
+	u64 TimeZoneBias;
+	u32 TimeZoneId;
+	u32 Reserved;
+	u64 BootTimeBias;
+	u64 SleepTimeBias;
+};
+
+struct SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION
+{
+	u64 IdleTime;
+	u64 KernelTime;         // includes IdleTime
+	u64 UserTime;
+	u64 DpcTime;
+	u64 InterruptTime;
+	u32 InterruptCount;
+	u32 Reserved;
+};
+
+/* Seconds between the NT epoch (1601) and the Unix one. */
+#define NT_EPOCH_OFFSET 11644473600ULL
+
+extern "C" s32 __stdcall NtQuerySystemInformation(u32 infoclass,
+		void* buffer, u32 length, u32* returnlength);
+asm ("_NtQuerySystemInformation: jmp _NtQuerySystemInformation@16");
+
+extern "C" s32 __stdcall NtSetInformationThread(void* thread,
+		u32 infoclass, void* buffer, u32 length);
+asm ("_NtSetInformationThread: jmp _NtSetInformationThread@16");
+
+extern "C" s32 __stdcall NtYieldExecution();
+asm ("_NtYieldExecution: jmp _NtYieldExecution@0");
+
+/* The answers don't change, so they only need fetching once. Racing
+ * threads will just fetch the same thing twice. */
+const HostInfo& GetHostInfo()
+{
+	static HostInfo hi;
+	static volatile bool valid = false;
+
+	if (!valid)
+	{
+		SYSTEM_BASIC_INFORMATION sbi;
+		memset(&sbi, 0, sizeof(sbi));
+		s32 status = NtQuerySystemInformation(SystemBasicInformation,
+				&sbi, sizeof(sbi), NULL);
+
+		if ((status < 0) || (sbi.NumberOfProcessors < 1))
+		{
+			Warning("unable to query host system information: %08x", status);
+			hi.PageSize = 4096;
+			hi.PhysicalPages = 0;
+			hi.ProcessorMask = 1;
+			hi.Processors = 1;
+		}
+		else
+		{
+			hi.PageSize = sbi.PageSize;
+			hi.PhysicalPages = sbi.NumberOfPhysicalPages;
+			hi.ProcessorMask = sbi.ActiveProcessorsAffinityMask;
+			hi.Processors = sbi.NumberOfProcessors;
+		}
+		valid = true;
+	}
+	return hi;
+}
+
+u32 GetHostFreePages()
+{
+	SYSTEM_PERFORMANCE_INFORMATION spi;
+	s32 status = NtQuerySystemInformation(SystemPerformanceInformation,
+			&spi, sizeof(spi), NULL);
+	if (status < 0)
+		return 0;
+	return spi.AvailablePages;
+}
+
+void GetHostCPUTimes(vector<HostCPUTimes>& times)
+{
+	int n = GetHostInfo().Processors;
+	vector<SYSTEM_PROCESSOR_PERFORMANCE_INFORMATION> sppi(n);
+
+	s32 status = NtQuerySystemInformation(SystemProcessorPerformanceInformation,
+			&sppi[0], n * sizeof(sppi[0]), NULL);
+
+	times.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		HostCPUTimes& t = times[i];
+		if (status < 0)
+		{
+			t.User = t.System = t.Idle = 0;
+			continue;
+		}
+
+		t.User = sppi[i].UserTime;
+		t.Idle = sppi[i].IdleTime;
+		t.System = sppi[i].KernelTime - sppi[i].IdleTime;
+	}
+}
+
+time_t GetHostBootTime()
+{
+	SYSTEM_TIMEOFDAY_INFORMATION sti;
+	memset(&sti, 0, sizeof(sti));
+	s32 status = NtQuerySystemInformation(SystemTimeOfDayInformation,
+			&sti, sizeof(sti), NULL);
+	if ((status < 0) || !sti.BootTime)
+		return 0;
+	return (time_t) (sti.BootTime / 10000000ULL - NT_EPOCH_OFFSET);
+}
+
+void HostCPUID(u32 leaf, u32& eax, u32& ebx, u32& ecx, u32& edx)
+{
+	eax = leaf;
+	asm volatile ("cpuid"
+			: "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+}
+
+void HostYield()
+{
+	NtYieldExecution();
+}
+
+/* Binds the calling thread to the given processors. */
+int HostSetThreadAffinity(u32 mask)
+{
+	s32 status = NtSetInformationThread(NtCurrentThread, ThreadAffinityMask,
+			&mask, sizeof(mask));
+	return (status < 0) ? EINVAL : 0;
+}
+
+/* increment is relative to the process' base priority, -2..2. */
+int HostSetThreadPriority(int increment)
+{
+	s32 priority = increment;
+	s32 status = NtSetInformationThread(NtCurrentThread, ThreadBasePriority,
+			&priority, sizeof(priority));
+	return (status < 0) ? EPERM : 0;
+}
+
+/* NT doesn't have a way of finding the current processor until well after
+ * XP, so use the APIC id. This is only a hint anyway. */
+int HostGetCPU()
+{
+	const HostInfo& hi = GetHostInfo();
+	if (hi.Processors == 1)
+		return 0;
+
+	u32 eax, ebx, ecx, edx;
+	HostCPUID(1, eax, ebx, ecx, edx);
+	return (ebx >> 24) % hi.Processors;
+}
@@ -0,0 +1,44 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef HOSTINFO_H
+#define HOSTINFO_H
+
+#include <vector>
+
+using std::vector;
+
+/* Things about the host machine which Interix won't tell us, so we have to
+ * ask NT directly. */
+
+struct HostInfo
+{
+	u32 PageSize;
+	u32 PhysicalPages;
+	u32 ProcessorMask;       // active processors
+	int Processors;
+};
+
+/* In 100ns units, as NT does it. */
+
+struct HostCPUTimes
+{
+	u64 User;
+	u64 System;
+	u64 Idle;
+};
+
+extern const HostInfo& GetHostInfo();
+extern u32 GetHostFreePages();
+extern void GetHostCPUTimes(vector<HostCPUTimes>& times);
+extern time_t GetHostBootTime();
+extern void HostCPUID(u32 leaf, u32& eax, u32& ebx, u32& ecx, u32& edx);
+
+extern void HostYield();
+extern int HostSetThreadAffinity(u32 mask);
+extern int HostSetThreadPriority(int increment);
+extern int HostGetCPU();
+
+#endif
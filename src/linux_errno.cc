@@ -11,24 +11,43 @@ int ErrnoI2L(int e)
 
 	switch (e)
 	{
+		case EACCES:          return LINUX_EACCES;
+		case EADDRINUSE:      return LINUX_EADDRINUSE;
+		case EADDRNOTAVAIL:   return LINUX_EADDRNOTAVAIL;
+		case EAFNOSUPPORT:    return LINUX_EAFNOSUPPORT;
 		case EAGAIN:          return LINUX_EAGAIN;
+		case EALREADY:        return LINUX_EALREADY;
 		case EBADF:           return LINUX_EBADF;
 		case ECHILD:          return LINUX_ECHILD;
+		case ECONNABORTED:    return LINUX_ECONNABORTED;
+		case ECONNREFUSED:    return LINUX_ECONNREFUSED;
+		case ECONNRESET:      return LINUX_ECONNRESET;
+		case EDESTADDRREQ:    return LINUX_EDESTADDRREQ;
 		case EEXIST:          return LINUX_EEXIST;
 		case EFAULT:          return LINUX_EFAULT;
+		case EFBIG:           return LINUX_EFBIG;
+		case EHOSTUNREACH:    return LINUX_EHOSTUNREACH;
 		case EINPROGRESS:     return LINUX_EINPROGRESS;
 		case EINTR:           return LINUX_EINTR;
 		case EINVAL:          return LINUX_EINVAL;
 		case EIO:             return LINUX_EIO;
 		case EISCONN:         return LINUX_EISCONN;
 		case EISDIR:          return LINUX_EISDIR;
+		case EMFILE:          return LINUX_EMFILE;
+		case EMSGSIZE:        return LINUX_EMSGSIZE;
+		case ENAMETOOLONG:    return LINUX_ENAMETOOLONG;
+		case ENETUNREACH:     return LINUX_ENETUNREACH;
+		case ENFILE:          return LINUX_ENFILE;
+		case ENOBUFS:         return LINUX_ENOBUFS;
 		case ENOENT:          return LINUX_ENOENT;
 		case ENOEXEC:         return LINUX_ENOEXEC;
 		case ENOMEM:          return LINUX_ENOMEM;
 		case ENOPROTOOPT:     return LINUX_ENOPROTOOPT;
 		case ENOSYS:          return LINUX_ENOSYS;
+		case ENOTCONN:        return LINUX_ENOTCONN;
 		case ENOTDIR:         return LINUX_ENOTDIR;
 		case ENOTEMPTY:       return LINUX_ENOTEMPTY;
+		case ENOTSOCK:        return LINUX_ENOTSOCK;
 		case ENOTTY:          return LINUX_ENOTTY;
 		case ENXIO:           return LINUX_ENXIO;
 		case EOPNOTSUPP:      return LINUX_EOPNOTSUPP;
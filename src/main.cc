@@ -6,6 +6,7 @@
 #include "globals.h"
 #include "Thread.h"
 #include "filesystem/VFS.h"
+#include "syscalls/mmap.h"
 #include <stdarg.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -77,7 +78,10 @@ public:
 	ArgumentParser():
 		Chroot("/"),
 		FakeRoot(false),
-		Warnings(false)
+		Warnings(false),
+		ForceLoad(false),
+		MemStats(false),
+		LockStats(false)
 	{
 		char buffer[PATH_MAX];
 		getcwd(buffer, sizeof(buffer));
@@ -127,6 +131,8 @@ public:
 				"  --warnings       Show warnings for emulation problems\n"
 				"  --chroot <path>  Set up a fake chroot for path\n"
 				"  --forceload      Don't mmap() code, load it instead\n"
+				"  --memstats       Report guest memory usage on exit\n"
+				"  --lockstats      Report internal lock contention on exit\n"
 				"\n"
 				"In order to run dynamic binaries, you must set up a chroot.\n"
 				"\n"
@@ -159,6 +165,16 @@ public:
 			ForceLoad = true;
 			return 1;
 		}
+		else if (option == "--memstats")
+		{
+			MemStats = true;
+			return 1;
+		}
+		else if (option == "--lockstats")
+		{
+			LockStats = true;
+			return 1;
+		}
 		else
 			BadOption();
 		return 1;
@@ -171,6 +187,8 @@ public:
 	bool FakeRoot : 1;
 	bool Warnings : 1;
 	bool ForceLoad : 1;
+	bool MemStats : 1;
+	bool LockStats : 1;
 };
 
 int main(int argc, const char* argv[], const char* environ[])
@@ -209,6 +227,12 @@ int main(int argc, const char* argv[], const char* environ[])
 		Options.Warnings = !!getenv("LBW_FORCELOAD");
 		unsetenv("LBW_FORCELOAD");
 
+		Options.MemStats = !!getenv("LBW_MEMSTATS");
+		unsetenv("LBW_MEMSTATS");
+
+		Options.LockStats = !!getenv("LBW_LOCKSTATS");
+		unsetenv("LBW_LOCKSTATS");
+
 		const char* s = getenv("LBW_CHROOT");
 		if (s)
 		{
@@ -269,6 +293,8 @@ int main(int argc, const char* argv[], const char* environ[])
 		Options.FakeRoot = ap.FakeRoot;
 		Options.Warnings = ap.Warnings;
 		Options.ForceLoad = ap.ForceLoad;
+		Options.MemStats = ap.MemStats;
+		Options.LockStats = ap.LockStats;
 		VFS::SetRoot(Options.Chroot);
 		VFS::SetCWD(NULL, ap.CWD);
 
@@ -280,6 +306,11 @@ int main(int argc, const char* argv[], const char* environ[])
 
 	InstallExceptionHandler();
 
+	if (Options.MemStats)
+		atexit(ReportMemoryStats);
+	if (Options.LockStats)
+		atexit(BaseLock::ReportAll);
+
 	//log("running elf file <%s>", linuxfile.c_str());
 	RunElf(linuxfile, argv, environ);
 	return 0;
@@ -133,8 +133,8 @@ int32_t Linux_MCE_Handler(Registers& regs)
 		CALL_SYSCALL(108, compat_sys_newfstat);
 		CALL_SYSCALL(114, compat_sys_wait4);
 		CALL_SYSCALL(116, compat_sys_sysinfo);
+		CALL_SYSCALL(117, sys32_ipc);
 		CALL_SYSCALL(118, sys_fsync);
-		CALL_SYSCALL(120, sys32_clone);
 		CALL_SYSCALL(122, sys_uname);
 		CALL_SYSCALL(125, sys32_mprotect);
 		CALL_SYSCALL(133, sys_fchdir);
@@ -144,22 +144,27 @@ int32_t Linux_MCE_Handler(Registers& regs)
 		CALL_SYSCALL(142, compat_sys_select);
 		CALL_SYSCALL(143, sys_flock);
 		CALL_SYSCALL(144, sys_msync);
+		CALL_SYSCALL(145, compat_sys_readv);
 		CALL_SYSCALL(146, compat_sys_writev);
 		CALL_SYSCALL(150, sys_mlock);
-		CALL_SYSCALL(154, enosys); // sys_sched_setparam
-		CALL_SYSCALL(155, enosys); // sys_sched_getparam
-		CALL_SYSCALL(156, enosys); // sys_sched_setscheduler
-		CALL_SYSCALL(157, enosys); // sys_sched_getscheduler
-		CALL_SYSCALL(158, enosys); // sys_sched_yield
-		CALL_SYSCALL(159, enosys); // sys_sched_get_priority_max
-		CALL_SYSCALL(160, enosys); // sys_sched_get_priority_min
+		CALL_SYSCALL(154, sys_sched_setparam);
+		CALL_SYSCALL(155, sys_sched_getparam);
+		CALL_SYSCALL(156, sys_sched_setscheduler);
+		CALL_SYSCALL(157, sys_sched_getscheduler);
+		CALL_SYSCALL(158, sys_sched_yield);
+		CALL_SYSCALL(159, sys_sched_get_priority_max);
+		CALL_SYSCALL(160, sys_sched_get_priority_min);
+		CALL_SYSCALL(161, sys32_sched_rr_get_interval);
 		CALL_SYSCALL(162, compat_sys_nanosleep);
 		CALL_SYSCALL(163, sys_mremap);
 		CALL_SYSCALL(168, sys_poll);
 		CALL_SYSCALL(174, sys32_rt_sigaction);
 		CALL_SYSCALL(175, sys32_rt_sigprocmask);
+		CALL_SYSCALL(180, sys32_pread);
+		CALL_SYSCALL(181, sys32_pwrite);
 		CALL_SYSCALL(183, sys_get_cwd);
 		CALL_SYSCALL(186, stub32_sigaltstack);
+		CALL_SYSCALL(187, sys32_sendfile);
 		CALL_SYSCALL(190, stub32_vfork);
 		CALL_SYSCALL(191, compat_sys_getrlimit);
 		CALL_SYSCALL(192, sys32_mmap2);
@@ -191,8 +196,14 @@ int32_t Linux_MCE_Handler(Registers& regs)
 		CALL_SYSCALL(229, sys_getxattr);
 		CALL_SYSCALL(230, sys_lgetxattr);
 		CALL_SYSCALL(231, sys_fgetxattr);
+		CALL_SYSCALL(239, sys_sendfile64);
 		CALL_SYSCALL(240, compat_sys_futex);
+		CALL_SYSCALL(241, compat_sys_sched_setaffinity);
+		CALL_SYSCALL(242, compat_sys_sched_getaffinity);
 		CALL_SYSCALL(252, sys_exit_group);
+		CALL_SYSCALL(254, sys_epoll_create);
+		CALL_SYSCALL(255, sys_epoll_ctl);
+		CALL_SYSCALL(256, sys_epoll_wait);
 		CALL_SYSCALL(258, sys_set_tid_address);
 		CALL_SYSCALL(265, compat_sys_clock_gettime);
 		CALL_SYSCALL(266, compat_sys_clock_getres);
@@ -206,8 +217,46 @@ int32_t Linux_MCE_Handler(Registers& regs)
 		CALL_SYSCALL(301, sys_unlinkat);
 		CALL_SYSCALL(306, sys_fchmodat);
 		CALL_SYSCALL(308, compat_sys_pselect6);
+		CALL_SYSCALL(309, compat_sys_ppoll);
 		CALL_SYSCALL(311, compat_sys_set_robust_list);
+		CALL_SYSCALL(312, compat_sys_get_robust_list);
+		CALL_SYSCALL(313, sys_splice);
+		CALL_SYSCALL(315, sys_tee);
+		CALL_SYSCALL(316, compat_sys_vmsplice);
+		CALL_SYSCALL(318, sys_getcpu);
+		CALL_SYSCALL(319, sys_epoll_pwait);
 		CALL_SYSCALL(320, compat_sys_utimensat);
+		CALL_SYSCALL(321, compat_sys_signalfd);
+		CALL_SYSCALL(322, sys_timerfd_create);
+		CALL_SYSCALL(323, sys_eventfd);
+		CALL_SYSCALL(325, compat_sys_timerfd_settime);
+		CALL_SYSCALL(326, compat_sys_timerfd_gettime);
+		CALL_SYSCALL(327, compat_sys_signalfd4);
+		CALL_SYSCALL(328, sys_eventfd2);
+		CALL_SYSCALL(329, sys_epoll_create1);
+		CALL_SYSCALL(333, compat_sys_preadv);
+		CALL_SYSCALL(334, compat_sys_pwritev);
+		CALL_SYSCALL(337, compat_sys_recvmmsg);
+		CALL_SYSCALL(345, compat_sys_sendmmsg);
+		CALL_SYSCALL(359, sys_socket);
+		CALL_SYSCALL(360, sys_socketpair);
+		CALL_SYSCALL(361, sys_bind);
+		CALL_SYSCALL(362, sys_connect);
+		CALL_SYSCALL(363, sys_listen);
+		CALL_SYSCALL(364, sys_accept4);
+		CALL_SYSCALL(365, compat_sys_getsockopt);
+		CALL_SYSCALL(366, compat_sys_setsockopt);
+		CALL_SYSCALL(367, sys_getsockname);
+		CALL_SYSCALL(368, sys_getpeername);
+		CALL_SYSCALL(369, sys_sendto);
+		CALL_SYSCALL(370, compat_sys_sendmsg);
+		CALL_SYSCALL(371, compat_sys_recvfrom);
+		CALL_SYSCALL(372, compat_sys_recvmsg);
+		CALL_SYSCALL(373, sys_shutdown);
+
+		case 120: /* special handling for sys32_clone */
+			extern int32_t sys32_clone(Registers& regs);
+			return sys32_clone(regs);
 
 		case 243: /* special handling for sys_set_thread_area */
 			extern int32_t sys_set_thread_area(Registers& regs);
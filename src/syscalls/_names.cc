@@ -344,5 +344,42 @@ const char* const SyscallNames[NUM_SYSCALLS] =
 	"compat_sys_preadv",
 	"compat_sys_pwritev",
 	"compat_sys_rt_tgsigqueueinfo", 	/* 335 */
-	"sys_perf_event_open"
+	"sys_perf_event_open",
+	"compat_sys_recvmmsg",
+	"sys_fanotify_init",
+	"sys32_fanotify_mark",
+	"sys_prlimit64", 			/* 340 */
+	"sys_name_to_handle_at",
+	"compat_sys_open_by_handle_at",
+	"compat_sys_clock_adjtime",
+	"sys_syncfs",
+	"compat_sys_sendmmsg", 		/* 345 */
+	"sys_setns",
+	"compat_sys_process_vm_readv",
+	"compat_sys_process_vm_writev",
+	"sys_kcmp",
+	"sys_finit_module", 		/* 350 */
+	"sys_sched_setattr",
+	"sys_sched_getattr",
+	"sys_renameat2",
+	"sys_seccomp",
+	"sys_getrandom", 			/* 355 */
+	"sys_memfd_create",
+	"sys_bpf",
+	"compat_sys_execveat",
+	"sys_socket",
+	"sys_socketpair", 			/* 360 */
+	"sys_bind",
+	"sys_connect",
+	"sys_listen",
+	"sys_accept4",
+	"compat_sys_getsockopt", 	/* 365 */
+	"compat_sys_setsockopt",
+	"sys_getsockname",
+	"sys_getpeername",
+	"sys_sendto",
+	"compat_sys_sendmsg", 		/* 370 */
+	"compat_sys_recvfrom",
+	"compat_sys_recvmsg",
+	"sys_shutdown"
 };
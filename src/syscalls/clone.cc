@@ -5,7 +5,11 @@
 
 #include "globals.h"
 #include "syscalls.h"
+#include "syscalls/mmap.h"
+#include "syscalls/thread.h"
+#include "Thread.h"
 #include <unistd.h>
+#include <semaphore.h>
 
 #define LINUX_CSIGNAL                 0x000000ff      /* signal mask to be sent at exit */
 #define LINUX_CLONE_VM                0x00000100      /* set if VM shared between processes */
@@ -46,6 +50,7 @@ SYSCALL(stub32_fork)
 		case 0: /* child */
 			InitProcess();
 			InstallExceptionHandler();
+			RemapSharedAfterFork();
 			//error("fork() needs work");
 			//StartMonitor();
 			break;
@@ -66,6 +71,7 @@ SYSCALL(stub32_vfork)
 		case 0: /* child */
 			InitProcess();
 			InstallExceptionHandler();
+			RemapSharedAfterFork();
 			//error("fork() needs work");
 			//StartMonitor();
 			break;
@@ -77,48 +83,207 @@ SYSCALL(stub32_vfork)
 	return result;
 }
 
-SYSCALL(sys32_clone)
+/* The new thread has to appear to return from the clone() syscall, on the
+ * stack it was given, with all the registers the parent had except for
+ * %eax. */
+static void enter_guest_thread(const Registers& regs, u32 sp)
+{
+	u32* stack = (u32*) sp;
+	*--stack = regs.eip;
+	*--stack = regs.flags;
+
+	u32 frame[] =
+	{
+		regs.ebx.u, regs.ecx.u, regs.edx.u, regs.esi.u, regs.edi.u,
+		regs.ebp.u, (u32) stack
+	};
+
+	asm volatile (
+		"mov 0(%0), %%ebx; "
+		"mov 4(%0), %%ecx; "
+		"mov 8(%0), %%edx; "
+		"mov 12(%0), %%esi; "
+		"mov 16(%0), %%edi; "
+		"mov 20(%0), %%ebp; "
+		"mov 24(%0), %%esp; "
+		"xor %%eax, %%eax; "
+		"popf; "
+		"ret"
+		:
+		: "a" (frame)
+		);
+	error("guest thread returned from clone()");
+}
+
+struct ThreadStartup
+{
+	Registers regs;
+	u32 flags;
+	u32 newsp;
+	u16 gs;
+	void* linear;
+	pid_t* parent_tid;
+	pid_t* child_tid;
+	pid_t tid;
+	u32 affinity;
+	int sched_policy;
+	int sched_priority;
+	sem_t started;
+};
+
+static void* guest_thread_cb(void* user)
+{
+	ThreadStartup& ts = *(ThreadStartup*) user;
+
+	Registers regs = ts.regs;
+	u32 newsp = ts.newsp;
+
+	SetGS(ts.gs, ts.linear);
+
+	GuestThread* gt = new GuestThread((pid_t) pthread_self());
+	if (ts.flags & LINUX_CLONE_CHILD_CLEARTID)
+		gt->clear_child_tid = (u32*) ts.child_tid;
+
+	/* Scheduling state is inherited. */
+
+	gt->affinity = ts.affinity;
+	gt->sched_policy = ts.sched_policy;
+	gt->sched_priority = ts.sched_priority;
+	ApplyGuestThreadScheduling(*gt);
+	RegisterGuestThread(gt);
+
+	/* These must be written before either thread sees the other. */
+
+	if ((ts.flags & LINUX_CLONE_PARENT_SETTID) && ts.parent_tid)
+		*ts.parent_tid = gt->tid;
+	if ((ts.flags & LINUX_CLONE_CHILD_SETTID) && ts.child_tid)
+		*ts.child_tid = gt->tid;
+
+	/* ts belongs to the parent and becomes invalid once we post. */
+
+	ts.tid = gt->tid;
+	sem_post(&ts.started);
+
+	enter_guest_thread(regs, newsp);
+	return NULL;
+}
+
+static int32_t clone_thread(Registers& regs)
+{
+	u32 clone_flags = regs.arg.a0.u;
+
+	ThreadStartup ts;
+	ts.regs = regs;
+	ts.flags = clone_flags;
+	ts.newsp = regs.arg.a1.u;
+	ts.parent_tid = (pid_t*) regs.arg.a2.p;
+	ts.child_tid = (pid_t*) regs.arg.a4.p;
+	ts.gs = GetGS();
+	ts.linear = GetGSLinear();
+
+	GuestThread& parent = GetGuestThread();
+	ts.affinity = parent.affinity;
+	ts.sched_policy = parent.sched_policy;
+	ts.sched_priority = parent.sched_priority;
+
+	if (!ts.newsp)
+		throw EINVAL;
+
+	if (clone_flags & LINUX_CLONE_SETTLS)
+	{
+		struct linux_user_desc& u = *(struct linux_user_desc*) regs.arg.a3.p;
+		ts.gs = (u.entry_number << 3) | 7;
+		ts.linear = (void*) u.base_addr;
+	}
+
+	/* Make sure the main thread is registered before we make any more. */
+
+	GetGuestThread();
+
+	sem_init(&ts.started, false, 0);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	pthread_t thread;
+	int i = wrapped_pthread_create(&thread, &attr, guest_thread_cb, &ts);
+	pthread_attr_destroy(&attr);
+	if (i)
+	{
+		sem_destroy(&ts.started);
+		throw i;
+	}
+
+	sem_wait(&ts.started);
+	sem_destroy(&ts.started);
+	return ts.tid;
+}
+
+static int32_t clone_process(const Arguments& arg)
 {
 	u32 clone_flags = arg.a0.u;
-	u32 newsp = arg.a1.u;
 	void* parent_tid = arg.a2.p;
 	void* child_tid = arg.a4.p;
 
-	switch (clone_flags)
+	pid_t newpid = stub32_fork(arg);
+	switch (newpid)
 	{
-		case 0x01200011: /* fork, I think */
-		case 0x00100011:
-		{
-			pid_t newpid = stub32_fork(arg);
-			switch (newpid)
+		case 0: /* child */
+			if (clone_flags & LINUX_CLONE_CHILD_SETTID)
 			{
-				case 0: /* child */
-					if (clone_flags & LINUX_CLONE_CHILD_SETTID)
-					{
-						if (child_tid)
-							*(pid_t*)child_tid = getpid();
-					}
-					if (clone_flags & LINUX_CLONE_PARENT_SETTID)
-					{
-						if (parent_tid)
-							*(pid_t*)parent_tid = getpid();
-					}
-					break;
-
-				default: /* parent */
-					if (clone_flags & LINUX_CLONE_PARENT_SETTID)
-					{
-						if (parent_tid)
-							*(pid_t*)parent_tid = newpid;
-					}
-					break;
+				if (child_tid)
+					*(pid_t*)child_tid = getpid();
+			}
+			if (clone_flags & LINUX_CLONE_PARENT_SETTID)
+			{
+				if (parent_tid)
+					*(pid_t*)parent_tid = getpid();
 			}
-			return newpid;
-		}
 
-		default:
-			log("clone flags=%08x newsp=%08x ptid=%p ctid=%p", clone_flags, newsp,
-					parent_tid, child_tid);
-			error("unimplemented clone scenario");
+			/* The child doesn't inherit the parent thread's exit state. */
+
+			GetGuestThread().robust_list = 0;
+			GetGuestThread().clear_child_tid = NULL;
+			if (clone_flags & LINUX_CLONE_CHILD_CLEARTID)
+				GetGuestThread().clear_child_tid = (u32*) child_tid;
+			break;
+
+		default: /* parent */
+			if (clone_flags & LINUX_CLONE_PARENT_SETTID)
+			{
+				if (parent_tid)
+					*(pid_t*)parent_tid = newpid;
+			}
+			break;
 	}
+	return newpid;
+}
+
+/* clone() needs the full register set, so it's dispatched specially. */
+int32_t sys32_clone(Registers& regs)
+{
+	const Arguments& arg = regs.arg;
+	u32 clone_flags = arg.a0.u;
+
+	try
+	{
+		if ((clone_flags & LINUX_CLONE_THREAD) && (clone_flags & LINUX_CLONE_VM))
+			return clone_thread(regs);
+
+		switch (clone_flags)
+		{
+			case 0x01200011: /* fork, I think */
+			case 0x00100011:
+				return clone_process(arg);
+		}
+	}
+	catch (int e)
+	{
+		return -ErrnoI2L(e);
+	}
+
+	log("clone flags=%08x newsp=%08x ptid=%p ctid=%p", clone_flags, arg.a1.u,
+			arg.a2.p, arg.a4.p);
+	error("unimplemented clone scenario");
 }
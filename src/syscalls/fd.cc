@@ -7,6 +7,7 @@
 #include "syscalls.h"
 #include "filesystem/FD.h"
 #include "filesystem/RealFD.h"
+#include "filesystem/EventFD.h"
 #include "filesystem/VFS.h"
 #include <sys/uio.h>
 #include <sys/types.h>
@@ -16,20 +17,6 @@
 #include <poll.h>
 #include <map>
 
-#define LINUX_POLLIN          0x001           /* There is data to read.  */
-#define LINUX_POLLPRI         0x002           /* There is urgent data to read.  */
-#define LINUX_POLLOUT         0x004           /* Writing now will not block.  */
-#define LINUX_POLLRDNORM      0x040           /* Normal data may be read.  */
-#define LINUX_POLLRDBAND      0x080           /* Priority data may be read.  */
-#define LINUX_POLLWRNORM      0x100           /* Writing now will not block.  */
-#define LINUX_POLLWRBAND      0x200           /* Priority data may be written.  */
-#define LINUX_POLLMSG         0x400
-#define LINUX_POLLREMOVE      0x1000
-#define LINUX_POLLRDHUP       0x2000
-#define LINUX_POLLERR         0x008           /* Error condition.  */
-#define LINUX_POLLHUP         0x010           /* Hung up.  */
-#define LINUX_POLLNVAL        0x020           /* Invalid polling request.  */
-
 static int do_open(VFSNode* node, const char* filename, int flags, int mode)
 {
 	//log("open(%s)", filename);
@@ -141,7 +128,213 @@ SYSCALL(sys_write)
 	return fdo->Write(buf, nbytes);
 }
 
+/* Positional I/O. The 64-bit offset arrives split across two registers. */
+
+#define OFFSET64(lo, hi) ((int64_t) (((u64) (hi) << 32) | (u32) (lo)))
+
+SYSCALL(sys32_pread)
+{
+	int fd = arg.a0.s;
+	void* buf = arg.a1.p;
+	size_t nbytes = arg.a2.u;
+	int64_t offset = OFFSET64(arg.a3.u, arg.a4.u);
+
+	{
+		BorrowedFD fdo(fd);
+		if (!fdo->CanBlock())
+			return fdo->PRead(buf, nbytes, offset);
+	}
+
+	Ref<FD> fdo = FD::Get(fd);
+	return fdo->PRead(buf, nbytes, offset);
+}
+
+SYSCALL(sys32_pwrite)
+{
+	int fd = arg.a0.s;
+	const void* buf = arg.a1.p;
+	size_t nbytes = arg.a2.u;
+	int64_t offset = OFFSET64(arg.a3.u, arg.a4.u);
+
+	Ref<FD> fdo = FD::Get(fd);
+	return fdo->PWrite(buf, nbytes, offset);
+}
+
 /* struct iovec and struct linux_compat_iovec are equivalent */
+SYSCALL(compat_sys_readv)
+{
+	int fd = arg.a0.s;
+	const struct iovec* vec = (const struct iovec*) arg.a1.p;
+	unsigned int vlen = arg.a2.u;
+
+	Ref<FD> fdo = FD::Get(fd);
+	return fdo->ReadV(vec, vlen);
+}
+
+SYSCALL(compat_sys_preadv)
+{
+	int fd = arg.a0.s;
+	const struct iovec* vec = (const struct iovec*) arg.a1.p;
+	unsigned int vlen = arg.a2.u;
+	int64_t offset = OFFSET64(arg.a3.u, arg.a4.u);
+
+	Ref<FD> fdo = FD::Get(fd);
+	return fdo->PReadV(vec, vlen, offset);
+}
+
+SYSCALL(compat_sys_pwritev)
+{
+	int fd = arg.a0.s;
+	const struct iovec* vec = (const struct iovec*) arg.a1.p;
+	unsigned int vlen = arg.a2.u;
+	int64_t offset = OFFSET64(arg.a3.u, arg.a4.u);
+
+	Ref<FD> fdo = FD::Get(fd);
+	return fdo->PWriteV(vec, vlen, offset);
+}
+
+/* Zero-copy transfers. These are only zero-copy when the source is a
+ * regular file; see RealFD::SendFile(). */
+
+SYSCALL(sys32_sendfile)
+{
+	int outfd = arg.a0.s;
+	int infd = arg.a1.s;
+	s32* offsetp = (s32*) arg.a2.p;
+	size_t count = arg.a3.u;
+
+	Ref<FD> in = FD::Get(infd);
+	Ref<FD> out = FD::Get(outfd);
+
+	if (!offsetp)
+		return in->SendFile(out, NULL, count);
+
+	int64_t offset = *offsetp;
+	int result = in->SendFile(out, &offset, count);
+	*offsetp = offset;
+	return result;
+}
+
+SYSCALL(sys_sendfile64)
+{
+	int outfd = arg.a0.s;
+	int infd = arg.a1.s;
+	int64_t* offsetp = (int64_t*) arg.a2.p;
+	size_t count = arg.a3.u;
+
+	Ref<FD> in = FD::Get(infd);
+	Ref<FD> out = FD::Get(outfd);
+	return in->SendFile(out, offsetp, count);
+}
+
+/* An explicit output offset means going through a buffer, as SendFile()
+ * can only append. As there, a seekable source only moves past what was
+ * actually written. Bytes read from a pipe can't be put back, so those are
+ * written out in full unless the destination fails, in which case whatever
+ * did get written is reported. */
+SYSCALL(sys_splice)
+{
+	int infd = arg.a0.s;
+	int64_t* inoffp = (int64_t*) arg.a1.p;
+	int outfd = arg.a2.s;
+	int64_t* outoffp = (int64_t*) arg.a3.p;
+	size_t len = arg.a4.u;
+
+	Ref<FD> in = FD::Get(infd);
+	Ref<FD> out = FD::Get(outfd);
+
+	if (!outoffp)
+		return in->SendFile(out, inoffp, len);
+
+	int64_t inpos = -1;
+	if (inoffp)
+		inpos = *inoffp;
+	else
+	{
+		try
+		{
+			inpos = in->Seek(0, SEEK_CUR);
+		}
+		catch (int e)
+		{
+			/* Not seekable. */
+		}
+	}
+
+	char buffer[4096];
+	size_t sent = 0;
+	while (sent < len)
+	{
+		size_t count = len - sent;
+		if (count > sizeof(buffer))
+			count = sizeof(buffer);
+
+		int r;
+		try
+		{
+			if (inpos == -1)
+				r = in->Read(buffer, count);
+			else
+				r = in->PRead(buffer, count, inpos + sent);
+		}
+		catch (int e)
+		{
+			if (sent)
+				break;
+			throw e;
+		}
+		if (r == 0)
+			break;
+
+		int w = 0;
+		try
+		{
+			while (w < r)
+				w += out->PWrite(buffer + w, r - w, *outoffp + sent + w);
+		}
+		catch (int e)
+		{
+			if (!sent && !w)
+				throw e;
+		}
+
+		sent += w;
+		if (w < r)
+			break;
+	}
+
+	*outoffp += sent;
+	if (inoffp)
+		*inoffp = inpos + sent;
+	else if (inpos != -1)
+		in->Seek(inpos + sent, SEEK_SET);
+	return sent;
+}
+
+/* Duplicating pipe contents without consuming them isn't possible with
+ * Interix pipes. Linux returns EINVAL for unsuitable fds, and callers are
+ * expected to fall back to read() and write(). */
+SYSCALL(sys_tee)
+{
+	throw EINVAL;
+}
+
+/* Without shared pipe buffers, this is just readv() or writev(), depending
+ * on which end of the pipe we've been given. */
+SYSCALL(compat_sys_vmsplice)
+{
+	int fd = arg.a0.s;
+	const struct iovec* vec = (const struct iovec*) arg.a1.p;
+	unsigned int vlen = arg.a2.u;
+
+	Ref<FD> fdo = FD::Get(fd);
+
+	int flags = fdo->Fcntl(LINUX_F_GETFL, 0);
+	if ((flags & LINUX_O_ACCMODE) == LINUX_O_RDONLY)
+		return fdo->ReadV(vec, vlen);
+	return fdo->WriteV(vec, vlen);
+}
+
 SYSCALL(compat_sys_writev)
 {
 	int fd = arg.a0.s;
@@ -157,7 +350,7 @@ SYSCALL(sys32_fstat64)
 	int fd = arg.a0.s;
 	struct linux_stat64& ls = *(struct linux_stat64*) arg.a1.p;
 
-	Ref<FD> fdo = FD::Get(fd);
+	BorrowedFD fdo(fd);
 
 	struct stat is;
 	fdo->Fstat(is);
@@ -172,6 +365,20 @@ SYSCALL(compat_sys_fcntl64)
 	int cmd = arg.a1.s;
 	u_int32_t argument = arg.a2.u;
 
+	/* The flag operations are the common ones, and never block. */
+
+	switch (cmd)
+	{
+		case LINUX_F_GETFD:
+		case LINUX_F_SETFD:
+		case LINUX_F_GETFL:
+		case LINUX_F_SETFL:
+		{
+			BorrowedFD fdo(fd);
+			return fdo->Fcntl(cmd, argument);
+		}
+	}
+
 	Ref<FD> fdo = FD::Get(fd);
 	return fdo->Fcntl(cmd, argument);
 }
@@ -193,7 +400,7 @@ SYSCALL(sys32_lseek)
 	int32_t offset = arg.a1.s;
 	unsigned int whence = arg.a2.u;
 
-	Ref<FD> fdo = FD::Get(fd);
+	BorrowedFD fdo(fd);
 	return fdo->Seek(offset, whence);
 }
 
@@ -205,7 +412,7 @@ SYSCALL(sys_llseek)
 	int64_t* result = (int64_t*) arg.a3.p;
 	unsigned int whence = arg.a4.u;
 
-	Ref<FD> fdo = FD::Get(fd);
+	BorrowedFD fdo(fd);
 	*result = fdo->Seek(offset, whence);
 	return 0;
 }
@@ -296,3 +503,18 @@ SYSCALL(compat_sys_getdents)
 	Ref<FD> fdo = FD::Get(fd);
 	return fdo->GetDents(dirent, count);
 }
+
+SYSCALL(sys_eventfd)
+{
+	unsigned int count = arg.a0.u;
+
+	return EventFD::Create(count, 0);
+}
+
+SYSCALL(sys_eventfd2)
+{
+	unsigned int count = arg.a0.u;
+	int flags = arg.a1.s;
+
+	return EventFD::Create(count, flags);
+}
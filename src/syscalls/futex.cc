@@ -0,0 +1,572 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "syscalls.h"
+#include "syscalls/futex.h"
+#include "Atomic.h"
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+
+//#define VERBOSE
+
+#define LINUX_FUTEX_WAIT              0
+#define LINUX_FUTEX_WAKE              1
+#define LINUX_FUTEX_FD                2
+#define LINUX_FUTEX_REQUEUE           3
+#define LINUX_FUTEX_CMP_REQUEUE       4
+#define LINUX_FUTEX_WAKE_OP           5
+#define LINUX_FUTEX_LOCK_PI           6
+#define LINUX_FUTEX_UNLOCK_PI         7
+#define LINUX_FUTEX_TRYLOCK_PI        8
+#define LINUX_FUTEX_WAIT_BITSET       9
+#define LINUX_FUTEX_WAKE_BITSET       10
+
+#define LINUX_FUTEX_PRIVATE_FLAG      128
+#define LINUX_FUTEX_CLOCK_REALTIME	256
+#define LINUX_FUTEX_CMD_MASK		~(LINUX_FUTEX_PRIVATE_FLAG | LINUX_FUTEX_CLOCK_REALTIME)
+
+#define LINUX_FUTEX_BITSET_MATCH_ANY  0xffffffff
+
+#define LINUX_FUTEX_OP_SET            0  /* *(int *)UADDR2 = OPARG; */
+#define LINUX_FUTEX_OP_ADD            1  /* *(int *)UADDR2 += OPARG; */
+#define LINUX_FUTEX_OP_OR             2  /* *(int *)UADDR2 |= OPARG; */
+#define LINUX_FUTEX_OP_ANDN           3  /* *(int *)UADDR2 &= ~OPARG; */
+#define LINUX_FUTEX_OP_XOR            4  /* *(int *)UADDR2 ^= OPARG; */
+
+#define LINUX_FUTEX_OP_CMP_EQ         0  /* if (oldval == CMPARG) wake */
+#define LINUX_FUTEX_OP_CMP_NE         1  /* if (oldval != CMPARG) wake */
+#define LINUX_FUTEX_OP_CMP_LT         2  /* if (oldval < CMPARG) wake */
+#define LINUX_FUTEX_OP_CMP_LE         3  /* if (oldval <= CMPARG) wake */
+#define LINUX_FUTEX_OP_CMP_GT         4  /* if (oldval > CMPARG) wake */
+#define LINUX_FUTEX_OP_CMP_GE         5  /* if (oldval >= CMPARG) wake */
+
+/* Futexes are implemented with a hash table of wait queues, keyed by
+ * address. Each bucket has its own lock, which protects the queue; each
+ * waiter sleeps on a condition variable of its own, which means a waiter
+ * can be moved from one bucket to another (for FUTEX_REQUEUE) without
+ * having to wake it up.
+ *
+ * The hash table only knows about this process. Shared futexes may be
+ * woken by another process, which we can't see, so waiters on those wake
+ * up every SHARED_SLICE_MS to recheck the futex word.
+ */
+
+static const int BUCKET_COUNT = 256;
+static const int SHARED_SLICE_MS = 10;
+
+struct Bucket;
+
+struct Waiter
+{
+	Waiter* next;
+	Waiter* prev;
+	Bucket* bucket;
+	u32* uaddr;
+	u32 bitset;
+	bool queued;
+	bool woken;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+struct Bucket
+{
+	pthread_mutex_t mutex;
+	Waiter* first;
+	Waiter* last;
+};
+
+static Bucket buckets[BUCKET_COUNT];
+
+void InitFutexes()
+{
+	/* This is also called in fork() children, where any waiters belong to
+	 * threads which no longer exist. */
+
+	for (int i = 0; i < BUCKET_COUNT; i++)
+	{
+		Bucket& b = buckets[i];
+		pthread_mutex_init(&b.mutex, NULL);
+		b.first = b.last = NULL;
+	}
+}
+
+static Bucket* get_bucket(u32* uaddr)
+{
+	u32 h = (u32) uaddr;
+	h = (h >> 2) ^ (h >> 10) ^ (h >> 18);
+	return &buckets[h % BUCKET_COUNT];
+}
+
+/* Locks two buckets in a consistent order, to avoid deadlocks. */
+static void lock_buckets(Bucket* b1, Bucket* b2)
+{
+	if (b1 == b2)
+		pthread_mutex_lock(&b1->mutex);
+	else if (b1 < b2)
+	{
+		pthread_mutex_lock(&b1->mutex);
+		pthread_mutex_lock(&b2->mutex);
+	}
+	else
+	{
+		pthread_mutex_lock(&b2->mutex);
+		pthread_mutex_lock(&b1->mutex);
+	}
+}
+
+static void unlock_buckets(Bucket* b1, Bucket* b2)
+{
+	pthread_mutex_unlock(&b1->mutex);
+	if (b1 != b2)
+		pthread_mutex_unlock(&b2->mutex);
+}
+
+/* Bucket must be locked. */
+static void enqueue(Bucket* b, Waiter* w)
+{
+	w->bucket = b;
+	w->next = NULL;
+	w->prev = b->last;
+	if (b->last)
+		b->last->next = w;
+	else
+		b->first = w;
+	b->last = w;
+	w->queued = true;
+}
+
+/* Bucket must be locked. */
+static void dequeue(Waiter* w)
+{
+	Bucket* b = w->bucket;
+	if (w->prev)
+		w->prev->next = w->next;
+	else
+		b->first = w->next;
+	if (w->next)
+		w->next->prev = w->prev;
+	else
+		b->last = w->prev;
+	w->queued = false;
+}
+
+/* Bucket must be locked. The waiter's bucket lock stays held by the caller
+ * until the wakeup is complete, which keeps the waiter from returning (and
+ * destroying itself) while we're still poking at it. */
+static void wake_waiter(Waiter* w)
+{
+	dequeue(w);
+
+	pthread_mutex_lock(&w->mutex);
+	w->woken = true;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+/* Bucket must be locked. */
+static int wake_bucket(Bucket* b, u32* uaddr, int count, u32 bitset)
+{
+	int woken = 0;
+	Waiter* w = b->first;
+	while (w && (woken < count))
+	{
+		Waiter* next = w->next;
+		if ((w->uaddr == uaddr) && (w->bitset & bitset))
+		{
+			wake_waiter(w);
+			woken++;
+		}
+		w = next;
+	}
+	return woken;
+}
+
+/* Locks whichever bucket the waiter is currently in; this can change under
+ * our feet if someone requeues it. */
+static Bucket* lock_waiter_bucket(Waiter* w)
+{
+	for (;;)
+	{
+		Bucket* b = w->bucket;
+		pthread_mutex_lock(&b->mutex);
+		if (w->bucket == b)
+			return b;
+		pthread_mutex_unlock(&b->mutex);
+	}
+}
+
+static void add_ms(struct timespec& ts, int ms)
+{
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	ts.tv_sec += ms / 1000 + ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+}
+
+static void get_now(struct timespec& ts)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec;
+	ts.tv_nsec = tv.tv_usec * 1000;
+}
+
+static bool before(const struct timespec& t1, const struct timespec& t2)
+{
+	if (t1.tv_sec != t2.tv_sec)
+		return t1.tv_sec < t2.tv_sec;
+	return t1.tv_nsec < t2.tv_nsec;
+}
+
+/* deadline is absolute (CLOCK_MONOTONIC is the same as CLOCK_REALTIME
+ * here), or NULL for no timeout. */
+static int futex_wait(u32* uaddr, u32 val, const struct timespec* deadline,
+		u32 bitset, bool shared)
+{
+	if (bitset == 0)
+		throw EINVAL;
+
+	Waiter w;
+	w.uaddr = uaddr;
+	w.bitset = bitset;
+	w.woken = false;
+	pthread_mutex_init(&w.mutex, NULL);
+	pthread_cond_init(&w.cond, NULL);
+
+	Bucket* b = get_bucket(uaddr);
+	pthread_mutex_lock(&b->mutex);
+	if (*(volatile u32*) uaddr != val)
+	{
+		pthread_mutex_unlock(&b->mutex);
+		pthread_cond_destroy(&w.cond);
+		pthread_mutex_destroy(&w.mutex);
+		throw EAGAIN;
+	}
+	enqueue(b, &w);
+	pthread_mutex_unlock(&b->mutex);
+
+	bool timedout = false;
+	pthread_mutex_lock(&w.mutex);
+	while (!w.woken)
+	{
+		if (!shared && !deadline)
+		{
+			pthread_cond_wait(&w.cond, &w.mutex);
+			continue;
+		}
+
+		struct timespec until;
+		if (shared)
+		{
+			get_now(until);
+			add_ms(until, SHARED_SLICE_MS);
+			if (deadline && before(*deadline, until))
+				until = *deadline;
+		}
+		else
+			until = *deadline;
+
+		pthread_cond_timedwait(&w.cond, &w.mutex, &until);
+		if (w.woken)
+			break;
+
+		/* Probably woken by another process. */
+
+		if (shared && (*(volatile u32*) uaddr != val))
+			break;
+
+		if (deadline)
+		{
+			struct timespec now;
+			get_now(now);
+			if (!before(now, *deadline))
+			{
+				timedout = true;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&w.mutex);
+
+	/* Take ourselves off the queue, if nobody else has. Taking the bucket
+	 * lock also guarantees that any waker has finished with us. */
+
+	b = lock_waiter_bucket(&w);
+	bool woken = !w.queued;
+	if (w.queued)
+		dequeue(&w);
+	pthread_mutex_unlock(&b->mutex);
+
+	pthread_cond_destroy(&w.cond);
+	pthread_mutex_destroy(&w.mutex);
+
+	if (!woken && timedout)
+		throw ETIMEDOUT;
+	return 0;
+}
+
+static int futex_wake(u32* uaddr, int count, u32 bitset)
+{
+	if (bitset == 0)
+		throw EINVAL;
+
+	Bucket* b = get_bucket(uaddr);
+	pthread_mutex_lock(&b->mutex);
+	int woken = wake_bucket(b, uaddr, count, bitset);
+	pthread_mutex_unlock(&b->mutex);
+	return woken;
+}
+
+int FutexWake(u32* uaddr, int count)
+{
+	return futex_wake(uaddr, count, LINUX_FUTEX_BITSET_MATCH_ANY);
+}
+
+/* Robust futexes. Each thread registers a list of the futexes it holds;
+ * when it dies, any which it still owns are marked OWNER_DIED and a waiter
+ * is woken to clean up. */
+
+#define LINUX_FUTEX_WAITERS           0x80000000
+#define LINUX_FUTEX_OWNER_DIED        0x40000000
+#define LINUX_FUTEX_TID_MASK          0x3fffffff
+
+#define ROBUST_LIST_LIMIT             2048
+
+struct linux_robust_list
+{
+	u32 next;
+};
+
+struct linux_robust_list_head
+{
+	struct linux_robust_list list;
+	s32 futex_offset;
+	u32 list_op_pending;
+};
+
+static void handle_futex_death(u32* uaddr, pid_t tid, bool pi)
+{
+	for (;;)
+	{
+		u32 uval = *(volatile u32*) uaddr;
+		if ((uval & LINUX_FUTEX_TID_MASK) != (u32) tid)
+			return;
+
+		u32 mval = (uval & LINUX_FUTEX_WAITERS) | LINUX_FUTEX_OWNER_DIED;
+		if (Atomic::CompareAndSwap(uaddr, uval, mval) != uval)
+			continue;
+
+		/* PI futexes aren't supported, so nobody can be waiting on one
+		 * in the kernel. */
+		if (!pi && (uval & LINUX_FUTEX_WAITERS))
+			futex_wake(uaddr, 1, LINUX_FUTEX_BITSET_MATCH_ANY);
+		return;
+	}
+}
+
+/* Called as a thread exits, with the head it registered via
+ * set_robust_list(). The list lives in guest memory and may be garbage, so
+ * the walk is bounded. Entries have the PI flag in the bottom bit. */
+void FutexExitRobustList(u32 head, pid_t tid)
+{
+	if (!head)
+		return;
+
+	struct linux_robust_list_head& h = *(struct linux_robust_list_head*) head;
+	u32 pending = h.list_op_pending;
+	u32 entry = h.list.next;
+
+	int limit = ROBUST_LIST_LIMIT;
+	while (entry && (entry != head) && (limit-- > 0))
+	{
+		u32 e = entry & ~1;
+		u32 next = ((struct linux_robust_list*) e)->next;
+
+		/* The pending op is dealt with last. */
+		if (e != (pending & ~1))
+			handle_futex_death((u32*) (e + h.futex_offset), tid, entry & 1);
+
+		entry = next;
+	}
+
+	if (pending)
+		handle_futex_death((u32*) ((pending & ~1) + h.futex_offset), tid,
+				pending & 1);
+}
+
+static int futex_requeue(u32* uaddr, int nrwake, int nrrequeue,
+		u32* uaddr2, bool compare, u32 val3)
+{
+	Bucket* b1 = get_bucket(uaddr);
+	Bucket* b2 = get_bucket(uaddr2);
+	lock_buckets(b1, b2);
+
+	if (compare && (*(volatile u32*) uaddr != val3))
+	{
+		unlock_buckets(b1, b2);
+		throw EAGAIN;
+	}
+
+	int woken = 0;
+	int requeued = 0;
+	Waiter* w = b1->first;
+	while (w)
+	{
+		Waiter* next = w->next;
+		if (w->uaddr == uaddr)
+		{
+			if (woken < nrwake)
+			{
+				wake_waiter(w);
+				woken++;
+			}
+			else if (requeued < nrrequeue)
+			{
+				dequeue(w);
+				w->uaddr = uaddr2;
+				enqueue(b2, w);
+				requeued++;
+			}
+			else
+				break;
+		}
+		w = next;
+	}
+
+	unlock_buckets(b1, b2);
+	return woken + requeued;
+}
+
+static int futex_wake_op(u32* uaddr, int nrwake, int nrwake2, u32* uaddr2,
+		u32 encodedop)
+{
+	int op = (encodedop >> 28) & 7;
+	int cmp = (encodedop >> 24) & 15;
+	s32 oparg = ((s32) (encodedop << 8)) >> 20;
+	s32 cmparg = ((s32) (encodedop << 20)) >> 20;
+	if (encodedop & 0x80000000)
+		oparg = 1 << oparg;
+
+	Bucket* b1 = get_bucket(uaddr);
+	Bucket* b2 = get_bucket(uaddr2);
+	lock_buckets(b1, b2);
+
+	/* The guest may be changing *uaddr2 concurrently, so this has to be an
+	 * atomic update. */
+
+	s32 oldval;
+	for (;;)
+	{
+		oldval = *(volatile s32*) uaddr2;
+		s32 newval;
+		switch (op)
+		{
+			case LINUX_FUTEX_OP_SET:  newval = oparg; break;
+			case LINUX_FUTEX_OP_ADD:  newval = oldval + oparg; break;
+			case LINUX_FUTEX_OP_OR:   newval = oldval | oparg; break;
+			case LINUX_FUTEX_OP_ANDN: newval = oldval & ~oparg; break;
+			case LINUX_FUTEX_OP_XOR:  newval = oldval ^ oparg; break;
+			default:
+				unlock_buckets(b1, b2);
+				throw ENOSYS;
+		}
+
+		if (Atomic::CompareAndSwap(uaddr2, oldval, newval) == (u32) oldval)
+			break;
+	}
+
+	int woken = wake_bucket(b1, uaddr, nrwake, LINUX_FUTEX_BITSET_MATCH_ANY);
+
+	bool wake2;
+	switch (cmp)
+	{
+		case LINUX_FUTEX_OP_CMP_EQ: wake2 = (oldval == cmparg); break;
+		case LINUX_FUTEX_OP_CMP_NE: wake2 = (oldval != cmparg); break;
+		case LINUX_FUTEX_OP_CMP_LT: wake2 = (oldval < cmparg); break;
+		case LINUX_FUTEX_OP_CMP_LE: wake2 = (oldval <= cmparg); break;
+		case LINUX_FUTEX_OP_CMP_GT: wake2 = (oldval > cmparg); break;
+		case LINUX_FUTEX_OP_CMP_GE: wake2 = (oldval >= cmparg); break;
+		default:
+			unlock_buckets(b1, b2);
+			throw ENOSYS;
+	}
+
+	if (wake2)
+		woken += wake_bucket(b2, uaddr2, nrwake2, LINUX_FUTEX_BITSET_MATCH_ANY);
+
+	unlock_buckets(b1, b2);
+	return woken;
+}
+
+SYSCALL(compat_sys_futex)
+{
+	u32* uaddr = (u32*) arg.a0.p;
+	int op = arg.a1.s;
+	u32 val = arg.a2.u;
+	const struct timespec* timeout = (const struct timespec*) arg.a3.p;
+	u32 val2 = arg.a3.u;
+	u32* uaddr2 = (u32*) arg.a4.p;
+	u32 val3 = arg.a5.u;
+
+	bool shared = !(op & LINUX_FUTEX_PRIVATE_FLAG);
+	int cmd = op & LINUX_FUTEX_CMD_MASK;
+
+#if defined VERBOSE
+	log("futex(%p, %x, %08x, %p, %p, %08x)", uaddr, op, val, timeout,
+			uaddr2, val3);
+#endif
+
+	switch (cmd)
+	{
+		case LINUX_FUTEX_WAIT:
+		{
+			/* The timeout is relative. */
+
+			struct timespec deadline;
+			if (timeout)
+			{
+				if ((timeout->tv_sec < 0) || (timeout->tv_nsec < 0) ||
+						(timeout->tv_nsec >= 1000000000))
+					throw EINVAL;
+
+				get_now(deadline);
+				deadline.tv_sec += timeout->tv_sec;
+				deadline.tv_nsec += timeout->tv_nsec;
+				if (deadline.tv_nsec >= 1000000000)
+				{
+					deadline.tv_sec++;
+					deadline.tv_nsec -= 1000000000;
+				}
+			}
+
+			return futex_wait(uaddr, val, timeout ? &deadline : NULL,
+					LINUX_FUTEX_BITSET_MATCH_ANY, shared);
+		}
+
+		case LINUX_FUTEX_WAIT_BITSET:
+			/* The timeout is absolute. */
+			return futex_wait(uaddr, val, timeout, val3, shared);
+
+		case LINUX_FUTEX_WAKE:
+			return futex_wake(uaddr, val, LINUX_FUTEX_BITSET_MATCH_ANY);
+
+		case LINUX_FUTEX_WAKE_BITSET:
+			return futex_wake(uaddr, val, val3);
+
+		case LINUX_FUTEX_REQUEUE:
+			return futex_requeue(uaddr, val, val2, uaddr2, false, 0);
+
+		case LINUX_FUTEX_CMP_REQUEUE:
+			return futex_requeue(uaddr, val, val2, uaddr2, true, val3);
+
+		case LINUX_FUTEX_WAKE_OP:
+			return futex_wake_op(uaddr, val, val2, uaddr2, val3);
+	}
+
+	Warning("futex op %x unsupported", op);
+	throw ENOSYS;
+}
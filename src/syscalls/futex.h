@@ -0,0 +1,13 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef SYSCALLS_FUTEX_H
+#define SYSCALLS_FUTEX_H
+
+extern void InitFutexes();
+extern int FutexWake(u32* uaddr, int count);
+extern void FutexExitRobustList(u32 head, pid_t tid);
+
+#endif
@@ -0,0 +1,569 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "syscalls.h"
+#include "syscalls/ipc.h"
+#include "syscalls/mmap.h"
+#include "MemOp.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <map>
+
+//#define VERBOSE
+
+using std::map;
+
+#define LINUX_SHMAT         21
+#define LINUX_SHMDT         22
+#define LINUX_SHMGET        23
+#define LINUX_SHMCTL        24
+
+#define LINUX_IPC_PRIVATE   0
+#define LINUX_IPC_CREAT     00001000
+#define LINUX_IPC_EXCL      00002000
+
+#define LINUX_IPC_RMID      0
+#define LINUX_IPC_SET       1
+#define LINUX_IPC_STAT      2
+#define LINUX_IPC_64        0x0100
+
+#define LINUX_SHM_RDONLY    010000
+#define LINUX_SHM_RND       020000
+#define LINUX_SHM_EXEC      0100000
+#define LINUX_SHM_LOCK      11
+#define LINUX_SHM_UNLOCK    12
+#define LINUX_SHM_DEST      01000
+
+#define LINUX_SHMLBA        4096
+
+#pragma pack(push, 1)
+struct linux_ipc_perm
+{
+	s32 key;
+	u16 uid;
+	u16 gid;
+	u16 cuid;
+	u16 cgid;
+	u16 mode;
+	u16 seq;
+};
+
+struct linux_shmid_ds
+{
+	struct linux_ipc_perm shm_perm;
+	s32 shm_segsz;
+	s32 shm_atime;
+	s32 shm_dtime;
+	s32 shm_ctime;
+	u16 shm_cpid;
+	u16 shm_lpid;
+	u16 shm_nattch;
+	u16 shm_unused;
+	u32 shm_unused2;
+	u32 shm_unused3;
+};
+
+struct linux_ipc64_perm
+{
+	s32 key;
+	u32 uid;
+	u32 gid;
+	u32 cuid;
+	u32 cgid;
+	u16 mode;
+	u16 __pad1;
+	u16 seq;
+	u16 __pad2;
+	u32 __unused1;
+	u32 __unused2;
+};
+
+struct linux_shmid64_ds
+{
+	struct linux_ipc64_perm shm_perm;
+	u32 shm_segsz;
+	u32 shm_atime;
+	u32 __unused1;
+	u32 shm_dtime;
+	u32 __unused2;
+	u32 shm_ctime;
+	u32 __unused3;
+	s32 shm_cpid;
+	s32 shm_lpid;
+	u32 shm_nattch;
+	u32 __unused4;
+	u32 __unused5;
+};
+#pragma pack(pop)
+
+/* IPC objects have to be visible to every LBW process, so they live as
+ * files in a world-writeable host directory.
+ */
+
+static void make_shared_directory(const string& path)
+{
+	/* mkdir() is subject to umask, so set the mode explicitly. */
+
+	if (mkdir(path.c_str(), 0777) == 0)
+		chmod(path.c_str(), 01777);
+}
+
+string GetIPCDirectory(const string& name)
+{
+	static const char root[] = "/tmp/.lbw";
+
+	make_shared_directory(root);
+	string path = string(root) + "/" + name;
+	make_shared_directory(path);
+	return path;
+}
+
+/* --- System V shared memory ------------------------------------------- */
+
+/* Each segment is a file called shm.<id>, whose size is the size of the
+ * segment. Keyed segments also get a symlink key.<key> pointing at the
+ * segment file. Attaching a segment is just a MAP_SHARED mmap() of the file,
+ * which the mmap layer turns into real shared mappings.
+ *
+ * IPC_RMID on a segment which is still attached renames it to rmid.<id>,
+ * where it can still be attached by id until the last attachment goes away.
+ * As with nattch, only this process's attachments are known about; if the
+ * process dies while attached, the file is left behind.
+ */
+
+struct Attachment
+{
+	int id;
+	u32 length;
+};
+
+typedef map<u32, Attachment> Attachments;
+static Attachments attachments;
+
+/* When each segment was last detached by this process. */
+static map<int, u32> detachtimes;
+static Mutex ipclock("SysV IPC");
+
+static const string& shm_dir()
+{
+	static string dir;
+	if (dir.empty())
+		dir = GetIPCDirectory("sysvshm");
+	return dir;
+}
+
+static string segment_path(int id)
+{
+	return cprintf("%s/shm.%d", shm_dir().c_str(), id);
+}
+
+static string removed_path(int id)
+{
+	return cprintf("%s/rmid.%d", shm_dir().c_str(), id);
+}
+
+/* Finds the file for a segment, even if it's been removed. */
+static string find_segment(int id, struct stat& st, bool& removed)
+{
+	string path = segment_path(id);
+	removed = false;
+	if (stat(path.c_str(), &st) == 0)
+		return path;
+	if (errno != ENOENT)
+		throw errno;
+
+	path = removed_path(id);
+	removed = true;
+	if (stat(path.c_str(), &st) == 0)
+		return path;
+	throw (errno == ENOENT) ? EINVAL : errno;
+}
+
+static string key_path(s32 key)
+{
+	return cprintf("%s/key.%08x", shm_dir().c_str(), key);
+}
+
+static int lookup_key(s32 key)
+{
+	char buffer[64];
+	int i = readlink(key_path(key).c_str(), buffer, sizeof(buffer)-1);
+	if (i == -1)
+		return -1;
+	buffer[i] = '\0';
+
+	int id;
+	if (sscanf(buffer, "shm.%d", &id) != 1)
+		return -1;
+	return id;
+}
+
+/* Finds the key for a segment, if it has one. This is slow, but is only
+ * used by shmctl(). */
+static bool find_key(int id, s32& key)
+{
+	string target = cprintf("shm.%d", id);
+	bool found = false;
+
+	DIR* d = opendir(shm_dir().c_str());
+	if (!d)
+		return false;
+
+	for (;;)
+	{
+		struct dirent* de = readdir(d);
+		if (!de)
+			break;
+
+		u32 k;
+		if (sscanf(de->d_name, "key.%x", &k) != 1)
+			continue;
+		if (lookup_key(k) == id)
+		{
+			key = k;
+			found = true;
+			break;
+		}
+	}
+
+	closedir(d);
+	return found;
+}
+
+static int create_segment(u32 size, int flags)
+{
+	if (size == 0)
+		throw EINVAL;
+
+	for (int id = 1;; id++)
+	{
+		/* Removed segments still own their ids. */
+
+		struct stat st;
+		if (stat(removed_path(id).c_str(), &st) == 0)
+			continue;
+
+		string path = segment_path(id);
+		int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd == -1)
+		{
+			if (errno == EEXIST)
+				continue;
+			throw errno;
+		}
+
+		int i = fchmod(fd, flags & 0777);
+		if (i != -1)
+			i = ftruncate(fd, size);
+		int e = errno;
+		close(fd);
+
+		if (i == -1)
+		{
+			unlink(path.c_str());
+			throw e;
+		}
+
+#if defined VERBOSE
+		log("created shm segment %d of %d bytes", id, size);
+#endif
+		return id;
+	}
+}
+
+static int do_shmget(s32 key, u32 size, int flags)
+{
+	if (key == LINUX_IPC_PRIVATE)
+		return create_segment(size, flags);
+
+	for (;;)
+	{
+		int id = lookup_key(key);
+		if (id != -1)
+		{
+			struct stat st;
+			if (stat(segment_path(id).c_str(), &st) == -1)
+			{
+				/* Stale key (the owner died before removing it). */
+				unlink(key_path(key).c_str());
+				continue;
+			}
+
+			if ((flags & LINUX_IPC_CREAT) && (flags & LINUX_IPC_EXCL))
+				throw EEXIST;
+			if (size > (u32) st.st_size)
+				throw EINVAL;
+			return id;
+		}
+
+		if (!(flags & LINUX_IPC_CREAT))
+			throw ENOENT;
+
+		id = create_segment(size, flags);
+		string target = cprintf("shm.%d", id);
+		if (symlink(target.c_str(), key_path(key).c_str()) == 0)
+			return id;
+
+		/* Someone else created the key while we weren't looking; use
+		 * theirs. */
+
+		int e = errno;
+		unlink(segment_path(id).c_str());
+		if (e != EEXIST)
+			throw e;
+	}
+}
+
+static u32 do_shmat(int id, u8* addr, int flags)
+{
+	bool readonly = flags & LINUX_SHM_RDONLY;
+
+	u32 mmapflags = LINUX_MAP_SHARED;
+	if (addr)
+	{
+		if (flags & LINUX_SHM_RND)
+			addr = MemOp::Align<LINUX_SHMLBA>(addr);
+		else if (!MemOp::Aligned<LINUX_SHMLBA>(addr))
+			throw EINVAL;
+
+		/* Anything else would end up as a private copy. */
+
+		if (!MemOp::Aligned<0x10000>(addr))
+		{
+			Warning("shmat() can only attach to 64kB boundaries, not %p", addr);
+			throw EINVAL;
+		}
+		mmapflags |= LINUX_MAP_FIXED;
+	}
+
+	u32 prot = LINUX_PROT_READ;
+	if (!readonly)
+		prot |= LINUX_PROT_WRITE;
+	if (flags & LINUX_SHM_EXEC)
+		prot |= LINUX_PROT_EXEC;
+
+	struct stat st;
+	bool removed;
+	string path = find_segment(id, st, removed);
+
+	int fd = open(path.c_str(), readonly ? O_RDONLY : O_RDWR);
+	if (fd == -1)
+		throw (errno == ENOENT) ? EINVAL : errno;
+
+	u32 result;
+	try
+	{
+		if (fstat(fd, &st) == -1)
+			throw errno;
+
+		string label = cprintf("/SYSV%08x", id);
+		result = do_mmap(addr, st.st_size, prot, mmapflags, fd, 0,
+				label.c_str());
+
+		Attachment& a = attachments[result];
+		a.id = id;
+		a.length = st.st_size;
+	}
+	catch (int e)
+	{
+		close(fd);
+		throw e;
+	}
+
+	/* The mapping keeps the file alive. */
+
+	close(fd);
+
+	if (!MemOp::Aligned<0x10000>(result))
+		Warning("shm segment %d attached at %08x will not be shared", id, result);
+	return result;
+}
+
+/* Only counts attachments in this process; we have no way of knowing about
+ * anyone else's. */
+static u32 count_attachments(int id)
+{
+	u32 count = 0;
+	for (Attachments::const_iterator i = attachments.begin();
+			i != attachments.end(); i++)
+	{
+		if (i->second.id == id)
+			count++;
+	}
+	return count;
+}
+
+static void do_shmdt(u8* addr)
+{
+	Attachments::iterator i = attachments.find((u32) addr);
+	if (i == attachments.end())
+		throw EINVAL;
+
+	int id = i->second.id;
+	do_munmap(addr, i->second.length);
+	attachments.erase(i);
+	detachtimes[id] = time(NULL);
+
+	/* The last attachment of a removed segment takes it with it. */
+
+	if (count_attachments(id) == 0)
+		unlink(removed_path(id).c_str());
+}
+
+static int do_shmctl(int id, int cmd, void* buf)
+{
+	/* glibc always uses the IPC_64 structures on i386, but older
+	 * binaries use the 16-bit ones. */
+
+	bool ipc64 = cmd & LINUX_IPC_64;
+	cmd &= ~LINUX_IPC_64;
+
+	switch (cmd)
+	{
+		case LINUX_IPC_RMID:
+		{
+			/* The key goes immediately, but the segment has to stay
+			 * attachable by id while anything is attached to it.
+			 * Existing mappings keep the file alive regardless. */
+
+			string path = segment_path(id);
+			s32 key;
+			bool haskey = find_key(id, key);
+
+			int i;
+			if (count_attachments(id) == 0)
+				i = unlink(path.c_str());
+			else
+				i = rename(path.c_str(), removed_path(id).c_str());
+			if (i == -1)
+				throw (errno == ENOENT) ? EINVAL : errno;
+
+			if (haskey)
+				unlink(key_path(key).c_str());
+			return 0;
+		}
+
+		case LINUX_IPC_STAT:
+		{
+			struct stat st;
+			bool removed;
+			find_segment(id, st, removed);
+
+			s32 key = LINUX_IPC_PRIVATE;
+			if (!removed)
+				find_key(id, key);
+
+			u32 mode = st.st_mode & 0777;
+			if (removed)
+				mode |= LINUX_SHM_DEST;
+
+			/* Segments are only detached by the process that attached
+			 * them, so this only knows about its own. */
+
+			u32 dtime = 0;
+			map<int, u32>::const_iterator di = detachtimes.find(id);
+			if (di != detachtimes.end())
+				dtime = di->second;
+
+			if (ipc64)
+			{
+				struct linux_shmid64_ds& ds = *(struct linux_shmid64_ds*) buf;
+				memset(&ds, 0, sizeof(ds));
+				ds.shm_perm.key = key;
+				ds.shm_perm.uid = ds.shm_perm.cuid = st.st_uid;
+				ds.shm_perm.gid = ds.shm_perm.cgid = st.st_gid;
+				ds.shm_perm.mode = mode;
+				ds.shm_segsz = st.st_size;
+				ds.shm_atime = st.st_atime;
+				ds.shm_dtime = dtime;
+				ds.shm_ctime = st.st_ctime;
+				ds.shm_nattch = count_attachments(id);
+			}
+			else
+			{
+				struct linux_shmid_ds& ds = *(struct linux_shmid_ds*) buf;
+				memset(&ds, 0, sizeof(ds));
+				ds.shm_perm.key = key;
+				ds.shm_perm.uid = ds.shm_perm.cuid = st.st_uid;
+				ds.shm_perm.gid = ds.shm_perm.cgid = st.st_gid;
+				ds.shm_perm.mode = mode;
+				ds.shm_segsz = st.st_size;
+				ds.shm_atime = st.st_atime;
+				ds.shm_dtime = dtime;
+				ds.shm_ctime = st.st_ctime;
+				ds.shm_nattch = count_attachments(id);
+			}
+			return 0;
+		}
+
+		case LINUX_IPC_SET:
+		{
+			struct stat st;
+			bool removed;
+			string path = find_segment(id, st, removed);
+
+			u32 mode;
+			if (ipc64)
+				mode = ((struct linux_shmid64_ds*) buf)->shm_perm.mode;
+			else
+				mode = ((struct linux_shmid_ds*) buf)->shm_perm.mode;
+
+			if (chmod(path.c_str(), mode & 0777) == -1)
+				throw (errno == ENOENT) ? EINVAL : errno;
+			return 0;
+		}
+
+		case LINUX_SHM_LOCK:
+		case LINUX_SHM_UNLOCK:
+			return 0;
+	}
+
+	throw EINVAL;
+}
+
+SYSCALL(sys32_ipc)
+{
+	u32 call = arg.a0.u;
+	s32 first = arg.a1.s;
+	s32 second = arg.a2.s;
+	u32 third = arg.a3.u;
+	void* ptr = arg.a4.p;
+	u32 version = call >> 16;
+
+	RAIILock locked(ipclock);
+
+#if defined VERBOSE
+	log("ipc(%d, %d, %d, %08x, %p)", call, first, second, third, ptr);
+#endif
+
+	switch (call & 0xffff)
+	{
+		case LINUX_SHMAT:
+		{
+			/* Version 1 is the iBCS2 entry point, which Linux doesn't
+			 * support either. */
+
+			if (version == 1)
+				throw EINVAL;
+
+			*(u32*) third = do_shmat(first, (u8*) ptr, second);
+			return 0;
+		}
+
+		case LINUX_SHMDT:
+			do_shmdt((u8*) ptr);
+			return 0;
+
+		case LINUX_SHMGET:
+			return do_shmget(first, second, third);
+
+		case LINUX_SHMCTL:
+			return do_shmctl(first, second, ptr);
+	}
+
+	Warning("unsupported ipc call %d", call & 0xffff);
+	throw ENOSYS;
+}
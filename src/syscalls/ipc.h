@@ -0,0 +1,11 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef SYSCALLS_IPC_H
+#define SYSCALLS_IPC_H
+
+extern string GetIPCDirectory(const string& name);
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "globals.h"
 #include "syscalls.h"
+#include "syscalls/memory.h"
 #include <sys/mman.h>
 #include <pthread.h>
 
@@ -12,15 +13,28 @@
 
 static u_int8_t* brkbuf = NULL;
 static u_int8_t* pos;
+static Mutex brklock("brk");
 
 void ClearBrk()
 {
 	pos = brkbuf;
 }
 
+void GetBrkRange(u32& start, u32& end)
+{
+	start = (u32) brkbuf;
+	end = (u32) pos;
+}
+
+/* The brk buffer is mapped all in one go, so it all counts. */
+u32 GetBrkSize()
+{
+	return brkbuf ? BRK_SIZE : 0;
+}
+
 SYSCALL(sys_brk)
 {
-	RAIILock locked;
+	RAIILock locked(brklock);
 	u_int32_t addr = arg.a0.u;
 
 	if (!brkbuf)
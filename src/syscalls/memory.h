@@ -7,5 +7,7 @@
 #define SYSCALLS_MEMORY_H
 
 extern void ClearBrk();
+extern void GetBrkRange(u32& start, u32& end);
+extern u32 GetBrkSize();
 
 #endif
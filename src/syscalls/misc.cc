@@ -5,6 +5,7 @@
 
 #include "globals.h"
 #include "syscalls.h"
+#include "hostinfo.h"
 #include <sys/utsname.h>
 
 #pragma pack(push, 1)
@@ -66,6 +67,17 @@ SYSCALL(compat_sys_sysinfo)
 	struct linux_compat_sysinfo* sysinfo =
 			(struct linux_compat_sysinfo*) arg.a0.p;
 
-	Warning("sysinfo() not implemented yet");
-	throw ENOSYS;
+	/* glibc's get_phys_pages() and get_avphys_pages() use this. */
+
+	const HostInfo& hi = GetHostInfo();
+	memset(sysinfo, 0, sizeof(*sysinfo));
+
+	time_t boot = GetHostBootTime();
+	if (boot)
+		sysinfo->uptime = time(NULL) - boot;
+	sysinfo->totalram = hi.PhysicalPages;
+	sysinfo->freeram = GetHostFreePages();
+	sysinfo->procs = 1;
+	sysinfo->mem_unit = hi.PageSize;
+	return 0;
 }
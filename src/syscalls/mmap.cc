@@ -7,8 +7,10 @@
 #include "syscalls.h"
 #include "filesystem/RealFD.h"
 #include "syscalls/mmap.h"
+#include "syscalls/memory.h"
 #include "MemOp.h"
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <map>
 #include <bitset>
 #include <algorithm>
@@ -18,6 +20,7 @@
 using std::map;
 using std::bitset;
 using std::min;
+using std::max;
 
 /* Linux wants to be able to map files to 4kB page boundaries when loading
  * executables. Alas, Interix can't do that --- it will only let us map stuff
@@ -37,6 +40,69 @@ static const u32 RANGE_TOP    = 0x80000000;
 
 static const u32 BLOCK_COUNT = (RANGE_TOP - RANGE_BOTTOM) / BLOCK_SIZE;
 
+/* Locking. Blocks are divided between a number of stripes, each with its
+ * own lock, and an operation locks all the stripes that its address range
+ * touches (always in ascending order). Operations on different parts of the
+ * address space can then run in parallel.
+ *
+ * The bookkeeping (mapping records, shared sections and statistics) has a
+ * separate lock, which is only ever held briefly and is always taken after
+ * any stripe locks. Nothing in the BlockStore may be called while holding
+ * it.
+ */
+
+class StripeLock : public Mutex
+{
+public:
+	StripeLock():
+		Mutex("mmap stripe")
+	{
+	}
+};
+
+static const u32 LOCK_STRIPES = 32;
+static StripeLock stripelocks[LOCK_STRIPES];
+static Mutex maplock("mmap bookkeeping");
+
+/* Finding a free address range for a non-fixed mapping and then filling it
+ * in has to be atomic with respect to other non-fixed mappings. */
+static Mutex alloclock("mmap allocation");
+
+class RangeLock
+{
+public:
+	RangeLock(u32 address, u32 length):
+		_stripes(0)
+	{
+		if (length == 0)
+			return;
+
+		u32 first = address / BLOCK_SIZE;
+		u32 last = (u32) (((u64) address + length - 1) / BLOCK_SIZE);
+		if ((last - first) >= LOCK_STRIPES)
+			_stripes = ~0;
+		else
+		{
+			for (u32 b = first; b <= last; b++)
+				_stripes |= 1U << (b % LOCK_STRIPES);
+		}
+
+		for (u32 i = 0; i < LOCK_STRIPES; i++)
+			if (_stripes & (1U << i))
+				stripelocks[i].Lock();
+	}
+
+	~RangeLock()
+	{
+		for (u32 i = LOCK_STRIPES; i > 0; i--)
+			if (_stripes & (1U << (i-1)))
+				stripelocks[i-1].Unlock();
+	}
+
+private:
+	u32 _stripes;
+};
+
 class Block
 {
 public:
@@ -113,6 +179,7 @@ public:
 			bool shared, bool w, bool x):
 		Block(address),
 		_length(length),
+		_realfd(realfd),
 		_writeable(false)
 	{
 		int flags = MAP_FIXED;
@@ -148,6 +215,11 @@ public:
 		return _length;
 	}
 
+	int GetRealFD() const
+	{
+		return _realfd;
+	}
+
 	void Msync(size_t length, int flags)
 	{
 		if (!_writeable)
@@ -157,13 +229,18 @@ public:
 
 private:
 	size_t _length;
+	int _realfd;
 	bool _writeable : 1;
 };
 
 class BlockStore
 {
 public:
-	BlockStore()
+	BlockStore():
+		_fragmented(0),
+		_mapped(0),
+		_committed(0),
+		_peakcommitted(0)
 	{
 		memset(_blocks, 0, sizeof(_blocks));
 	}
@@ -175,11 +252,61 @@ public:
 
 	void Reset()
 	{
+		RangeLock locked(RANGE_BOTTOM, RANGE_TOP - RANGE_BOTTOM);
 		for (u32 block = 0; block < BLOCK_COUNT; block++)
+			Replace(_blocks[block], NULL);
+	}
+
+	/* All block creation and destruction goes through here, so that we can
+	 * keep track of how much host memory the guest is actually using.
+	 */
+	void Replace(Block*& block, Block* newblock)
+	{
+		Block* oldblock = block;
+		block = newblock;
+
 		{
-			delete _blocks[block];
-			_blocks[block] = NULL;
+			RAIILock locked(maplock);
+
+			if (oldblock)
+			{
+				if (dynamic_cast<MappedBlock*>(oldblock))
+					_mapped--;
+				else
+					_fragmented--;
+				_committed -= oldblock->GetLength();
+			}
+
+			if (newblock)
+			{
+				if (dynamic_cast<MappedBlock*>(newblock))
+					_mapped++;
+				else
+					_fragmented++;
+				_committed += newblock->GetLength();
+				_peakcommitted = max(_peakcommitted, _committed);
+			}
 		}
+
+		delete oldblock;
+	}
+
+	u32 GetFragmentedBlocks() const { return _fragmented; }
+	u32 GetMappedBlocks() const { return _mapped; }
+	u32 GetCommitted() const { return _committed; }
+	u32 GetPeakCommitted() const { return _peakcommitted; }
+
+	u32 GetUsedPages() const
+	{
+		RangeLock locked(RANGE_BOTTOM, RANGE_TOP - RANGE_BOTTOM);
+		u32 pages = 0;
+		for (u32 block = 0; block < BLOCK_COUNT; block++)
+		{
+			FragmentedBlock* fb = dynamic_cast<FragmentedBlock*>(_blocks[block]);
+			if (fb)
+				pages += fb->Pages().count();
+		}
+		return pages;
 	}
 
 	Block*& GetBlock(u8* address)
@@ -213,13 +340,12 @@ public:
 						x ? 'y' : 'n');
 #endif
 				Block*& block = GetBlock(address + i);
-				if (block)
-					delete block;
+				Replace(block, NULL);
 				u32 bl = length - i;
 				if (bl > 0x10000)
 					bl = 0x10000;
-				block = new MappedBlock(address + i, realfd, offset + i, bl,
-						shared, w, x);
+				Replace(block, new MappedBlock(address + i, realfd, offset + i, bl,
+						shared, w, x));
 			}
 		}
 		catch (int e)
@@ -230,6 +356,27 @@ public:
 		}
 	}
 
+	/* Maps the file in again over any blocks in the range which are still
+	 * mapped from it; anything that has since been unmapped or replaced is
+	 * left alone. address must be 64kB-aligned. */
+	void Remap(u8* address, u32 length, int realfd, bool w, bool x)
+	{
+		assert(MemOp::Aligned<BLOCK_SIZE>(address));
+
+		for (u32 i = 0; i < length; i += BLOCK_SIZE)
+		{
+			Block*& block = GetBlock(address + i);
+			MappedBlock* mb = dynamic_cast<MappedBlock*>(block);
+			if (!mb || (mb->GetRealFD() != realfd))
+				continue;
+
+			u32 bl = mb->GetLength();
+			Replace(block, NULL);
+			Replace(block, new MappedBlock(address + i, realfd, i, bl,
+					true, w, x));
+		}
+	}
+
 	/* address must be 64kB-aligned. */
 	bitset<16>& GetPageMap(u8* address)
 	{
@@ -239,7 +386,7 @@ public:
 		if (!block)
 		{
 			/* No block here --- create one! */
-			block = new FragmentedBlock(address);
+			Replace(block, new FragmentedBlock(address));
 		}
 
 		MappedBlock* mb = dynamic_cast<MappedBlock*>(block);
@@ -258,9 +405,9 @@ public:
 			u8 copybuffer[length];
 			memcpy(copybuffer, address, length);
 
-			delete block;
+			Replace(block, NULL);
 			FragmentedBlock* fb = new FragmentedBlock(address);
-			block = fb;
+			Replace(block, fb);
 
 			memcpy(address, copybuffer, length);
 			fb->Pages().set();
@@ -271,14 +418,40 @@ public:
 		return fb->Pages();
 	}
 
+	/* True if any page from page onwards in the block at address is used
+	 * by a private mapping. address must be 64kB-aligned. */
+	bool PagesInUse(u8* address, u32 page)
+	{
+		assert(MemOp::Aligned<BLOCK_SIZE>(address));
+
+		FragmentedBlock* fb = dynamic_cast<FragmentedBlock*>(GetBlock(address));
+		if (!fb)
+			return false;
+		for (; page < 16; page++)
+			if (fb->Pages()[page])
+				return true;
+		return false;
+	}
+
+	/* Unmaps the block at address if it's still mapped from a file, but
+	 * leaves it alone if it's since been made private. address must be
+	 * 64kB-aligned. */
+	void UnmapIfMapped(u8* address)
+	{
+		assert(MemOp::Aligned<BLOCK_SIZE>(address));
+
+		Block*& block = GetBlock(address);
+		if (dynamic_cast<MappedBlock*>(block))
+			Replace(block, NULL);
+	}
+
 	/* address must be 64kB-aligned */
 	void Unmap(u8* address)
 	{
 		assert(MemOp::Aligned<BLOCK_SIZE>(address));
 
 		Block*& block = GetBlock(address);
-		delete block;
-		block = NULL;
+		Replace(block, NULL);
 	}
 
 	/* address, length must be 64kB-aligned */
@@ -329,12 +502,354 @@ public:
 
 private:
 	Block* _blocks[BLOCK_COUNT];
+	u32 _fragmented;
+	u32 _mapped;
+	u32 _committed;
+	u32 _peakcommitted;
 };
 static BlockStore blockstore;
 
+/* The BlockStore only knows about 64kB blocks, which is far too coarse to
+ * tell the user anything useful. So we also keep a record of every mapping
+ * the guest has asked for, at page granularity, along with what's behind
+ * it. This is used for /proc/self/maps and the memory statistics.
+ */
+
+typedef map<u32, MemoryMapping> Mappings;
+static Mappings mappings;
+static u32 vmsize = 0;
+static u32 vmpeak = 0;
+
+/* Removes start..end from the mapping records, trimming or splitting any
+ * mappings which straddle the boundaries. */
+static void forget_mappings(u32 start, u32 end)
+{
+	Mappings::iterator i = mappings.lower_bound(start);
+	if (i != mappings.begin())
+	{
+		Mappings::iterator p = i;
+		p--;
+		if (p->second.end > start)
+			i = p;
+	}
+
+	while ((i != mappings.end()) && (i->second.start < end))
+	{
+		MemoryMapping m = i->second;
+		mappings.erase(i++);
+		vmsize -= m.end - m.start;
+
+		if (m.start < start)
+		{
+			MemoryMapping left = m;
+			left.end = start;
+			mappings[left.start] = left;
+			vmsize += left.end - left.start;
+		}
+
+		if (m.end > end)
+		{
+			MemoryMapping right = m;
+			right.start = end;
+			if (!(right.flags & LINUX_MAP_ANONYMOUS))
+				right.offset += end - m.start;
+			mappings[right.start] = right;
+			vmsize += right.end - right.start;
+		}
+	}
+}
+
+/* True if the guest has anything mapped in start..end. Call with maplock
+ * held. */
+static bool is_mapped(u32 start, u32 end)
+{
+	Mappings::const_iterator i = mappings.lower_bound(start);
+	if (i != mappings.begin())
+	{
+		Mappings::const_iterator p = i;
+		p--;
+		if (p->second.end > start)
+			return true;
+	}
+	return (i != mappings.end()) && (i->second.start < end);
+}
+
+static void record_mapping(u32 start, u32 len, u32 prot, u32 flags,
+		const string& path, u32 offset)
+{
+	MemoryMapping m;
+	m.start = start;
+	m.end = MemOp::AlignUp<PAGE_SIZE>(start + len);
+	m.prot = prot;
+	m.flags = flags;
+	m.path = path;
+	m.offset = (flags & LINUX_MAP_ANONYMOUS) ? 0 : offset;
+
+	forget_mappings(m.start, m.end);
+	mappings[m.start] = m;
+	vmsize += m.end - m.start;
+	vmpeak = max(vmpeak, vmsize);
+}
+
+static void protect_mappings(u32 start, u32 end, u32 prot)
+{
+	Mappings::iterator i = mappings.lower_bound(start);
+	if (i != mappings.begin())
+	{
+		Mappings::iterator p = i;
+		p--;
+		if (p->second.end > start)
+			i = p;
+	}
+
+	deque<MemoryMapping> changed;
+	while ((i != mappings.end()) && (i->second.start < end))
+	{
+		MemoryMapping m = i->second;
+		m.start = max(m.start, start);
+		if (!(m.flags & LINUX_MAP_ANONYMOUS))
+			m.offset += m.start - i->second.start;
+		m.end = min(m.end, end);
+		m.prot = prot;
+		changed.push_back(m);
+		i++;
+	}
+
+	for (deque<MemoryMapping>::const_iterator c = changed.begin();
+			c != changed.end(); c++)
+		record_mapping(c->start, c->end - c->start, c->prot, c->flags,
+				c->path, c->offset);
+}
+
+void GetMemoryMappings(deque<MemoryMapping>& result)
+{
+	RAIILock locked(maplock);
+
+	result.clear();
+	for (Mappings::const_iterator i = mappings.begin(); i != mappings.end(); i++)
+		result.push_back(i->second);
+}
+
+void GetMemoryStats(MemoryStats& ms)
+{
+	u32 brksize = GetBrkSize();
+	ms.UsedPages = blockstore.GetUsedPages();
+
+	RAIILock locked(maplock);
+
+	ms.VmSize = vmsize + brksize;
+	ms.VmPeak = max(vmpeak + brksize, ms.VmSize);
+	ms.VmRSS = blockstore.GetCommitted() + brksize;
+	ms.VmHWM = max(blockstore.GetPeakCommitted() + brksize, ms.VmRSS);
+	ms.Mappings = mappings.size();
+	ms.FragmentedBlocks = blockstore.GetFragmentedBlocks();
+	ms.MappedBlocks = blockstore.GetMappedBlocks();
+}
+
+string GetProcMaps()
+{
+	deque<MemoryMapping> m;
+	GetMemoryMappings(m);
+
+	string s;
+	for (deque<MemoryMapping>::const_iterator i = m.begin(); i != m.end(); i++)
+	{
+		s += cprintf("%08x-%08x %c%c%c%c %08x 00:00 0",
+				i->start, i->end,
+				(i->prot & LINUX_PROT_READ) ? 'r' : '-',
+				(i->prot & LINUX_PROT_WRITE) ? 'w' : '-',
+				(i->prot & LINUX_PROT_EXEC) ? 'x' : '-',
+				(i->flags & LINUX_MAP_SHARED) ? 's' : 'p',
+				i->offset);
+		if (!i->path.empty())
+			s += string(18, ' ') + i->path;
+		s += '\n';
+	}
+
+	u32 brkstart, brkend;
+	GetBrkRange(brkstart, brkend);
+	if (brkend > brkstart)
+		s += cprintf("%08x-%08x rw-p 00000000 00:00 0                  [heap]\n",
+				brkstart, MemOp::AlignUp<PAGE_SIZE>(brkend));
+	return s;
+}
+
+/* Called at exit if --memstats is set. */
+void ReportMemoryStats()
+{
+	MemoryStats ms;
+	GetMemoryStats(ms);
+
+	log("memstats: VmPeak %u kB, VmSize %u kB, VmHWM %u kB, VmRSS %u kB",
+			ms.VmPeak / 1024, ms.VmSize / 1024,
+			ms.VmHWM / 1024, ms.VmRSS / 1024);
+	log("memstats: %u mappings, %u fragmented blocks (%u pages in use), "
+			"%u mapped blocks",
+			ms.Mappings, ms.FragmentedBlocks, ms.UsedPages, ms.MappedBlocks);
+
+	string maps = GetProcMaps();
+	write(2, maps.data(), maps.size());
+}
+
+/* Shared anonymous memory can't live in FragmentedBlocks, because those are
+ * private. Instead each such mapping gets a section of its own: an unlinked
+ * temporary file which is mapped MAP_SHARED, and so stays shared with any
+ * children we fork(). We keep the fd so that the child can map the section
+ * in again at the same address (see RemapSharedAfterFork()).
+ *
+ * Sections occupy whole 64kB blocks, but only the first length bytes are
+ * the guest's; the rest of the last block is padding, which the guest can't
+ * see and which goes when the section does.
+ */
+
+struct SharedSection
+{
+	int fd;
+	u32 length;             // guest-visible length, page-aligned
+	bool w : 1;
+	bool x : 1;
+	dev_t dev;
+	ino_t ino;
+};
+
+typedef map<u32, SharedSection> SharedSections;
+static SharedSections sharedsections;
+
+static void close_shared_section(SharedSections::iterator i)
+{
+	close(i->second.fd);
+	sharedsections.erase(i);
+}
+
+/* Forgets any sections which lie entirely inside start..end. Sections which
+ * are only partially unmapped are kept until the rest goes. Returns the end
+ * of the last block used by any of them, or 0. Call with maplock held. */
+static u32 forget_shared_sections(u32 start, u32 end)
+{
+	u32 blocksend = 0;
+	SharedSections::iterator i = sharedsections.lower_bound(start);
+	while ((i != sharedsections.end()) && (i->first < end))
+	{
+		u32 sectionend = i->first + i->second.length;
+		if (sectionend <= end)
+		{
+			blocksend = max(blocksend, MemOp::AlignUp<BLOCK_SIZE>(sectionend));
+			close_shared_section(i++);
+		}
+		else
+			i++;
+	}
+	return blocksend;
+}
+
+/* Returns false, having done nothing, if the padding at the end of the
+ * section would land on top of something the guest has mapped. address
+ * must be 64kB-aligned. */
+static bool map_shared_section(u8* address, u32 length, bool w, bool x)
+{
+	u32 pagelength = MemOp::AlignUp<PAGE_SIZE>(length);
+	u32 alignedlength = MemOp::AlignUp<BLOCK_SIZE>(length);
+
+	if (pagelength != alignedlength)
+	{
+		u8* lastblock = address + alignedlength - BLOCK_SIZE;
+		u32 firstpage = (address + pagelength - lastblock) / PAGE_SIZE;
+		if (blockstore.PagesInUse(lastblock, firstpage))
+			return false;
+
+		RAIILock locked(maplock);
+		if (is_mapped((u32) address + pagelength, (u32) address + alignedlength))
+			return false;
+	}
+
+	char filename[] = "/tmp/lbw-shared.XXXXXX";
+	int fd = mkstemp(filename);
+	if (fd == -1)
+		throw errno;
+	unlink(filename);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	struct stat st;
+	if ((ftruncate(fd, alignedlength) == -1) || (fstat(fd, &st) == -1))
+	{
+		int e = errno;
+		close(fd);
+		throw e;
+	}
+
+	try
+	{
+		blockstore.Map(address, alignedlength, fd, 0, true, w, x);
+	}
+	catch (int e)
+	{
+		close(fd);
+		throw e;
+	}
+
+	RAIILock locked(maplock);
+	forget_shared_sections((u32) address, (u32) address + alignedlength);
+
+	SharedSection& ss = sharedsections[(u32) address];
+	ss.fd = fd;
+	ss.length = pagelength;
+	ss.w = w;
+	ss.x = x;
+	ss.dev = st.st_dev;
+	ss.ino = st.st_ino;
+	return true;
+}
+
+/* Called in the child after fork(). The section mappings ought to have been
+ * inherited, but we map them in again anyway so that we know for certain
+ * that the child is looking at the shared section and not a copy. */
+void RemapSharedAfterFork()
+{
+	SharedSections sections;
+	{
+		RAIILock locked(maplock);
+		sections = sharedsections;
+	}
+
+	for (SharedSections::iterator i = sections.begin();
+			i != sections.end(); i++)
+	{
+		SharedSection& ss = i->second;
+
+		/* Make sure the guest hasn't dup2()ed something over our fd. */
+
+		struct stat st;
+		if ((fstat(ss.fd, &st) == -1) ||
+				(st.st_dev != ss.dev) || (st.st_ino != ss.ino))
+		{
+			Warning("shared section at %08x has lost its backing file; "
+					"relying on inherited mapping", i->first);
+			continue;
+		}
+
+		try
+		{
+			u32 alignedlength = MemOp::AlignUp<BLOCK_SIZE>(ss.length);
+			RangeLock locked(i->first, alignedlength);
+			blockstore.Remap((u8*) i->first, alignedlength, ss.fd, ss.w, ss.x);
+		}
+		catch (int e)
+		{
+			Warning("unable to remap shared section at %08x: %d", i->first, e);
+		}
+	}
+}
+
 void UnmapAll()
 {
 	blockstore.Reset();
+
+	RAIILock locked(maplock);
+	mappings.clear();
+	vmsize = 0;
+
+	while (!sharedsections.empty())
+		close_shared_section(sharedsections.begin());
 }
 
 struct linux_mmap_arg_struct
@@ -347,63 +862,52 @@ struct linux_mmap_arg_struct
 	u32 offset;
 };
 
-u32 do_mmap(u8* addr, u32 len, u32 prot, u32 flags, int fd, u32 offset)
+static string get_mapped_path(int fd)
 {
-	RAIILock locked;
-
-#if defined VERBOSE
-	log("mmap(%p, %p, %p, %p, %d, %p)",
-			addr, len, prot, flags, fd, offset);
-#endif
-
-	if (!MemOp::Aligned<PAGE_SIZE>(addr))
-		throw EINVAL;
-	if (!MemOp::Aligned<PAGE_SIZE>(offset))
-		throw EINVAL;
-
-	if (prot & LINUX_PROT_SEM)
+	try
 	{
-		log("mmap(): no support for PROT_SEM, ignoring");
+		Ref<FD> fdo = FD::Get(fd);
+		return fdo->GetPath();
+	}
+	catch (int e)
+	{
+		return "";
 	}
+}
+
+/* Fills in a range of the address space; addr is now known. */
+static u32 map_range(u8* addr, u32 len, u32 prot, u32 flags, int fd,
+		u32 offset, const char* path)
+{
+	RangeLock locked((u32) addr, len);
 
 	bool w = prot & LINUX_PROT_WRITE;
 	bool x = prot & LINUX_PROT_EXEC;
 	bool shared = flags & LINUX_MAP_SHARED;
 
-	if (!(flags & LINUX_MAP_FIXED))
-	{
-		/* This is a very nasty hack to find an unused memory area to
-		 * map the block into. Rather than keep our own range allocator,
-		 * we abuse Interix'. This also has the advantage that we
-		 * interoperate nicely with Interix' mappings.
-		 */
-
-		void* result = mmap(addr, len,
-				PROT_READ | PROT_WRITE | PROT_EXEC,
-				MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
-				-1, 0);
-		if (result == MAP_FAILED)
-			throw ENOMEM;
-
-#if defined VERBOSE
-		log("nonfixed map going to %08x+%08x (app preferred %08x)", result, len, addr);
-#endif
-		addr = (u8*) result;
-		int i = munmap(result, len);
-		assert(i == 0);
-	}
-
 	if (flags & LINUX_MAP_ANONYMOUS)
 	{
 #if defined VERBOSE
 		log("anonymous");
 #endif
-		/* Anonymous areas are all fragmented. */
+		/* Shared anonymous areas get a section of their own, if there's
+		 * room for one. */
 
-		for (u32 i = 0; i < len; i += PAGE_SIZE)
+		if (!shared || !MemOp::Aligned<BLOCK_SIZE>(addr) ||
+				!map_shared_section(addr, len, w, x))
 		{
-			blockstore.UsePage(addr + i);
-			memset(addr + i, 0, PAGE_SIZE);
+			/* Private anonymous areas are all fragmented. */
+
+			if (shared)
+				Warning("shared anonymous mapping at %p+%08x can't have a "
+						"section and will not be shared with children",
+						addr, len);
+
+			for (u32 i = 0; i < len; i += PAGE_SIZE)
+			{
+				blockstore.UsePage(addr + i);
+				memset(addr + i, 0, PAGE_SIZE);
+			}
 		}
 	}
 	else
@@ -451,11 +955,87 @@ u32 do_mmap(u8* addr, u32 len, u32 prot, u32 flags, int fd, u32 offset)
 		}
 	}
 
+	string mappedpath;
+	if (path)
+		mappedpath = path;
+	else if (!(flags & LINUX_MAP_ANONYMOUS))
+		mappedpath = get_mapped_path(fd);
+
+	RAIILock maplocked(maplock);
+	record_mapping((u32) addr, len, prot, flags, mappedpath, offset);
 	return (u32) addr;
 }
 
+/* path, if given, is used to label the mapping instead of looking up fd. */
+u32 do_mmap(u8* addr, u32 len, u32 prot, u32 flags, int fd, u32 offset,
+		const char* path)
+{
+#if defined VERBOSE
+	log("mmap(%p, %p, %p, %p, %d, %p)",
+			addr, len, prot, flags, fd, offset);
+#endif
+
+	if (!MemOp::Aligned<PAGE_SIZE>(addr))
+		throw EINVAL;
+	if (!MemOp::Aligned<PAGE_SIZE>(offset))
+		throw EINVAL;
+
+	if (prot & LINUX_PROT_SEM)
+	{
+		log("mmap(): no support for PROT_SEM, ignoring");
+	}
+
+	if (flags & LINUX_MAP_FIXED)
+		return map_range(addr, len, prot, flags, fd, offset, path);
+
+	/* This is a very nasty hack to find an unused memory area to
+	 * map the block into. Rather than keep our own range allocator,
+	 * we abuse Interix'. This also has the advantage that we
+	 * interoperate nicely with Interix' mappings.
+	 */
+
+	RAIILock locked(alloclock);
+
+	void* result = mmap(addr, len,
+			PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
+			-1, 0);
+	if (result == MAP_FAILED)
+		throw ENOMEM;
+
+#if defined VERBOSE
+	log("nonfixed map going to %08x+%08x (app preferred %08x)", result, len, addr);
+#endif
+	addr = (u8*) result;
+	int i = munmap(result, len);
+	assert(i == 0);
+
+	return map_range(addr, len, prot, flags, fd, offset, path);
+}
+
 void do_munmap(u8* addr, u32 len)
 {
+	RangeLock locked((u32) addr, len);
+
+	u32 end = MemOp::AlignUp<PAGE_SIZE>((u32) addr + len);
+	u32 sectionsend;
+	{
+		RAIILock maplocked(maplock);
+		forget_mappings((u32) addr, end);
+		sectionsend = forget_shared_sections((u32) addr, end);
+	}
+
+	/* If a section has gone, so does the padding at its end, along with
+	 * the rest of the block. Going page by page would make that block
+	 * private and keep it forever. */
+
+	if (sectionsend > end)
+	{
+		u32 lastblock = MemOp::Align<BLOCK_SIZE>(end);
+		blockstore.UnmapIfMapped((u8*) lastblock);
+		len = max(lastblock, (u32) addr) - (u32) addr;
+	}
+
 	if (MemOp::Aligned<BLOCK_SIZE>(addr))
 	{
 #if defined VERBOSE
@@ -517,6 +1097,12 @@ SYSCALL(sys32_mprotect)
 	log("mprotect(%08x, %08x, %08x)", addr, len, prot);
 #endif
 	//return SysError(result);
+
+	/* We don't actually change the protection, but we do remember what
+	 * the guest asked for so that /proc/self/maps looks right.
+	 */
+	RAIILock locked(maplock);
+	protect_mappings(addr, MemOp::AlignUp<PAGE_SIZE>(addr + len), prot);
 	return 0;
 }
 
@@ -540,6 +1126,8 @@ SYSCALL(sys_msync)
 	length += MemOp::Offset<0x10000>(addr);
 	addr = MemOp::Align<0x10000>(addr);
 
+	RangeLock locked((u32) addr, length);
+
 	for (size_t i = 0; i < length; i += 0x10000)
 	{
 		Block*& b = blockstore.GetBlock(addr + i);
@@ -589,6 +1177,8 @@ void MakeWriteable(u8* addr, u32 length)
 	u8* topaddr = MemOp::AlignUp<0x10000>(addr + length - 1);
 	addr = MemOp::Align<0x10000>(addr);
 
+	RangeLock locked((u32) addr, topaddr - addr + 1);
+
 	blockstore.GetPageMap(addr);
 	if (topaddr != addr)
 		blockstore.GetPageMap(topaddr);
@@ -22,9 +22,42 @@
 #define LINUX_MS_INVALIDATE   2
 #define LINUX_MS_SYNC         4
 
-extern u32 do_mmap(u8* addr, u32 len, u32 prot, u32 flags, int fd, u32 offset);
+#include <deque>
+
+using std::deque;
+
+struct MemoryMapping
+{
+	u32 start;
+	u32 end;
+	u32 prot;          // LINUX_PROT_*
+	u32 flags;         // LINUX_MAP_*
+	u32 offset;
+	string path;       // backing file, or empty
+};
+
+struct MemoryStats
+{
+	u32 VmPeak;
+	u32 VmSize;
+	u32 VmHWM;
+	u32 VmRSS;
+	u32 Mappings;
+	u32 FragmentedBlocks;
+	u32 MappedBlocks;
+	u32 UsedPages;
+};
+
+extern u32 do_mmap(u8* addr, u32 len, u32 prot, u32 flags, int fd, u32 offset,
+		const char* path = NULL);
 extern void do_munmap(u8* addr, u32 len);
 extern void UnmapAll();
 extern void MakeWriteable(u8* addr, u32 len);
+extern void RemapSharedAfterFork();
+
+extern void GetMemoryMappings(deque<MemoryMapping>& result);
+extern void GetMemoryStats(MemoryStats& ms);
+extern string GetProcMaps();
+extern void ReportMemoryStats();
 
 #endif
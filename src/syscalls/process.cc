@@ -5,6 +5,7 @@
 
 #include "globals.h"
 #include "syscalls.h"
+#include "syscalls/thread.h"
 #include <sys/resource.h>
 #include <sys/wait.h>
 
@@ -58,11 +59,17 @@ static gid_t high2lowgid(gid_t gid)
 
 SYSCALL(sys_exit)
 {
-	exit(arg.a0.s);
+	/* This only terminates the calling thread; the process goes away when
+	 * the last thread does. */
+
+	if (ExitGuestThread())
+		exit(arg.a0.s);
+	pthread_exit(NULL);
 }
 
 SYSCALL(sys_exit_group)
 {
+	ExitAllGuestThreads();
 	exit(arg.a0.s);
 }
 
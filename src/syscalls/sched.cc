@@ -0,0 +1,244 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include "syscalls.h"
+#include "syscalls/thread.h"
+#include "hostinfo.h"
+
+#define LINUX_SCHED_OTHER             0
+#define LINUX_SCHED_FIFO              1
+#define LINUX_SCHED_RR                2
+#define LINUX_SCHED_BATCH             3
+#define LINUX_SCHED_IDLE              5
+
+struct linux_sched_param
+{
+	s32 sched_priority;
+};
+
+struct compat_timespec
+{
+	s32 tv_sec;
+	s32 tv_nsec;
+};
+
+/* The scheduling state of a thread is kept in its GuestThread, and also
+ * pushed down to the host thread as best we can. We can only touch the
+ * host state of the calling thread, so anything else gets the defaults.
+ */
+
+static GuestThread* target_thread(pid_t pid)
+{
+	GuestThread& gt = GetGuestThread();
+	if ((pid == 0) || (pid == gt.tid))
+		return &gt;
+	if (pid < 0)
+		throw EINVAL;
+	return NULL;
+}
+
+static bool is_realtime(int policy)
+{
+	return (policy == LINUX_SCHED_FIFO) || (policy == LINUX_SCHED_RR);
+}
+
+static int priority_max(int policy)
+{
+	switch (policy)
+	{
+		case LINUX_SCHED_FIFO:
+		case LINUX_SCHED_RR:
+			return 99;
+
+		case LINUX_SCHED_OTHER:
+		case LINUX_SCHED_BATCH:
+		case LINUX_SCHED_IDLE:
+			return 0;
+	}
+	throw EINVAL;
+}
+
+static int priority_min(int policy)
+{
+	return is_realtime(policy) ? 1 : priority_max(policy);
+}
+
+/* NT thread priorities only go from -2 to 2 relative to the process, so
+ * this is very approximate. */
+static int host_priority(int policy, int priority)
+{
+	if (policy == LINUX_SCHED_IDLE)
+		return -2;
+	if (!is_realtime(policy))
+		return 0;
+	return (priority < 50) ? 1 : 2;
+}
+
+/* Pushes a thread's scheduling state down to the host. Must be called on
+ * the thread itself. */
+void ApplyGuestThreadScheduling(GuestThread& gt)
+{
+	if (gt.affinity)
+		HostSetThreadAffinity(gt.affinity);
+	if (gt.sched_policy != LINUX_SCHED_OTHER)
+		HostSetThreadPriority(host_priority(gt.sched_policy, gt.sched_priority));
+}
+
+static void set_scheduler(pid_t pid, int policy, int priority)
+{
+	if ((priority < priority_min(policy)) || (priority > priority_max(policy)))
+		throw EINVAL;
+
+	/* Real-time scheduling needs privilege. */
+
+	if (is_realtime(policy) && !Options.FakeRoot)
+		throw EPERM;
+
+	GuestThread* gt = target_thread(pid);
+	if (!gt)
+	{
+		Warning("can't change scheduling of thread %d", pid);
+		return;
+	}
+
+	int e = HostSetThreadPriority(host_priority(policy, priority));
+	if (e && is_realtime(policy))
+		throw e;
+
+	gt->sched_policy = policy;
+	gt->sched_priority = priority;
+}
+
+SYSCALL(sys_sched_setparam)
+{
+	pid_t pid = arg.a0.s;
+	struct linux_sched_param& param = *(struct linux_sched_param*) arg.a1.p;
+
+	GuestThread* gt = target_thread(pid);
+	int policy = gt ? gt->sched_policy : LINUX_SCHED_OTHER;
+	set_scheduler(pid, policy, param.sched_priority);
+	return 0;
+}
+
+SYSCALL(sys_sched_getparam)
+{
+	pid_t pid = arg.a0.s;
+	struct linux_sched_param& param = *(struct linux_sched_param*) arg.a1.p;
+
+	GuestThread* gt = target_thread(pid);
+	param.sched_priority = gt ? gt->sched_priority : 0;
+	return 0;
+}
+
+SYSCALL(sys_sched_setscheduler)
+{
+	pid_t pid = arg.a0.s;
+	int policy = arg.a1.s;
+	struct linux_sched_param& param = *(struct linux_sched_param*) arg.a2.p;
+
+	/* SCHED_RESET_ON_FORK is meaningless here. */
+	policy &= ~0x40000000;
+
+	set_scheduler(pid, policy, param.sched_priority);
+	return 0;
+}
+
+SYSCALL(sys_sched_getscheduler)
+{
+	pid_t pid = arg.a0.s;
+
+	GuestThread* gt = target_thread(pid);
+	return gt ? gt->sched_policy : LINUX_SCHED_OTHER;
+}
+
+SYSCALL(sys_sched_yield)
+{
+	HostYield();
+	return 0;
+}
+
+SYSCALL(sys_sched_get_priority_max)
+{
+	return priority_max(arg.a0.s);
+}
+
+SYSCALL(sys_sched_get_priority_min)
+{
+	return priority_min(arg.a0.s);
+}
+
+SYSCALL(sys32_sched_rr_get_interval)
+{
+	pid_t pid = arg.a0.s;
+	struct compat_timespec& ts = *(struct compat_timespec*) arg.a1.p;
+
+	target_thread(pid);
+
+	/* The NT quantum varies, but this is the traditional Linux value. */
+	ts.tv_sec = 0;
+	ts.tv_nsec = 100000000;
+	return 0;
+}
+
+/* CPU masks are only ever one word, as 32-bit NT can't have more than 32
+ * processors. */
+
+SYSCALL(compat_sys_sched_setaffinity)
+{
+	pid_t pid = arg.a0.s;
+	u32 len = arg.a1.u;
+	u32* mask = (u32*) arg.a2.p;
+
+	if (len < sizeof(u32))
+		throw EINVAL;
+
+	u32 m = *mask & GetHostInfo().ProcessorMask;
+	if (!m)
+		throw EINVAL;
+
+	GuestThread* gt = target_thread(pid);
+	if (!gt)
+	{
+		Warning("can't change affinity of thread %d", pid);
+		return 0;
+	}
+
+	int e = HostSetThreadAffinity(m);
+	if (e)
+		throw e;
+	gt->affinity = m;
+	return 0;
+}
+
+SYSCALL(compat_sys_sched_getaffinity)
+{
+	pid_t pid = arg.a0.s;
+	u32 len = arg.a1.u;
+	u32* mask = (u32*) arg.a2.p;
+
+	if (len < sizeof(u32))
+		throw EINVAL;
+
+	GuestThread* gt = target_thread(pid);
+	u32 m = GetHostInfo().ProcessorMask;
+	if (gt && gt->affinity)
+		m = gt->affinity;
+
+	*mask = m;
+	return sizeof(u32);
+}
+
+SYSCALL(sys_getcpu)
+{
+	u32* cpu = (u32*) arg.a0.p;
+	u32* node = (u32*) arg.a1.p;
+
+	if (cpu)
+		*cpu = HostGetCPU();
+	if (node)
+		*node = 0;
+	return 0;
+}
@@ -7,110 +7,197 @@
 #include "syscalls.h"
 #include "filesystem/FD.h"
 #include "filesystem/VFS.h"
+#include "filesystem/EpollFD.h"
+#include "filesystem/FDSet.h"
+#include "filesystem/file.h"
+#include "syscalls/signals.h"
 #include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/fcntl.h>
+#include <sys/socket.h>
 #include <dirent.h>
 #include <poll.h>
 #include <map>
 
-#define LINUX_POLLIN          0x001           /* There is data to read.  */
-#define LINUX_POLLPRI         0x002           /* There is urgent data to read.  */
-#define LINUX_POLLOUT         0x004           /* Writing now will not block.  */
-#define LINUX_POLLRDNORM      0x040           /* Normal data may be read.  */
-#define LINUX_POLLRDBAND      0x080           /* Priority data may be read.  */
-#define LINUX_POLLWRNORM      0x100           /* Writing now will not block.  */
-#define LINUX_POLLWRBAND      0x200           /* Priority data may be written.  */
-#define LINUX_POLLMSG         0x400
-#define LINUX_POLLREMOVE      0x1000
-#define LINUX_POLLRDHUP       0x2000
-#define LINUX_POLLERR         0x008           /* Error condition.  */
-#define LINUX_POLLHUP         0x010           /* Hung up.  */
-#define LINUX_POLLNVAL        0x020           /* Invalid polling request.  */
-
-/* Interix supports poll... but only on /proc/%/ctl files. Bah.
+/* Interix supports poll... but only on /proc/%/ctl files. Bah. So this is
+ * built on select(), using growable fd sets so that it isn't limited to
+ * FD_SETSIZE. Descriptors that can answer for themselves, like files and
+ * the fake files in /proc, don't go to the host at all.
  * Luckily the struct pollfd structures are compatible.
+ * If sigwakefd is readable, a signal has arrived; see SignalWait.
  */
-SYSCALL(sys_poll)
+static int do_poll(struct pollfd* lp, unsigned int nfds, struct timeval* tv,
+		int sigwakefd)
 {
-	struct pollfd* lp = (struct pollfd*) arg.a0.p;
-	unsigned int nfds = arg.a1.u;
-	long timeout = arg.a2.s;
-
-	fd_set reads;
-	fd_set writes;
-	fd_set excepts;
+	FDSet reads;
+	FDSet writes;
+	FDSet excepts;
+	int maxfd = -1;
+	int ready = 0;
+	bool anyhost = false;
 
-	FD_ZERO(&reads);
-	FD_ZERO(&writes);
-	FD_ZERO(&excepts);
-
-	//log("poll (nfds=%d timeout=%ld)", nfds, timeout);
-	int maxfd = 0;
 	for (unsigned i = 0; i < nfds; i++)
 	{
-		int fd = lp[i].fd;
-		if (fd > maxfd)
-			maxfd = fd;
+		struct pollfd& p = lp[i];
+		p.revents = 0;
+		if (p.fd < 0)
+			continue;
 
-		short flags = lp[i].events;
-		if (flags & LINUX_POLLIN)
+		int revents;
+		try
 		{
-			//log("...interested in being readable");
-			FD_SET(fd, &reads);
+			Ref<FD> fdo = FD::Get(p.fd);
+			revents = fdo->Poll(p.events);
 		}
-		if (flags & LINUX_POLLOUT)
+		catch (int e)
 		{
-			//log("...interested in being writeable");
-			FD_SET(fd, &writes);
+			revents = LINUX_POLLNVAL;
 		}
-		if (flags & LINUX_POLLERR)
+
+		if (revents != -1)
 		{
-			//log("...interested in errors");
-			FD_SET(fd, &excepts);
+			p.revents = revents;
+			if (revents)
+				ready++;
+			continue;
 		}
 
-		lp[i].revents = 0;
+		anyhost = true;
+		if (p.fd > maxfd)
+			maxfd = p.fd;
+		if (p.events & (LINUX_POLLIN | LINUX_POLLRDNORM | LINUX_POLLRDHUP))
+			reads.Set(p.fd);
+		if (p.events & (LINUX_POLLOUT | LINUX_POLLWRNORM))
+			writes.Set(p.fd);
+		if (p.events & LINUX_POLLPRI)
+			excepts.Set(p.fd);
 	}
 
-	struct timeval tv;
-	tv.tv_sec = timeout / 1000;
-	tv.tv_usec = (timeout % 1000) * 1000;
+	/* If something's already ready, just check the rest without waiting.
+	 * If nothing needs the host at all, we're done (unless the caller is
+	 * using poll() to sleep). */
+
+	struct timeval zero = { 0, 0 };
+	if (ready)
+	{
+		if (!anyhost)
+			return ready;
+		tv = &zero;
+	}
 
-	int result = select(maxfd+1, &reads, &writes, &excepts,
-			(timeout == -1) ? NULL : &tv);
+	if (sigwakefd != -1)
+	{
+		reads.Set(sigwakefd);
+		if (sigwakefd > maxfd)
+			maxfd = sigwakefd;
+	}
+
+	int result = select(maxfd+1, reads.Get(), writes.Get(), excepts.Get(), tv);
 	if (result == -1)
 		throw errno;
 	if (result == 0)
-	{
-		//log("...timed out with no change");
-		return 0;
-	}
+		return ready;
+	if (sigwakefd != -1)
+		reads.Clear(sigwakefd);
 
 	for (unsigned i = 0; i < nfds; i++)
 	{
-		int fd = lp[i].fd;
+		struct pollfd& p = lp[i];
+		if ((p.fd < 0) || p.revents)
+			continue;
 
-		//log("realfd %d", realfd);
-		lp[i].revents = 0;
-		if (FD_ISSET(fd, &reads))
+		int revents = 0;
+		if (reads.IsSet(p.fd))
 		{
-			//log("...is readable");
-			lp[i].revents |= LINUX_POLLIN;
-		}
-		if (FD_ISSET(fd, &writes))
-		{
-			//log("...is writeable");
-			lp[i].revents |= LINUX_POLLOUT;
-		}
-		if (FD_ISSET(fd, &excepts))
-		{
-			//log("...is error");
-			lp[i].revents |= LINUX_POLLERR;
+			revents |= p.events & (LINUX_POLLIN | LINUX_POLLRDNORM);
+
+			try
+			{
+				Ref<FD> fdo = FD::Get(p.fd);
+				revents |= fdo->PollHangup(p.events);
+			}
+			catch (int e)
+			{
+				revents |= LINUX_POLLNVAL;
+			}
 		}
+		if (writes.IsSet(p.fd))
+			revents |= p.events & (LINUX_POLLOUT | LINUX_POLLWRNORM);
+		if (excepts.IsSet(p.fd))
+			revents |= LINUX_POLLPRI;
+
+		p.revents = revents;
+		if (revents)
+			ready++;
 	}
 
+	return ready;
+}
+
+SYSCALL(sys_poll)
+{
+	struct pollfd* lp = (struct pollfd*) arg.a0.p;
+	unsigned int nfds = arg.a1.u;
+	long timeout = arg.a2.s;
+
+	//log("poll (nfds=%d timeout=%ld)", nfds, timeout);
+
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	return do_poll(lp, nfds, (timeout < 0) ? NULL : &tv, -1);
+}
+
+/* --- select ------------------------------------------------------------- */
+
+/* The guest's fd_sets are copied into FDSets, rather than handed straight
+ * to the host, so that the signal wakeup pipe can be added. */
+static int do_select(int n, fd_set* in, fd_set* out, fd_set* ex,
+		struct timeval* tv, int sigwakefd)
+{
+	if (n < 0)
+		throw EINVAL;
+
+	FDSet reads;
+	FDSet writes;
+	FDSet excepts;
+	if (in)
+		reads.Load(in, n);
+	if (out)
+		writes.Load(out, n);
+	if (ex)
+		excepts.Load(ex, n);
+
+	int maxfd = n-1;
+	if (sigwakefd != -1)
+	{
+		reads.Set(sigwakefd);
+		if (sigwakefd > maxfd)
+			maxfd = sigwakefd;
+	}
+
+	int result = select(maxfd+1, reads.Get(), writes.Get(), excepts.Get(), tv);
+	if (result == -1)
+		throw errno;
+	if (sigwakefd != -1)
+		reads.Clear(sigwakefd);
+
+	if (result == 0)
+	{
+		reads.Zero();
+		writes.Zero();
+		excepts.Zero();
+	}
+
+	result = 0;
+	if (in)
+		result += reads.Store(in, n);
+	if (out)
+		result += writes.Store(out, n);
+	if (ex)
+		result += excepts.Store(ex, n);
 	return result;
 }
 
@@ -123,27 +210,225 @@ SYSCALL(compat_sys_select)
 	fd_set* excepts = (fd_set*) arg.a3.p;
 	struct timeval* tv = (struct timeval*) arg.a4.p;
 
-//	log("tv_sec = %ld tv_usec=%ld", tv->tv_sec, tv->tv_usec);
-	int result = select(size, reads, writes, excepts, tv);
-//	log("select returned %d", result);
-	if (result == -1)
-		throw errno;
+	return do_select(size, reads, writes, excepts, tv, -1);
+}
 
-	return result;
+/* --- Signal-safe variants ----------------------------------------------- */
+
+struct linux_compat_timespec
+{
+	s32 tv_sec;
+	s32 tv_nsec;
+};
+
+struct linux_compat_sigset_arg
+{
+	u32 ss;
+	u32 ss_len;
+};
+
+static int64_t now_us()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Rounds up, so that we never wake up early. Returns NULL (wait forever) if
+ * there's no timeout. */
+static struct timeval* timespec_to_timeval(const linux_compat_timespec* ts,
+		struct timeval& tv)
+{
+	if (!ts)
+		return NULL;
+	if ((ts->tv_sec < 0) || (ts->tv_nsec < 0) || (ts->tv_nsec >= 1000000000))
+		throw EINVAL;
+
+	tv.tv_sec = ts->tv_sec;
+	tv.tv_usec = (ts->tv_nsec + 999) / 1000;
+	if (tv.tv_usec == 1000000)
+	{
+		tv.tv_sec++;
+		tv.tv_usec = 0;
+	}
+	return &tv;
+}
+
+static int64_t deadline_us(const struct timeval* tv)
+{
+	if (!tv)
+		return 0;
+	return now_us() + (int64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* Like Linux, pselect6 and ppoll write back how much time was left. */
+static void update_timespec(linux_compat_timespec* ts, int64_t deadline)
+{
+	if (!ts)
+		return;
+
+	int64_t left = deadline - now_us();
+	if (left < 0)
+		left = 0;
+	ts->tv_sec = left / 1000000;
+	ts->tv_nsec = (left % 1000000) * 1000;
 }
 
 SYSCALL(compat_sys_pselect6)
 {
-	throw ENOSYS;
-#if 0
-	int fd = arg.a0.s;
-	fd_set* lreads = (fd_set*) arg.a1.p;
-	fd_set* lwrites = (fd_set*) arg.a2.p;
-	fd_set* lexcepts = (fd_set*) arg.a3.p;
-	struct timeval* tv = (struct timeval*) arg.a4.p;
+	int n = arg.a0.s;
+	fd_set* reads = (fd_set*) arg.a1.p;
+	fd_set* writes = (fd_set*) arg.a2.p;
+	fd_set* excepts = (fd_set*) arg.a3.p;
+	linux_compat_timespec* ts = (linux_compat_timespec*) arg.a4.p;
+	linux_compat_sigset_arg* sig = (linux_compat_sigset_arg*) arg.a5.p;
+
+	const linux_compat_sigset_t* mask = NULL;
+	if (sig && sig->ss)
+	{
+		if (sig->ss_len != sizeof(linux_compat_sigset_t))
+			throw EINVAL;
+		mask = (const linux_compat_sigset_t*) sig->ss;
+	}
+
+	struct timeval tv;
+	struct timeval* tvp = timespec_to_timeval(ts, tv);
+	int64_t deadline = deadline_us(tvp);
+
+	SignalWait sw(mask);
+	int result = do_select(n, reads, writes, excepts, tvp, sw.GetFD());
+	update_timespec(ts, deadline);
+	if ((result == 0) && sw.Interrupted())
+		throw EINTR;
+	return result;
+}
+
+SYSCALL(compat_sys_ppoll)
+{
+	struct pollfd* lp = (struct pollfd*) arg.a0.p;
+	unsigned int nfds = arg.a1.u;
+	linux_compat_timespec* ts = (linux_compat_timespec*) arg.a2.p;
+	const linux_compat_sigset_t* mask = (const linux_compat_sigset_t*) arg.a3.p;
+	size_t sigsetsize = arg.a4.u;
+
+	if (mask && (sigsetsize != sizeof(linux_compat_sigset_t)))
+		throw EINVAL;
+
+	struct timeval tv;
+	struct timeval* tvp = timespec_to_timeval(ts, tv);
+	int64_t deadline = deadline_us(tvp);
+
+	SignalWait sw(mask);
+	int result = do_poll(lp, nfds, tvp, sw.GetFD());
+	update_timespec(ts, deadline);
+	if ((result == 0) && sw.Interrupted())
+		throw EINTR;
+	return result;
+}
+
+/* --- epoll -------------------------------------------------------------- */
 
-	int n, compat_ulong_t __user *inp,
-		compat_ulong_t __user *outp, compat_ulong_t __user *exp,
-		struct compat_timespec __user *tsp, void __user *sig)
-#endif
+static EpollFD* get_epollfd(int fd, Ref<FD>& ref)
+{
+	ref = FD::Get(fd);
+	EpollFD* epollfd = dynamic_cast<EpollFD*>((FD*) ref);
+	if (!epollfd)
+		throw EINVAL;
+	return epollfd;
+}
+
+static int do_epoll_create(int flags)
+{
+	int fd = FD::CreateDummyFD();
+	new EpollFD(fd);
+	fcntl(fd, F_SETFD, !!(flags & LINUX_EPOLL_CLOEXEC));
+	return fd;
+}
+
+SYSCALL(sys_epoll_create)
+{
+	int size = arg.a0.s;
+	if (size <= 0)
+		throw EINVAL;
+
+	return do_epoll_create(0);
+}
+
+SYSCALL(sys_epoll_create1)
+{
+	int flags = arg.a0.s;
+	if (flags & ~LINUX_EPOLL_CLOEXEC)
+		throw EINVAL;
+
+	return do_epoll_create(flags);
+}
+
+SYSCALL(sys_epoll_ctl)
+{
+	int epfd = arg.a0.s;
+	int op = arg.a1.s;
+	int fd = arg.a2.s;
+	struct linux_epoll_event* event = (struct linux_epoll_event*) arg.a3.p;
+
+	Ref<FD> epref;
+	EpollFD* epollfd = get_epollfd(epfd, epref);
+	Ref<FD> fdo = FD::Get(fd);
+	if (fd == epfd)
+		throw EINVAL;
+
+	switch (op)
+	{
+		case LINUX_EPOLL_CTL_ADD:
+			epollfd->Add(fd, fdo, event->events, event->data);
+			return 0;
+
+		case LINUX_EPOLL_CTL_MOD:
+			epollfd->Modify(fd, event->events, event->data);
+			return 0;
+
+		case LINUX_EPOLL_CTL_DEL:
+			epollfd->Delete(fd);
+			return 0;
+	}
+
+	throw EINVAL;
+}
+
+SYSCALL(sys_epoll_wait)
+{
+	int epfd = arg.a0.s;
+	struct linux_epoll_event* events = (struct linux_epoll_event*) arg.a1.p;
+	int maxevents = arg.a2.s;
+	int timeout = arg.a3.s;
+
+	if (maxevents <= 0)
+		throw EINVAL;
+
+	Ref<FD> epref;
+	EpollFD* epollfd = get_epollfd(epfd, epref);
+	return epollfd->Wait(events, maxevents, timeout);
+}
+
+SYSCALL(sys_epoll_pwait)
+{
+	int epfd = arg.a0.s;
+	struct linux_epoll_event* events = (struct linux_epoll_event*) arg.a1.p;
+	int maxevents = arg.a2.s;
+	int timeout = arg.a3.s;
+	const linux_compat_sigset_t* mask = (const linux_compat_sigset_t*) arg.a4.p;
+	size_t sigsetsize = arg.a5.u;
+
+	if (maxevents <= 0)
+		throw EINVAL;
+	if (mask && (sigsetsize != sizeof(linux_compat_sigset_t)))
+		throw EINVAL;
+
+	Ref<FD> epref;
+	EpollFD* epollfd = get_epollfd(epfd, epref);
+
+	SignalWait sw(mask);
+	int result = epollfd->Wait(events, maxevents, timeout, sw.GetFD());
+	if ((result == 0) && sw.Interrupted())
+		throw EINTR;
+	return result;
 }
@@ -5,10 +5,11 @@
 
 #include "globals.h"
 #include "syscalls.h"
+#include "syscalls/thread.h"
+#include "syscalls/signals.h"
+#include "filesystem/SignalFD.h"
 #include <signal.h>
 
-typedef u_int64_t linux_compat_sigset_t;
-
 struct linux_sigaction32 {
 	void (*sa_handler)(int);
 	unsigned int sa_flags;
@@ -184,6 +185,67 @@ static int convert_signal_l2i(int signal)
 	return -1;
 }
 
+#define CONVERT_SIGNAL_I2L(name) \
+		case name: return LINUX_##name
+
+static int convert_signal_i2l(int signal)
+{
+	switch(signal)
+	{
+		CONVERT_SIGNAL_I2L(SIGHUP);
+		CONVERT_SIGNAL_I2L(SIGINT);
+		CONVERT_SIGNAL_I2L(SIGQUIT);
+		CONVERT_SIGNAL_I2L(SIGILL);
+		CONVERT_SIGNAL_I2L(SIGTRAP);
+		CONVERT_SIGNAL_I2L(SIGABRT);
+		CONVERT_SIGNAL_I2L(SIGBUS);
+		CONVERT_SIGNAL_I2L(SIGFPE);
+		CONVERT_SIGNAL_I2L(SIGKILL);
+		CONVERT_SIGNAL_I2L(SIGUSR1);
+		CONVERT_SIGNAL_I2L(SIGSEGV);
+		CONVERT_SIGNAL_I2L(SIGUSR2);
+		CONVERT_SIGNAL_I2L(SIGPIPE);
+		CONVERT_SIGNAL_I2L(SIGALRM);
+		CONVERT_SIGNAL_I2L(SIGTERM);
+		CONVERT_SIGNAL_I2L(SIGCHLD);
+		CONVERT_SIGNAL_I2L(SIGCONT);
+		CONVERT_SIGNAL_I2L(SIGSTOP);
+		CONVERT_SIGNAL_I2L(SIGTSTP);
+		CONVERT_SIGNAL_I2L(SIGTTIN);
+		CONVERT_SIGNAL_I2L(SIGTTOU);
+		CONVERT_SIGNAL_I2L(SIGURG);
+		CONVERT_SIGNAL_I2L(SIGXCPU);
+		CONVERT_SIGNAL_I2L(SIGXFSZ);
+		CONVERT_SIGNAL_I2L(SIGVTALRM);
+		CONVERT_SIGNAL_I2L(SIGPROF);
+		CONVERT_SIGNAL_I2L(SIGWINCH);
+		CONVERT_SIGNAL_I2L(SIGIO);
+		CONVERT_SIGNAL_I2L(SIGSYS);
+	}
+	return signal;
+}
+
+int SignalI2L(int isig)
+{
+	return convert_signal_i2l(isig);
+}
+
+/* Guest signal handlers aren't given to the host directly. Instead the host
+ * calls signal_trampoline(), which lets any SignalWait on this thread know
+ * and then calls the guest's handler with the Linux signal number. */
+
+typedef void (*SignalHandler)(int);
+static SignalHandler guesthandlers[NSIG];
+
+static void signal_trampoline(int isig)
+{
+	GuestThread* gt = FindGuestThread();
+	if (gt && gt->sigwaiting)
+		write(gt->sigwaitpipe[1], "", 1);
+
+	guesthandlers[isig](convert_signal_i2l(isig));
+}
+
 #define COPYBIT_I2L(field, name) \
 	if (is.field & name) ls.field |= LINUX_ ## name
 
@@ -278,6 +340,13 @@ SYSCALL(sys32_rt_sigaction)
 	if (lact)
 		convert_sigaction_l2i(*lact, iact);
 
+	SignalHandler oldhandler = guesthandlers[isig];
+	if (lact && (iact.sa_handler != SIG_DFL) && (iact.sa_handler != SIG_IGN))
+	{
+		guesthandlers[isig] = iact.sa_handler;
+		iact.sa_handler = signal_trampoline;
+	}
+
 	int result = 0;
 	if (lact && loact)
 		result = sigaction(isig, &iact, &ioact);
@@ -290,7 +359,11 @@ SYSCALL(sys32_rt_sigaction)
 		return -ErrnoI2L(errno);
 
 	if (loact)
+	{
+		if (ioact.sa_handler == signal_trampoline)
+			ioact.sa_handler = oldhandler;
 		convert_sigaction_i2l(ioact, *loact);
+	}
 	return result;
 }
 
@@ -300,12 +373,6 @@ SYSCALL(sys_tgkill)
 	pid_t pid = arg.a1.u;
 	int sig = arg.a2.u;
 
-	if (tgid != pid)
-	{
-		log("tgkill(%d, %d, %d) not supported yet", tgid, pid, sig);
-		throw EINVAL;
-	}
-
 	int isig = convert_signal_l2i(sig);
 	if (isig == -1)
 	{
@@ -313,6 +380,21 @@ SYSCALL(sys_tgkill)
 		throw EINVAL;
 	}
 
+	if (tgid != pid)
+	{
+		/* Signalling a specific thread; this only works within our own
+		 * process. */
+
+		if (tgid != getpid())
+		{
+			log("tgkill(%d, %d, %d) not supported yet", tgid, pid, sig);
+			throw EINVAL;
+		}
+
+		KillGuestThread(pid, isig);
+		return 0;
+	}
+
 	int result = kill(pid, isig);
 	CheckError(result);
 	return 0;
@@ -341,3 +423,109 @@ SYSCALL(stub32_sigaltstack)
 {
 	throw ENOSYS;
 }
+
+static int do_signalfd(int fd, linux_compat_sigset_t* lmask, size_t sizemask,
+		int flags)
+{
+	if (sizemask != sizeof(linux_compat_sigset_t))
+		throw EINVAL;
+	if (flags & ~(LINUX_SFD_CLOEXEC | LINUX_SFD_NONBLOCK))
+		throw EINVAL;
+
+	sigset_t mask;
+	convert_sigset_l2i(*lmask, mask);
+	sigdelset(&mask, SIGKILL);
+	sigdelset(&mask, SIGSTOP);
+
+	if (fd == -1)
+		return SignalFD::Create(mask, flags);
+
+	Ref<FD> fdo = FD::Get(fd);
+	SignalFD* signalfd = dynamic_cast<SignalFD*>((FD*) fdo);
+	if (!signalfd)
+		throw EINVAL;
+	signalfd->SetMask(mask);
+	return fd;
+}
+
+SYSCALL(compat_sys_signalfd)
+{
+	int fd = arg.a0.s;
+	linux_compat_sigset_t* lmask = (linux_compat_sigset_t*) arg.a1.p;
+	size_t sizemask = arg.a2.u;
+
+	return do_signalfd(fd, lmask, sizemask, 0);
+}
+
+SYSCALL(compat_sys_signalfd4)
+{
+	int fd = arg.a0.s;
+	linux_compat_sigset_t* lmask = (linux_compat_sigset_t*) arg.a1.p;
+	size_t sizemask = arg.a2.u;
+	int flags = arg.a3.s;
+
+	return do_signalfd(fd, lmask, sizemask, flags);
+}
+
+/* --- Atomic signal mask swaps ------------------------------------------- */
+
+static bool drain(int fd)
+{
+	bool any = false;
+	char buffer[16];
+	while (read(fd, buffer, sizeof(buffer)) > 0)
+		any = true;
+	return any;
+}
+
+SignalWait::SignalWait(const linux_compat_sigset_t* mask):
+	_fd(-1)
+{
+	if (!mask)
+		return;
+
+	GuestThread& gt = GetGuestThread();
+	if (gt.sigwaitpipe[0] == -1)
+	{
+		if (pipe(gt.sigwaitpipe) == -1)
+			throw errno;
+
+		for (int i = 0; i < 2; i++)
+		{
+			fcntl(gt.sigwaitpipe[i], F_SETFD, 1);
+			fcntl(gt.sigwaitpipe[i], F_SETFL, O_NONBLOCK);
+		}
+	}
+
+	_fd = gt.sigwaitpipe[0];
+	drain(_fd);
+	gt.sigwaiting = true;
+
+	linux_compat_sigset_t ls = *mask;
+	sigset_t is;
+	convert_sigset_l2i(ls, is);
+	if (sigprocmask(SIG_SETMASK, &is, &_oldmask) == -1)
+	{
+		gt.sigwaiting = false;
+		throw errno;
+	}
+}
+
+SignalWait::~SignalWait()
+{
+	if (_fd == -1)
+		return;
+
+	/* Anything that arrives once the old mask is back is delivered after
+	 * the syscall, as on Linux, and doesn't count. */
+
+	GetGuestThread().sigwaiting = false;
+	sigprocmask(SIG_SETMASK, &_oldmask, NULL);
+}
+
+bool SignalWait::Interrupted()
+{
+	if (_fd == -1)
+		return false;
+	return drain(_fd);
+}
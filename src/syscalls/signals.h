@@ -0,0 +1,38 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef SYSCALLS_SIGNALS_H
+#define SYSCALLS_SIGNALS_H
+
+#include <signal.h>
+
+typedef u_int64_t linux_compat_sigset_t;
+
+/* pselect(), ppoll() and epoll_pwait() swap in the guest's signal mask just
+ * for the duration of the wait. Doing it with sigprocmask() either side
+ * would lose any signal arriving just before the wait starts, so guest
+ * signal handlers also poke a per-thread pipe; the wait watches GetFD(),
+ * and Interrupted() says whether a handler ran. The old mask is put back
+ * when this goes out of scope. With no mask, GetFD() is -1.
+ */
+
+/* Converts an Interix signal number to a Linux one. */
+extern int SignalI2L(int isig);
+
+class SignalWait
+{
+public:
+	SignalWait(const linux_compat_sigset_t* mask);
+	~SignalWait();
+
+	int GetFD() const { return _fd; }
+	bool Interrupted();
+
+private:
+	int _fd;
+	sigset_t _oldmask;
+};
+
+#endif
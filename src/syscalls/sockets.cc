@@ -10,7 +10,11 @@
 #include "filesystem/socket.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <xti.h>
+#include <vector>
+
+using std::vector;
 
 #define LINUX_SYS_SOCKET	1		/* sys_socket(2)		*/
 #define LINUX_SYS_BIND	2		/* sys_bind(2)			*/
@@ -30,6 +34,11 @@
 #define LINUX_SYS_SENDMSG	16		/* sys_sendmsg(2)		*/
 #define LINUX_SYS_RECVMSG	17		/* sys_recvmsg(2)		*/
 #define LINUX_SYS_ACCEPT4	18		/* sys_accept4(2)		*/
+#define LINUX_SYS_RECVMMSG	19		/* sys_recvmmsg(2)		*/
+#define LINUX_SYS_SENDMMSG	20		/* sys_sendmmsg(2)		*/
+
+/* The most messages sendmmsg() and recvmmsg() will do at once. */
+#define LINUX_UIO_MAXIOV	1024
 
 static void convert_sockopt(int level, int optname, int& ilevel, int& ioptname)
 {
@@ -120,6 +129,35 @@ static int convert_msg_flags(int lflags)
 	return iflags;
 }
 
+static int convert_msg_flags_i2l(int iflags)
+{
+	int lflags = 0;
+#define CONVERT(n) if (iflags & n) lflags |= LINUX_##n
+	CONVERT(MSG_OOB);
+#if defined MSG_TRUNC
+	CONVERT(MSG_TRUNC);
+#endif
+#if defined MSG_CTRUNC
+	CONVERT(MSG_CTRUNC);
+#endif
+#if defined MSG_EOR
+	CONVERT(MSG_EOR);
+#endif
+#undef CONVERT
+	return lflags;
+}
+
+/* For the flags that can be or'd into a socket type, or passed to
+ * accept4(). */
+static void set_sock_flags(int fd, int flags)
+{
+	Ref<FD> ref = FD::Get(fd);
+	if (flags & LINUX_SOCK_CLOEXEC)
+		ref->Fcntl(LINUX_F_SETFD, 1);
+	if (flags & LINUX_SOCK_NONBLOCK)
+		ref->Fcntl(LINUX_F_SETFL, LINUX_O_NONBLOCK);
+}
+
 static int do_socket(int protofamily, int type, int protocol)
 {
 	int itype = type & 0xff;
@@ -129,22 +167,43 @@ static int do_socket(int protofamily, int type, int protocol)
 	{
 		case AF_INET:
 		case AF_UNIX:
-			newfd = socket(protofamily, type, protocol);
+			newfd = socket(protofamily, itype, protocol);
+			if (newfd == -1)
+				throw errno;
 			break;
 
 		default:
 			throw EPROTONOSUPPORT;
 	}
 
-	Ref<FD> ref = new RealFD(newfd);
-	if (type & LINUX_SOCK_CLOEXEC)
-		ref->Fcntl(LINUX_F_SETFD, 1);
-	if (type & LINUX_SOCK_NONBLOCK)
-		ref->Fcntl(LINUX_F_SETFL, LINUX_O_NONBLOCK);
-
+	new RealFD(newfd);
+	set_sock_flags(newfd, type);
 	return newfd;
 }
 
+static int do_socketpair(int protofamily, int type, int protocol, int* sv)
+{
+	int itype = type & 0xff;
+
+	if (protofamily != AF_UNIX)
+		throw EAFNOSUPPORT;
+
+	int isv[2];
+	int result = socketpair(protofamily, itype, protocol, isv);
+	if (result == -1)
+		throw errno;
+
+	for (int i = 0; i < 2; i++)
+	{
+		new RealFD(isv[i]);
+		set_sock_flags(isv[i], type);
+	}
+
+	sv[0] = isv[0];
+	sv[1] = isv[1];
+	return 0;
+}
+
 static int do_bind(int fd, const struct sockaddr* addr, int addrlen)
 {
 	Ref<FD> ref = FD::Get(fd);
@@ -159,6 +218,25 @@ static int do_connect(int fd, const struct sockaddr* addr, int addrlen)
 	return 0;
 }
 
+static int do_listen(int fd, int backlog)
+{
+	Ref<FD> ref = FD::Get(fd);
+	ref->Listen(backlog);
+	return 0;
+}
+
+/* sockaddr_in is compatible. */
+static int do_accept(int fd, struct sockaddr* addr, int* addrlen, int flags)
+{
+	if (flags & ~(LINUX_SOCK_CLOEXEC | LINUX_SOCK_NONBLOCK))
+		throw EINVAL;
+
+	Ref<FD> ref = FD::Get(fd);
+	int newfd = ref->Accept(addr, addrlen);
+	set_sock_flags(newfd, flags);
+	return newfd;
+}
+
 static int do_setsockopt(int fd, int level, int optname, const void* optval,
 		int optlen)
 {
@@ -209,7 +287,8 @@ static int do_recv(int fd, void *msg, size_t len, int flags)
 	int iflags = convert_msg_flags(flags);
 
 	Ref<FD> ref = FD::Get(fd);
-	return ref->RecvFrom(msg, len, iflags, NULL, NULL);
+	return ref->RecvFrom(msg, len, iflags, NULL, NULL,
+			flags & LINUX_MSG_DONTWAIT);
 }
 
 static int do_sendto(int fd, const void* buf, size_t len, int flags,
@@ -227,7 +306,8 @@ static int do_recvfrom(int fd, void *buf, size_t len, int flags,
 	int iflags = convert_msg_flags(flags);
 
 	Ref<FD> ref = FD::Get(fd);
-	return ref->RecvFrom(buf, len, iflags, from, fromlen);
+	return ref->RecvFrom(buf, len, iflags, from, fromlen,
+			flags & LINUX_MSG_DONTWAIT);
 }
 
 static int do_shutdown(int fd, int how)
@@ -239,37 +319,216 @@ static int do_shutdown(int fd, int how)
 	return 0;
 }
 
-static ssize_t do_sendmsg(int fd, const struct linux_msghdr *msg, int flags)
+/* --- sendmsg and recvmsg ------------------------------------------------ */
+
+/* struct iovec is compatible, and so is the layout of the control messages;
+ * only the constants in the cmsg headers need converting. File descriptors
+ * passed with SCM_RIGHTS are host descriptors already. */
+
+#define LINUX_CMSG_ALIGN(n) (((n) + 3) & ~3)
+
+static void convert_cmsgs_l2i(void* control, u32 controllen)
 {
-	if (msg->msg_controllen > 0)
-		throw EOPNOTSUPP;
+	u8* p = (u8*) control;
+	u8* end = p + controllen;
+	while ((p + sizeof(linux_cmsghdr)) <= end)
+	{
+		linux_cmsghdr* c = (linux_cmsghdr*) p;
+		if ((c->cmsg_len < sizeof(linux_cmsghdr)) || ((p + c->cmsg_len) > end))
+			throw EINVAL;
 
-	if (msg->msg_iovlen == 1)
+		if (c->cmsg_level == LINUX_SOL_SOCKET)
+		{
+			if (c->cmsg_type != LINUX_SCM_RIGHTS)
+				throw EINVAL;
+			c->cmsg_level = SOL_SOCKET;
+			c->cmsg_type = SCM_RIGHTS;
+		}
+
+		p += LINUX_CMSG_ALIGN(c->cmsg_len);
+	}
+}
+
+static void convert_cmsgs_i2l(void* control, u32 controllen, int lflags)
+{
+	u8* p = (u8*) control;
+	u8* end = p + controllen;
+	while ((p + sizeof(linux_cmsghdr)) <= end)
 	{
-		return do_sendto(fd, msg->msg_iov->iov_base, msg->msg_iov->iov_len,
-				flags,
-				(const struct sockaddr*) msg->msg_name, msg->msg_namelen);
+		linux_cmsghdr* c = (linux_cmsghdr*) p;
+		if ((c->cmsg_len < sizeof(linux_cmsghdr)) || ((p + c->cmsg_len) > end))
+			break;
+
+		if ((c->cmsg_level == SOL_SOCKET) && (c->cmsg_type == SCM_RIGHTS))
+		{
+			c->cmsg_level = LINUX_SOL_SOCKET;
+			c->cmsg_type = LINUX_SCM_RIGHTS;
+
+			if (lflags & LINUX_MSG_CMSG_CLOEXEC)
+			{
+				int* fds = (int*) (c + 1);
+				int count = (c->cmsg_len - sizeof(linux_cmsghdr)) / sizeof(int);
+				for (int i = 0; i < count; i++)
+					fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+			}
+		}
+
+		p += LINUX_CMSG_ALIGN(c->cmsg_len);
 	}
-	else
+}
+
+/* The guest's control messages are converted in a copy, as the guest may
+ * reuse them. */
+static int send_one(FD* fdo, const struct linux_msghdr* lmsg, int flags,
+		vector<u8>& control)
+{
+	struct msghdr imsg;
+	memset(&imsg, 0, sizeof(imsg));
+	imsg.msg_name = (caddr_t) lmsg->msg_name;
+	imsg.msg_namelen = lmsg->msg_namelen;
+	imsg.msg_iov = lmsg->msg_iov;
+	imsg.msg_iovlen = lmsg->msg_iovlen;
+
+	if (lmsg->msg_control && lmsg->msg_controllen)
 	{
-		error("sendmsg() with more than one iov element not supported yet");
+		u8* p = (u8*) lmsg->msg_control;
+		control.assign(p, p + lmsg->msg_controllen);
+		convert_cmsgs_l2i(&control[0], control.size());
+		imsg.msg_control = (caddr_t) &control[0];
+		imsg.msg_controllen = control.size();
 	}
+
+	return fdo->SendMsg(&imsg, convert_msg_flags(flags));
+}
+
+/* Control messages are received straight into the guest's buffer and
+ * converted there. */
+static int recv_one(FD* fdo, struct linux_msghdr* lmsg, int flags)
+{
+	struct msghdr imsg;
+	memset(&imsg, 0, sizeof(imsg));
+	imsg.msg_name = (caddr_t) lmsg->msg_name;
+	imsg.msg_namelen = lmsg->msg_namelen;
+	imsg.msg_iov = lmsg->msg_iov;
+	imsg.msg_iovlen = lmsg->msg_iovlen;
+	imsg.msg_control = (caddr_t) lmsg->msg_control;
+	imsg.msg_controllen = lmsg->msg_control ? lmsg->msg_controllen : 0;
+
+	int result = fdo->RecvMsg(&imsg, convert_msg_flags(flags),
+			flags & LINUX_MSG_DONTWAIT);
+
+	lmsg->msg_namelen = imsg.msg_namelen;
+	lmsg->msg_controllen = imsg.msg_controllen;
+	lmsg->msg_flags = convert_msg_flags_i2l(imsg.msg_flags);
+	if (imsg.msg_control)
+		convert_cmsgs_i2l(imsg.msg_control, imsg.msg_controllen, flags);
+	return result;
+}
+
+static ssize_t do_sendmsg(int fd, const struct linux_msghdr *msg, int flags)
+{
+	Ref<FD> ref = FD::Get(fd);
+	vector<u8> control;
+	return send_one(ref, msg, flags, control);
 }
 
 static ssize_t do_recvmsg(int fd, struct linux_msghdr *msg, int flags)
 {
-	msg->msg_controllen = 0;
+	Ref<FD> ref = FD::Get(fd);
+	return recv_one(ref, msg, flags);
+}
+
+/* The batched versions look up the FD once for the whole batch. As on
+ * Linux, an error after the first message just ends the batch early. */
+
+static int do_sendmmsg(int fd, struct linux_mmsghdr* msgs, unsigned int vlen,
+		int flags)
+{
+	if (vlen > LINUX_UIO_MAXIOV)
+		vlen = LINUX_UIO_MAXIOV;
 
-	if (msg->msg_iovlen == 1)
+	Ref<FD> ref = FD::Get(fd);
+	vector<u8> control;
+	unsigned int i;
+	for (i = 0; i < vlen; i++)
 	{
-		return do_recvfrom(fd, msg->msg_iov->iov_base, msg->msg_iov->iov_len,
-				flags,
-				(struct sockaddr*) msg->msg_name, &msg->msg_namelen);
+		try
+		{
+			msgs[i].msg_len = send_one(ref, &msgs[i].msg_hdr, flags, control);
+		}
+		catch (int e)
+		{
+			if (i == 0)
+				throw e;
+			break;
+		}
+	}
+
+	return i;
+}
+
+static int64_t now_us()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* compat_timespec is compatible with Interix. Like Linux, the timeout is
+ * only checked after each message arrives. MSG_WAITFORONE is done by
+ * receiving everything after the first message with MSG_DONTWAIT. */
+static int do_recvmmsg(int fd, struct linux_mmsghdr* msgs, unsigned int vlen,
+		int flags, struct timespec* timeout)
+{
+	if (vlen > LINUX_UIO_MAXIOV)
+		vlen = LINUX_UIO_MAXIOV;
+
+	int64_t deadline = 0;
+	if (timeout)
+	{
+		if ((timeout->tv_sec < 0) || (timeout->tv_nsec < 0) ||
+				(timeout->tv_nsec >= 1000000000))
+			throw EINVAL;
+		deadline = now_us() + (int64_t) timeout->tv_sec * 1000000 +
+				timeout->tv_nsec / 1000;
+	}
+
+	Ref<FD> ref = FD::Get(fd);
+	unsigned int i;
+	for (i = 0; i < vlen; i++)
+	{
+		int mflags = flags;
+		if ((i > 0) && (flags & LINUX_MSG_WAITFORONE))
+			mflags |= LINUX_MSG_DONTWAIT;
+
+		try
+		{
+			msgs[i].msg_len = recv_one(ref, &msgs[i].msg_hdr, mflags);
+		}
+		catch (int e)
+		{
+			if (i == 0)
+				throw e;
+			break;
+		}
+
+		if (timeout && (now_us() >= deadline))
+		{
+			i++;
+			break;
+		}
 	}
-	else
+
+	if (timeout)
 	{
-		error("sendmsg() with more than one iov element not supported yet");
+		int64_t left = deadline - now_us();
+		if (left < 0)
+			left = 0;
+		timeout->tv_sec = left / 1000000;
+		timeout->tv_nsec = (left % 1000000) * 1000;
 	}
+
+	return i;
 }
 
 SYSCALL(compat_sys_socketcall)
@@ -290,6 +549,20 @@ SYSCALL(compat_sys_socketcall)
 			return do_connect(args[0], (const struct sockaddr*) args[1],
 					args[2]);
 
+		case LINUX_SYS_LISTEN:
+			return do_listen(args[0], args[1]);
+
+		case LINUX_SYS_ACCEPT:
+			return do_accept(args[0], (struct sockaddr*) args[1],
+					(int*) args[2], 0);
+
+		case LINUX_SYS_ACCEPT4:
+			return do_accept(args[0], (struct sockaddr*) args[1],
+					(int*) args[2], args[3]);
+
+		case LINUX_SYS_SOCKETPAIR:
+			return do_socketpair(args[0], args[1], args[2], (int*) args[3]);
+
 		case LINUX_SYS_SETSOCKOPT:
 			return do_setsockopt(args[0], args[1], args[2],
 					(const void*) args[3], args[4]);
@@ -331,9 +604,113 @@ SYSCALL(compat_sys_socketcall)
 		case LINUX_SYS_RECVMSG:
 			return do_recvmsg(args[0], (struct linux_msghdr*) args[1], args[2]);
 
+		case LINUX_SYS_SENDMMSG:
+			return do_sendmmsg(args[0], (struct linux_mmsghdr*) args[1],
+					args[2], args[3]);
+
+		case LINUX_SYS_RECVMMSG:
+			return do_recvmmsg(args[0], (struct linux_mmsghdr*) args[1],
+					args[2], args[3], (struct timespec*) args[4]);
+
 		default:
 			error("unimplemented compat_sys_socketcall opcode %d", call);
 	}
 
 	throw EINVAL;
 }
+
+/* Newer libcs use these instead of socketcall(). */
+
+SYSCALL(sys_socket)
+{
+	return do_socket(arg.a0.s, arg.a1.s, arg.a2.s);
+}
+
+SYSCALL(sys_socketpair)
+{
+	return do_socketpair(arg.a0.s, arg.a1.s, arg.a2.s, (int*) arg.a3.p);
+}
+
+SYSCALL(sys_bind)
+{
+	return do_bind(arg.a0.s, (const struct sockaddr*) arg.a1.p, arg.a2.s);
+}
+
+SYSCALL(sys_connect)
+{
+	return do_connect(arg.a0.s, (const struct sockaddr*) arg.a1.p, arg.a2.s);
+}
+
+SYSCALL(sys_listen)
+{
+	return do_listen(arg.a0.s, arg.a1.s);
+}
+
+SYSCALL(sys_accept4)
+{
+	return do_accept(arg.a0.s, (struct sockaddr*) arg.a1.p, (int*) arg.a2.p,
+			arg.a3.s);
+}
+
+SYSCALL(compat_sys_getsockopt)
+{
+	return do_getsockopt(arg.a0.s, arg.a1.s, arg.a2.s, arg.a3.p,
+			(int*) arg.a4.p);
+}
+
+SYSCALL(compat_sys_setsockopt)
+{
+	return do_setsockopt(arg.a0.s, arg.a1.s, arg.a2.s, arg.a3.p, arg.a4.s);
+}
+
+SYSCALL(sys_getsockname)
+{
+	return do_getsockname(arg.a0.s, (struct sockaddr*) arg.a1.p,
+			(int*) arg.a2.p);
+}
+
+SYSCALL(sys_getpeername)
+{
+	return do_getpeername(arg.a0.s, (struct sockaddr*) arg.a1.p,
+			(int*) arg.a2.p);
+}
+
+SYSCALL(sys_sendto)
+{
+	return do_sendto(arg.a0.s, arg.a1.p, arg.a2.u, arg.a3.s,
+			(const struct sockaddr*) arg.a4.p, arg.a5.s);
+}
+
+SYSCALL(compat_sys_sendmsg)
+{
+	return do_sendmsg(arg.a0.s, (const struct linux_msghdr*) arg.a1.p,
+			arg.a2.s);
+}
+
+SYSCALL(compat_sys_recvfrom)
+{
+	return do_recvfrom(arg.a0.s, arg.a1.p, arg.a2.u, arg.a3.s,
+			(struct sockaddr*) arg.a4.p, (int*) arg.a5.p);
+}
+
+SYSCALL(compat_sys_recvmsg)
+{
+	return do_recvmsg(arg.a0.s, (struct linux_msghdr*) arg.a1.p, arg.a2.s);
+}
+
+SYSCALL(sys_shutdown)
+{
+	return do_shutdown(arg.a0.s, arg.a1.s);
+}
+
+SYSCALL(compat_sys_sendmmsg)
+{
+	return do_sendmmsg(arg.a0.s, (struct linux_mmsghdr*) arg.a1.p, arg.a2.u,
+			arg.a3.s);
+}
+
+SYSCALL(compat_sys_recvmmsg)
+{
+	return do_recvmmsg(arg.a0.s, (struct linux_mmsghdr*) arg.a1.p, arg.a2.u,
+			arg.a3.s, (struct timespec*) arg.a4.p);
+}
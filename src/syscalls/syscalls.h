@@ -40,8 +40,8 @@ struct Registers
 			Argument ebp;
 		};
 	};
+	u_int32_t gs;               // pushed after the flags, so it's first
 	u_int32_t flags;
-	u_int32_t gs;
 	u_int32_t eip;
 };
 
@@ -49,7 +49,7 @@ struct Registers
 	int32_t __name(const Arguments& arg)
 typedef int32_t Syscall(const Arguments& arg);
 
-#define NUM_SYSCALLS 337
+#define NUM_SYSCALLS 374
 
 extern const char* const SyscallNames[NUM_SYSCALLS];
 
@@ -5,53 +5,154 @@
 
 #include "globals.h"
 #include "syscalls.h"
+#include "syscalls/thread.h"
+#include "syscalls/futex.h"
+#include <signal.h>
+#include <map>
 
-#define LINUX_FUTEX_WAIT              0
-#define LINUX_FUTEX_WAKE              1
-#define LINUX_FUTEX_FD                2
-#define LINUX_FUTEX_REQUEUE           3
-#define LINUX_FUTEX_CMP_REQUEUE       4
-#define LINUX_FUTEX_WAKE_OP           5
-#define LINUX_FUTEX_LOCK_PI           6
-#define LINUX_FUTEX_UNLOCK_PI         7
-#define LINUX_FUTEX_TRYLOCK_PI        8
-#define LINUX_FUTEX_WAIT_BITSET       9
-#define LINUX_FUTEX_WAKE_BITSET       10
-
-#define LINUX_FUTEX_PRIVATE_FLAG      128
-#define LINUX_FUTEX_CLOCK_REALTIME	256
-#define LINUX_FUTEX_CMD_MASK		~(LINUX_FUTEX_PRIVATE_FLAG | LINUX_FUTEX_CLOCK_REALTIME)
-
-#define LINUX_FUTEX_WAIT_PRIVATE      (LINUX_FUTEX_WAIT | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_WAKE_PRIVATE      (LINUX_FUTEX_WAKE | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_REQUEUE_PRIVATE   (LINUX_FUTEX_REQUEUE | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_CMP_REQUEUE_PRIVATE (LINUX_FUTEX_CMP_REQUEUE | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_WAKE_OP_PRIVATE   (LINUX_FUTEX_WAKE_OP | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_LOCK_PI_PRIVATE   (LINUX_FUTEX_LOCK_PI | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_UNLOCK_PI_PRIVATE (LINUX_FUTEX_UNLOCK_PI | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_TRYLOCK_PI_PRIVATE (LINUX_FUTEX_TRYLOCK_PI | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_WAIT_BITSET_PRIVATE       (LINUX_FUTEX_WAIT_BITS | LINUX_FUTEX_PRIVATE_FLAG)
-#define LINUX_FUTEX_WAKE_BITSET_PRIVATE       (LINUX_FUTEX_WAKE_BITS | LINUX_FUTEX_PRIVATE_FLAG)
-
-struct linux_user_desc {
-	int  entry_number;
-	unsigned int  base_addr;
-	unsigned int  limit;
-	unsigned int  seg_32bit:1;
-	unsigned int  contents:2;
-	unsigned int  read_exec_only:1;
-	unsigned int  limit_in_pages:1;
-	unsigned int  seg_not_present:1;
-	unsigned int  useable:1;
-};
+using std::map;
+
+typedef map<pid_t, GuestThread*> GuestThreads;
+static GuestThreads guestthreads;
+static pthread_key_t guestthread_key = 0;
+static Mutex guestthreadslock("guest threads");
+
+/* Called for every new process, including fork() children, where the
+ * calling thread becomes the main thread and all the others are gone. */
+void InitThreads()
+{
+	if (guestthread_key == 0)
+		pthread_key_create(&guestthread_key, NULL);
+
+	guestthreads.clear();
+
+	GuestThread* gt = (GuestThread*) pthread_getspecific(guestthread_key);
+	if (gt)
+	{
+		gt->tid = getpid();
+		gt->thread = pthread_self();
+
+		/* Don't share the parent's signal wait pipe. */
+
+		if (gt->sigwaitpipe[0] != -1)
+		{
+			close(gt->sigwaitpipe[0]);
+			close(gt->sigwaitpipe[1]);
+			gt->sigwaitpipe[0] = gt->sigwaitpipe[1] = -1;
+		}
+		gt->sigwaiting = false;
+
+		RegisterGuestThread(gt);
+	}
+}
+
+/* Unlike GetGuestThread() this never allocates, so it's safe to call from
+ * a signal handler. Returns NULL if the thread has no state yet. */
+GuestThread* FindGuestThread()
+{
+	return (GuestThread*) pthread_getspecific(guestthread_key);
+}
+
+void RegisterGuestThread(GuestThread* gt)
+{
+	RAIILock locked(guestthreadslock);
+
+	pthread_setspecific(guestthread_key, gt);
+	guestthreads[gt->tid] = gt;
+}
+
+GuestThread& GetGuestThread()
+{
+	GuestThread* gt = (GuestThread*) pthread_getspecific(guestthread_key);
+	if (!gt)
+	{
+		/* This must be the main thread. */
+
+		gt = new GuestThread(getpid());
+		RegisterGuestThread(gt);
+	}
+	return *gt;
+}
+
+/* Sends an Interix signal to one of our own threads. */
+void KillGuestThread(pid_t tid, int isig)
+{
+	RAIILock locked(guestthreadslock);
+
+	GuestThreads::const_iterator i = guestthreads.find(tid);
+	if (i == guestthreads.end())
+		throw ESRCH;
+
+	int e = pthread_kill(i->second->thread, isig);
+	if (e)
+		throw e;
+}
+
+/* Called when the current thread exits. Returns true if it was the last
+ * one, in which case the process should go too. */
+bool ExitGuestThread()
+{
+	GuestThread& gt = GetGuestThread();
+
+	FutexExitRobustList(gt.robust_list, gt.tid);
+	gt.robust_list = 0;
+
+	if (gt.clear_child_tid)
+	{
+		*gt.clear_child_tid = 0;
+		FutexWake(gt.clear_child_tid, 1);
+	}
+
+	RAIILock locked(guestthreadslock);
+	guestthreads.erase(gt.tid);
+	if (guestthreads.empty())
+		return true;
+
+	if (gt.sigwaitpipe[0] != -1)
+	{
+		close(gt.sigwaitpipe[0]);
+		close(gt.sigwaitpipe[1]);
+	}
+
+	pthread_setspecific(guestthread_key, NULL);
+	delete &gt;
+	return false;
+}
+
+/* Called when the whole process is exiting. Robust futexes may be in memory
+ * shared with other processes, so every thread's list gets cleaned up. */
+void ExitAllGuestThreads()
+{
+	RAIILock locked(guestthreadslock);
+
+	for (GuestThreads::iterator i = guestthreads.begin();
+			i != guestthreads.end(); i++)
+	{
+		GuestThread* gt = i->second;
+		FutexExitRobustList(gt->robust_list, gt->tid);
+		gt->robust_list = 0;
+	}
+}
+
+/* The main thread only registers itself when it first needs to, so it's
+ * counted whether it has or not. */
+int CountGuestThreads()
+{
+	RAIILock locked(guestthreadslock);
+
+	int count = guestthreads.size();
+	if (guestthreads.find(getpid()) == guestthreads.end())
+		count++;
+	return count;
+}
 
 int32_t sys_set_thread_area(Registers& regs)
 {
 	Arguments& arg = regs.arg;
 	struct linux_user_desc& u = *(struct linux_user_desc*) arg.a0.p;
 
-	assert(u.entry_number == -1);
-	u.entry_number = 10;
+	if (u.entry_number == -1)
+		u.entry_number = 10;
 
 	u_int16_t gs = (u.entry_number << 3) | 7;
 	//log("GS %04x now pointing at linear %08x", gs, u.base_addr);
@@ -60,55 +161,45 @@ int32_t sys_set_thread_area(Registers& regs)
 	return 0;
 }
 
-/* Not implemented --- nop */
+/* The word at this address is zeroed, and waiters on it woken, when the
+ * thread exits; this is how pthread_join() works. */
 SYSCALL(sys_set_tid_address)
 {
-	Warning("sys_set_tid_address() currently unimplemented");
-	return getpid();
+	GuestThread& gt = GetGuestThread();
+	gt.clear_child_tid = (u32*) arg.a0.p;
+	return gt.tid;
 }
 
-/* Not implemented */
 SYSCALL(compat_sys_set_robust_list)
 {
-	Warning("compat_sys_set_robust_list() currently unimplemented");
-	return 0; //-LINUX_ENOSYS;
-}
+	u32 head = arg.a0.u;
+	u32 len = arg.a1.u;
 
-SYSCALL(compat_sys_futex)
-{
-	int* uaddr = (int*) arg.a0.p;
-	int op = arg.a1.s;
-	int val = arg.a2.s;
-	const void* timespec = (const void*) arg.a3.p;
-	int* uaddr2 = (int*) arg.a4.p;
-	int val3 = arg.a5.s;
-
-	int cmd = op & LINUX_FUTEX_CMD_MASK;
-	switch (cmd)
-	{
-		case LINUX_FUTEX_WAIT:
-			*uaddr = 0;
-			log("FUTEX_WAIT faked");
-			return 0;
-
-		case LINUX_FUTEX_WAKE:
-			return 0;
+	/* sizeof(struct robust_list_head) */
+	if (len != 12)
+		throw EINVAL;
 
-		case LINUX_FUTEX_WAIT_BITSET:
-			throw EINVAL;
+	GetGuestThread().robust_list = head;
+	return 0;
+}
 
-		default:
-			log("op=%02x uaddr=%08x, *uaddr=%08x, val=%08x, timespec=%p, uaddr2=%08x, val3=%08x", op, uaddr, *uaddr, val,
-					timespec, uaddr2, val3);
+SYSCALL(compat_sys_get_robust_list)
+{
+	pid_t pid = arg.a0.s;
+	u32* head = (u32*) arg.a1.p;
+	u32* len = (u32*) arg.a2.p;
 
-			error("compat_sys_futex(%x) currently unimplemented", op);
-	}
+	/* Only our own thread can be looked at. */
+	GuestThread& gt = GetGuestThread();
+	if (pid && (pid != gt.tid))
+		throw ESRCH;
 
-	//sleep(-1);
-	throw ENOSYS;
+	*head = gt.robust_list;
+	*len = 12;
+	return 0;
 }
 
 SYSCALL(sys_gettid)
 {
-	return (u32) pthread_self();
+	return GetGuestThread().tid;
 }
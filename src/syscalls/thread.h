@@ -0,0 +1,63 @@
+/* © 2010 David Given.
+ * LBW is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef SYSCALLS_THREAD_H
+#define SYSCALLS_THREAD_H
+
+#include <pthread.h>
+
+struct linux_user_desc {
+	int  entry_number;
+	unsigned int  base_addr;
+	unsigned int  limit;
+	unsigned int  seg_32bit:1;
+	unsigned int  contents:2;
+	unsigned int  read_exec_only:1;
+	unsigned int  limit_in_pages:1;
+	unsigned int  seg_not_present:1;
+	unsigned int  useable:1;
+};
+
+/* Per-thread state for guest threads. The main thread's tid is the pid,
+ * as on Linux; other threads use their Interix thread id. */
+
+struct GuestThread
+{
+	/* Makes the state for the calling thread, with nothing set up. */
+	GuestThread(pid_t t):
+		tid(t),
+		thread(pthread_self()),
+		clear_child_tid(NULL),
+		robust_list(0),
+		affinity(0),
+		sched_policy(0),
+		sched_priority(0),
+		sigwaiting(false)
+	{
+		sigwaitpipe[0] = sigwaitpipe[1] = -1;
+	}
+
+	pid_t tid;
+	pthread_t thread;
+	u32* clear_child_tid;
+	u32 robust_list;        // guest address of robust_list_head
+	u32 affinity;           // CPU mask, or 0 for all of them
+	int sched_policy;
+	int sched_priority;
+	int sigwaitpipe[2];     // see SignalWait, or -1 if not made yet
+	volatile bool sigwaiting;
+};
+
+extern void InitThreads();
+extern GuestThread& GetGuestThread();
+extern GuestThread* FindGuestThread();
+extern void RegisterGuestThread(GuestThread* gt);
+extern void KillGuestThread(pid_t tid, int isig);
+extern bool ExitGuestThread();
+extern void ExitAllGuestThreads();
+extern int CountGuestThreads();
+extern void ApplyGuestThreadScheduling(GuestThread& gt);
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "globals.h"
 #include "syscalls.h"
+#include "filesystem/TimerFD.h"
 #include <sys/times.h>
 #include <sys/time.h>
 #include <time.h>
@@ -143,3 +144,44 @@ SYSCALL(compat_sys_times)
 	CheckError(t);
 	return t;
 }
+
+SYSCALL(sys_timerfd_create)
+{
+	int clockid = arg.a0.s;
+	int flags = arg.a1.s;
+
+	return TimerFD::Create(clockid, flags);
+}
+
+static TimerFD* get_timerfd(int fd, Ref<FD>& ref)
+{
+	ref = FD::Get(fd);
+	TimerFD* timerfd = dynamic_cast<TimerFD*>((FD*) ref);
+	if (!timerfd)
+		throw EINVAL;
+	return timerfd;
+}
+
+SYSCALL(compat_sys_timerfd_settime)
+{
+	int fd = arg.a0.s;
+	int flags = arg.a1.s;
+	const linux_itimerspec* value = (const linux_itimerspec*) arg.a2.p;
+	linux_itimerspec* ovalue = (linux_itimerspec*) arg.a3.p;
+
+	Ref<FD> ref;
+	TimerFD* timerfd = get_timerfd(fd, ref);
+	timerfd->SetTime(flags, *value, ovalue);
+	return 0;
+}
+
+SYSCALL(compat_sys_timerfd_gettime)
+{
+	int fd = arg.a0.s;
+	linux_itimerspec* value = (linux_itimerspec*) arg.a1.p;
+
+	Ref<FD> ref;
+	TimerFD* timerfd = get_timerfd(fd, ref);
+	timerfd->GetTime(*value);
+	return 0;
+}
@@ -7,16 +7,19 @@
 #include "exec/ElfLoader.h"
 #include "syscalls/mmap.h"
 #include "syscalls/memory.h"
+#include "syscalls/futex.h"
+#include "syscalls/thread.h"
 #include "filesystem/FD.h"
+#include "filesystem/NotifyFD.h"
 #include "filesystem/InterixVFSNode.h"
 #include "filesystem/VFS.h"
 #include "MemOp.h"
+#include "TimerThread.h"
 #include <pthread.h>
 #include <vector>
 
 using std::vector;
 
-static pthread_mutex_t lock;
 static ElfLoader* executable = NULL;
 static ElfLoader* interpreter = NULL;
 
@@ -25,16 +28,13 @@ static ElfLoader* interpreter = NULL;
  */
 void InitProcess()
 {
-	pthread_mutexattr_t attr;
-	pthread_mutexattr_init(&attr);
-	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-
-	int i = pthread_mutex_init(&lock, &attr);
-	if (i)
-		error("Failed to init process lock: %d!", i);
-
-	pthread_mutexattr_destroy(&attr);
+	BaseLock::ReinitAll();
 	InitGSStore();
+	InitFutexes();
+	InitThreads();
+	TimerThread::Init();
+	FD::InitTable();
+	NotifyFD::InitPipes();
 }
 
 /* Used once we've committed to loading a new executable. Deinits all
@@ -47,16 +47,6 @@ void FlushExecutable()
 	ClearBrk();
 }
 
-void Lock()
-{
-	pthread_mutex_lock(&lock);
-}
-
-void Unlock()
-{
-	pthread_mutex_unlock(&lock);
-}
-
 void RunElf(const string& pathname, const char* argv[], const char* environ[])
 {
 	int argvsize;
@@ -66,6 +56,16 @@ void RunElf(const string& pathname, const char* argv[], const char* environ[])
 	executable = new ElfLoader();
 	interpreter = NULL;
 
+	/* Remember where the executable really is, for /proc/self/exe; the
+	 * guest may chdir() away later. */
+
+	{
+		Ref<VFSNode> node;
+		string leaf;
+		VFS::Resolve(NULL, pathname, node, leaf);
+		Options.Executable = node->GetPath() + "/" + leaf;
+	}
+
 	executable->Open(pathname);
 
 	if (executable->HasInterpreter())